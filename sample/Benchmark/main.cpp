@@ -0,0 +1,531 @@
+#include "../common/common.hpp"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Headless micro benchmark of the sample/common image kernels on synthetic
+// frames, no camera needed. The depth codec also runs on recorded depth
+// with -depth. Exits with 1 if a kernel that should be allocation free in
+// steady state (depth rendering) allocated.
+//
+//   Benchmark [-filter <substr>] [-res <WxH>] [-time <seconds>] [-json <file>]
+//             [-depth <file.tyrec|file.tyd>]
+
+//------------------------------------------------------------------------------
+// allocation counting
+//------------------------------------------------------------------------------
+static std::atomic<long> g_allocs(0);
+
+#if defined(__GLIBC__)
+// cv::Mat data comes from malloc family, not operator new, so count there
+# include <errno.h>
+extern "C" {
+void* __libc_malloc(size_t);
+void* __libc_calloc(size_t, size_t);
+void* __libc_realloc(void*, size_t);
+void* __libc_memalign(size_t, size_t);
+
+void* malloc(size_t n) { g_allocs++; return __libc_malloc(n); }
+void* calloc(size_t c, size_t n) { g_allocs++; return __libc_calloc(c, n); }
+void* realloc(void* p, size_t n) { g_allocs++; return __libc_realloc(p, n); }
+void* memalign(size_t a, size_t n) { g_allocs++; return __libc_memalign(a, n); }
+void* aligned_alloc(size_t a, size_t n) { g_allocs++; return __libc_memalign(a, n); }
+int posix_memalign(void** p, size_t a, size_t n)
+{
+    g_allocs++;
+    *p = __libc_memalign(a, n);
+    return *p ? 0 : ENOMEM;
+}
+}
+#else
+# include <new>
+void* operator new(size_t n)
+{
+    g_allocs++;
+    void* p = malloc(n ? n : 1);
+    if(!p){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+void* operator new[](size_t n) { return operator new(n); }
+void operator delete(void* p) throw() { free(p); }
+void operator delete[](void* p) throw() { free(p); }
+#endif
+
+//------------------------------------------------------------------------------
+// runner
+//------------------------------------------------------------------------------
+struct BenchResult {
+    std::string kernel;
+    int         width;
+    int         height;
+    long        iterations;
+    double      nsPerPixel;
+    double      mbPerSec;
+    double      allocsPerIter;
+};
+
+struct BenchConfig {
+    const char* filter;
+    int         width;
+    int         height;
+    double      seconds;
+};
+
+static BenchConfig              g_config;
+static std::vector<BenchResult> g_results;
+static int                      g_allocFailures = 0;
+
+static double nowSeconds()
+{
+    return monotonicNs() / 1e9;
+}
+
+/// Run fn() until the time budget is spent, after one untimed warm up call
+/// which is allowed to allocate. bytes is the input size of one call. A
+/// kernel that is meant to be allocationFree fails the run if it allocates
+/// after the warm up.
+template<typename Fn>
+static void runBench(const char* kernel, int w, int h, size_t bytes, Fn fn
+        , bool allocationFree = false)
+{
+    if(g_config.filter && !strstr(kernel, g_config.filter)){
+        return;
+    }
+
+    fn();
+
+    long allocs = g_allocs;
+    long iters = 0;
+    double start = nowSeconds();
+    double elapsed = 0;
+    do {
+        fn();
+        iters++;
+        elapsed = nowSeconds() - start;
+    } while(elapsed < g_config.seconds || iters < 3);
+    allocs = g_allocs - allocs;
+
+    BenchResult r;
+    r.kernel = kernel;
+    r.width = w;
+    r.height = h;
+    r.iterations = iters;
+    r.nsPerPixel = elapsed * 1e9 / iters / ((double)w * h);
+    r.mbPerSec = (double)bytes * iters / elapsed / (1024. * 1024.);
+    r.allocsPerIter = (double)allocs / iters;
+    g_results.push_back(r);
+
+    LOGI("%-32s %4dx%-4d %9.3f ns/px %9.1f MB/s %7.2f allocs/iter"
+            , kernel, w, h, r.nsPerPixel, r.mbPerSec, r.allocsPerIter);
+    if(allocationFree && allocs != 0){
+        LOGE("%s allocates in steady state, %ld allocations in %ld iterations"
+                , kernel, allocs, iters);
+        g_allocFailures++;
+    }
+}
+
+static void writeJson(const char* file)
+{
+    FILE* fp = fopen(file, "w");
+    if(!fp){
+        LOGE("Open %s failed", file);
+        return;
+    }
+    fprintf(fp, "{\n  \"results\": [\n");
+    for(size_t i = 0; i < g_results.size(); i++){
+        const BenchResult& r = g_results[i];
+        fprintf(fp, "    {\"kernel\": \"%s\", \"width\": %d, \"height\": %d"
+                ", \"iterations\": %ld, \"ns_per_pixel\": %.4f, \"mb_per_s\": %.2f"
+                ", \"allocs_per_iter\": %.3f}%s\n"
+                , r.kernel.c_str(), r.width, r.height, r.iterations
+                , r.nsPerPixel, r.mbPerSec, r.allocsPerIter
+                , i + 1 < g_results.size() ? "," : "");
+    }
+    fprintf(fp, "  ]\n}\n");
+    fclose(fp);
+}
+
+//------------------------------------------------------------------------------
+// synthetic frames
+//------------------------------------------------------------------------------
+static uint32_t g_seed = 12345;
+static inline uint32_t fastRand()
+{
+    g_seed = g_seed * 1664525u + 1013904223u;
+    return g_seed >> 8;
+}
+
+/// Tilted plane with ripples and some invalid blobs, like a real scene.
+static void makeDepth(cv::Mat& depth, int w, int h)
+{
+    depth.create(h, w, CV_16U);
+    for(int y = 0; y < h; y++){
+        uint16_t* p = depth.ptr<uint16_t>(y);
+        for(int x = 0; x < w; x++){
+            float v = 800.f + 2000.f * y / h + 300.f * std::sin(x * 0.05f) + (fastRand() & 15);
+            bool hole = ((x / 37 + y / 23) % 11) == 0;
+            p[x] = hole ? 0 : (uint16_t)v;
+        }
+    }
+}
+
+static void makeBytes(std::vector<uint8_t>& buf, size_t n)
+{
+    buf.resize(n);
+    for(size_t i = 0; i < n; i++){
+        buf[i] = (uint8_t)((i * 7 + (fastRand() & 31)) & 0xff);
+    }
+}
+
+static void makePoints(const cv::Mat& depth, cv::Mat& points)
+{
+    const float f = depth.cols * 0.9f;
+    points.create(depth.size(), CV_32FC3);
+    for(int y = 0; y < depth.rows; y++){
+        const uint16_t* d = depth.ptr<uint16_t>(y);
+        float* p = points.ptr<float>(y);
+        for(int x = 0; x < depth.cols; x++, p += 3){
+            if(d[x] == 0){
+                p[0] = p[1] = p[2] = std::numeric_limits<float>::quiet_NaN();
+                continue;
+            }
+            p[0] = (x - depth.cols / 2) * d[x] / f;
+            p[1] = (y - depth.rows / 2) * d[x] / f;
+            p[2] = d[x];
+        }
+    }
+}
+
+static void setImage(TY_FRAME_DATA& frame, int32_t comp, int32_t fmt
+        , int w, int h, void* buffer, int32_t size)
+{
+    TY_IMAGE_DATA& img = frame.image[frame.validCount++];
+    memset(&img, 0, sizeof(img));
+    img.componentID = comp;
+    img.pixelFormat = fmt;
+    img.width = w;
+    img.height = h;
+    img.buffer = buffer;
+    img.size = size;
+}
+
+/// Lossless coding of depth, and the size it comes down to.
+static void benchDepthCodec(const cv::Mat& depth, const char* suffix)
+{
+    const int w = depth.cols;
+    const int h = depth.rows;
+    const size_t px = (size_t)w * h;
+    char name[64];
+    std::vector<uint8_t> coded(depthCodedBound(w, h));
+    cv::Mat decoded(h, w, CV_16U);
+    size_t size = 0;
+
+    sprintf(name, "depth_encode%s", suffix);
+    runBench(name, w, h, px * 2, [&]{
+            size = encodeDepth16(depth.ptr<uint16_t>(), w, h, (int)depth.step1(), &coded[0]); });
+    sprintf(name, "depth_decode%s", suffix);
+    runBench(name, w, h, px * 2, [&]{
+            decodeDepth16(&coded[0], size, decoded.ptr<uint16_t>(), w, h, w); });
+    if(!size){
+        return;     // filtered out
+    }
+
+    bool lossless = true;
+    for(int y = 0; y < h && lossless; y++){
+        lossless = memcmp(depth.ptr<uint16_t>(y), decoded.ptr<uint16_t>(y), w * sizeof(uint16_t)) == 0;
+    }
+    LOGI("%-32s %4dx%-4d %9.2f ratio %s", "depth_codec", w, h, px * 2. / size
+            , lossless ? "lossless" : "MISMATCH");
+}
+
+/// First depth image of a recording (.tyrec) or a depth stream (.tyd)
+static bool loadDepth(const char* path, cv::Mat& depth)
+{
+    DepthStreamReader stream;
+    if(stream.open(path)){
+        std::vector<uint16_t> data;
+        int w, h;
+        if(!stream.read(data, &w, &h)){
+            return false;
+        }
+        depth = cv::Mat(h, w, CV_16U, &data[0]).clone();
+        return true;
+    }
+
+    FrameRecordReader reader;
+    if(!reader.open(path)){
+        return false;
+    }
+    std::vector<uint8_t> buffer;
+    for(int i = 0; i < reader.frameCount(); i++){
+        buffer.resize(reader.unpackedSize(i));
+        TY_FRAME_DATA frame;
+        if(buffer.empty() || !reader.unpack(i, TY_COMPONENT_DEPTH_CAM, &buffer[0], (int32_t)buffer.size(), frame)){
+            continue;
+        }
+        const TY_IMAGE_DATA* img = TYImageInFrame(frame, TY_COMPONENT_DEPTH_CAM);
+        if(img && img->pixelFormat == TY_PIXEL_FORMAT_DEPTH16){
+            depth = cv::Mat(img->height, img->width, CV_16U, img->buffer).clone();
+            return true;
+        }
+    }
+    return false;
+}
+
+static void benchResolution(int w, int h)
+{
+    const size_t px = (size_t)w * h;
+    char name[64];
+
+    cv::Mat depth;
+    makeDepth(depth, w, h);
+
+    // ---- depth render
+    {
+        DepthRender render;
+        cv::Mat out;
+        runBench("depth_render_dynamic", w, h, px * 2, [&]{ render.Compute(depth, out); }, true);
+        render.SetRangeMode(DepthRender::COLOR_RANGE_ABS);
+        render.SetColorRange(500, 4000);
+        runBench("depth_render_abs", w, h, px * 2, [&]{ render.Compute(depth, out); }, true);
+
+        ThreadPool pool;
+        DepthRender prender;
+        prender.SetThreadPool(&pool);
+        runBench("depth_render_dynamic_pool", w, h, px * 2, [&]{ prender.Compute(depth, out); }, true);
+        prender.SetRangeMode(DepthRender::COLOR_RANGE_ABS);
+        prender.SetColorRange(500, 4000);
+        runBench("depth_render_abs_pool", w, h, px * 2, [&]{ prender.Compute(depth, out); }, true);
+
+        DepthViewer viewer;
+        runBench("depth_viewer_render", w, h, px * 2, [&]{ viewer.render(depth); }, true);
+
+        DepthHistogram hist;
+        runBench("depth_histogram", w, h, px * 2, [&]{ hist.Reset(); hist.Add(depth); });
+    }
+
+    benchDepthCodec(depth, "");
+
+    // ---- parseFrame, one color format at a time
+    struct ColorFormat { int32_t fmt; int bpp; const char* name; };
+    const ColorFormat formats[] = {
+        {TY_PIXEL_FORMAT_YUYV,      2, "yuyv"},
+        {TY_PIXEL_FORMAT_YVYU,      2, "yvyu"},
+        {TY_PIXEL_FORMAT_RGB,       3, "rgb"},
+        {TY_PIXEL_FORMAT_BAYER8GB,  1, "bayer8gb"},
+        {TY_PIXEL_FORMAT_MONO,      1, "mono"},
+    };
+    std::vector<uint8_t> raw;
+    cv::Mat color;
+    for(size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++){
+        makeBytes(raw, px * formats[i].bpp);
+        TY_FRAME_DATA frame;
+        memset(&frame, 0, sizeof(frame));
+        setImage(frame, TY_COMPONENT_RGB_CAM, formats[i].fmt, w, h, &raw[0], (int32_t)raw.size());
+        sprintf(name, "parse_color_%s", formats[i].name);
+        runBench(name, w, h, raw.size(), [&]{ parseFrame(frame, 0, 0, 0, &color, 0); });
+    }
+
+    // ---- bayer demosaic modes
+    makeBytes(raw, px);
+    runBench("bayer_bilinear", w, h, raw.size(), [&]{
+            bayer8GBToBGR(&raw[0], w, h, color, BAYER_BILINEAR); });
+    runBench("bayer_bin_2x2", w, h, raw.size(), [&]{
+            bayer8GBToBGR(&raw[0], w, h, color, BAYER_BIN_2X2); });
+
+    // ---- fused YUV422 conversion + downscale
+    makeBytes(raw, px * 2);
+    runBench("yuv422_to_bgr_half_box", w, h, raw.size(), [&]{
+            yuv422ToBGR(&raw[0], w, h, TY_PIXEL_FORMAT_YUYV, color, 2, YUV_SCALE_BOX); });
+    runBench("yuv422_to_bgr_quarter_bilinear", w, h, raw.size(), [&]{
+            yuv422ToBGR(&raw[0], w, h, TY_PIXEL_FORMAT_YUYV, color, 4, YUV_SCALE_BILINEAR); });
+
+    {
+        // jpeg payload lives in a frame sized buffer, like the camera does
+        cv::Mat bgr(h, w, CV_8UC3);
+        makeBytes(raw, px * 3);
+        memcpy(bgr.data, &raw[0], raw.size());
+        std::vector<uint8_t> jpeg;
+        cv::imencode(".jpg", bgr, jpeg);
+        raw.assign(px * 3, 0);
+        memcpy(&raw[0], &jpeg[0], jpeg.size() < raw.size() ? jpeg.size() : raw.size());
+        TY_FRAME_DATA frame;
+        memset(&frame, 0, sizeof(frame));
+        setImage(frame, TY_COMPONENT_RGB_CAM, TY_PIXEL_FORMAT_JPEG, w, h, &raw[0], (int32_t)jpeg.size());
+        runBench("parse_color_jpeg", w, h, jpeg.size(), [&]{ parseFrame(frame, 0, 0, 0, &color, 0); });
+
+        JpegDecoder decoder;
+        runBench("jpeg_decode", w, h, jpeg.size(), [&]{ decoder.decode(&raw[0], jpeg.size(), color); });
+        decoder.setScale(4);
+        runBench("jpeg_decode_quarter", w, h, jpeg.size(), [&]{ decoder.decode(&raw[0], jpeg.size(), color); });
+    }
+
+    // ---- depth / point3d views and point cloud export
+    cv::Mat points;
+    makePoints(depth, points);
+    {
+        TY_FRAME_DATA frame;
+        memset(&frame, 0, sizeof(frame));
+        setImage(frame, TY_COMPONENT_DEPTH_CAM, TY_PIXEL_FORMAT_DEPTH16, w, h, depth.data, (int32_t)px * 2);
+        setImage(frame, TY_COMPONENT_POINT3D_CAM, TY_PIXEL_FORMAT_FPOINT3D, w, h, points.data, (int32_t)px * 12);
+        cv::Mat d, p;
+        runBench("parse_depth_point3d", w, h, px * 14, [&]{ parseFrame(frame, &d, 0, 0, 0, &p); });
+    }
+
+    // ---- depth to points, per pixel division against the ray tables
+    {
+        TY_CAMERA_INTRINSIC intri;
+        memset(&intri, 0, sizeof(intri));
+        intri.data[0] = intri.data[4] = w * 0.9f;
+        intri.data[2] = w / 2.f;
+        intri.data[5] = h / 2.f;
+        intri.data[8] = 1.f;
+        cv::Mat p(h, w, CV_32FC3);
+        runBench("depth_to_world_divide", w, h, px * 2, [&]{
+                const float* k = intri.data;
+                for(int y = 0; y < h; y++){
+                    const uint16_t* d = depth.ptr<uint16_t>(y);
+                    cv::Point3f* o = p.ptr<cv::Point3f>(y);
+                    for(int x = 0; x < w; x++){
+                        o[x].x = (x - k[2]) * d[x] / k[0];
+                        o[x].y = (y - k[5]) * d[x] / k[4];
+                        o[x].z = d[x];
+                    }
+                } });
+        DepthToWorld toWorld;
+        toWorld.setup(intri, w, h);
+        runBench("depth_to_world", w, h, px * 2, [&]{
+                toWorld.convert(depth.ptr<uint16_t>(), (int)depth.step1(), (TY_VECT_3F*)p.data); });
+        std::vector<float> planes(px * 3);
+        runBench("depth_to_world_planar", w, h, px * 2, [&]{
+                toWorld.convertPlanar(depth.ptr<uint16_t>(), (int)depth.step1()
+                        , &planes[0], &planes[px], &planes[px * 2]); });
+    }
+
+    // ---- depth to color registration, color at twice the depth size
+    {
+        DepthRegistration::Calibration calib;
+        memset(&calib, 0, sizeof(calib));
+        calib.depth.data[0] = calib.depth.data[4] = w * 0.9f;
+        calib.depth.data[2] = w / 2.f;
+        calib.depth.data[5] = h / 2.f;
+        calib.depth.data[8] = 1.f;
+        calib.color.data[0] = calib.color.data[4] = w * 1.8f;
+        calib.color.data[2] = (float)w;
+        calib.color.data[5] = (float)h;
+        calib.color.data[8] = 1.f;
+        float* e = calib.depthToColor.data;
+        e[0] = e[5] = e[10] = e[15] = 1.f;
+        e[3] = -25.f;
+        cv::Mat registered(h * 2, w * 2, CV_16U);
+        DepthRegistration reg;
+        reg.setup(calib, w, h, w * 2, h * 2, w * 2, h * 2);
+        runBench("depth_register_color_size", w, h, px * 2, [&]{
+                reg.run(depth.ptr<uint16_t>(), (int)depth.step1()
+                        , registered.ptr<uint16_t>(), (int)registered.step1()); });
+        reg.setup(calib, w, h, w * 2, h * 2, w, h);
+        runBench("depth_register_depth_size", w, h, px * 2, [&]{
+                reg.run(depth.ptr<uint16_t>(), (int)depth.step1()
+                        , registered.ptr<uint16_t>(), (int)registered.step1()); });
+
+        ThreadPool pool;
+        DepthRegistration preg;
+        preg.setThreadPool(&pool);
+        preg.setup(calib, w, h, w * 2, h * 2, w * 2, h * 2);
+        runBench("depth_register_color_size_pool", w, h, px * 2, [&]{
+                preg.run(depth.ptr<uint16_t>(), (int)depth.step1()
+                        , registered.ptr<uint16_t>(), (int)registered.step1()); });
+
+        // color on the depth grid, cost follows the depth size
+        cv::Mat color(h * 2, w * 2, CV_8UC3, cv::Scalar(40, 120, 200));
+        cv::Mat aligned(h, w, CV_8UC4);
+        ColorToDepth toDepth;
+        toDepth.setup(calib, w, h, w * 2, h * 2, w * 2, h * 2);
+        runBench("color_to_depth_bgr", w, h, px * 2, [&]{
+                toDepth.run(depth.ptr<uint16_t>(), (int)depth.step1(), color.data, (int)color.step
+                        , aligned.data, w * 3, ColorToDepth::OUTPUT_BGR); });
+        runBench("color_to_depth_rgba", w, h, px * 2, [&]{
+                toDepth.run(depth.ptr<uint16_t>(), (int)depth.step1(), color.data, (int)color.step
+                        , aligned.data, (int)aligned.step, ColorToDepth::OUTPUT_RGBA); });
+    }
+
+    const char* pcFile = "bench_points.tmp";
+    runBench("write_point_cloud_xyz", w, h, px * 12, [&]{
+            writePointCloud((const cv::Point3f*)points.data, px, pcFile, PC_FILE_FORMAT_XYZ); });
+    runBench("write_point_cloud_ply", w, h, px * 12, [&]{
+            writePointCloud((const cv::Point3f*)points.data, px, pcFile, PC_FILE_FORMAT_PLY); });
+    runBench("write_point_cloud_pcd", w, h, px * 12, [&]{
+            writePointCloud((const cv::Point3f*)points.data, px, pcFile, PC_FILE_FORMAT_PCD); });
+    runBench("write_point_cloud_pcd_compressed", w, h, px * 12, [&]{
+            writePointCloud((const cv::Point3f*)points.data, px, pcFile, PC_FILE_FORMAT_PCD_COMPRESSED); });
+    remove(pcFile);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* json = NULL;
+    const char* depthFile = NULL;
+    g_config.filter = NULL;
+    g_config.width = 0;
+    g_config.height = 0;
+    g_config.seconds = 0.2;
+
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-filter") == 0 && i + 1 < argc){
+            g_config.filter = argv[++i];
+        }else if(strcmp(argv[i], "-res") == 0 && i + 1 < argc){
+            sscanf(argv[++i], "%dx%d", &g_config.width, &g_config.height);
+        }else if(strcmp(argv[i], "-time") == 0 && i + 1 < argc){
+            g_config.seconds = atof(argv[++i]);
+        }else if(strcmp(argv[i], "-json") == 0 && i + 1 < argc){
+            json = argv[++i];
+        }else if(strcmp(argv[i], "-depth") == 0 && i + 1 < argc){
+            depthFile = argv[++i];
+        }else if(strcmp(argv[i], "-h") == 0){
+            LOGI("Usage: Benchmark [-h] [-filter <substr>] [-res <WxH>] [-time <seconds>] [-json <file>]"
+                    " [-depth <file.tyrec|file.tyd>]");
+            LOGI("    -depth: also run the depth codec on recorded depth");
+            return 0;
+        }
+    }
+
+    // every resolution of TY_IMAGE_MODE_LIST
+    const TY_IMAGE_MODE modes[] = {
+        TY_IMAGE_MODE_160x120,
+        TY_IMAGE_MODE_320x240,
+        TY_IMAGE_MODE_640x480,
+        TY_IMAGE_MODE_1280x960,
+        TY_IMAGE_MODE_2592x1944,
+    };
+    for(size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); i++){
+        int w = modes[i] >> 12;
+        int h = modes[i] & 0xfff;
+        if(g_config.width && (w != g_config.width || h != g_config.height)){
+            continue;
+        }
+        LOGI("=== %dx%d", w, h);
+        benchResolution(w, h);
+    }
+
+    if(depthFile){
+        cv::Mat depth;
+        if(loadDepth(depthFile, depth)){
+            LOGI("=== recorded depth %s", depthFile);
+            benchDepthCodec(depth, "_recorded");
+        } else {
+            LOGE("No depth image in %s", depthFile);
+        }
+    }
+
+    if(json){
+        writeJson(json);
+        LOGI("=== Results written to %s", json);
+    }
+    if(g_allocFailures){
+        LOGE("=== %d kernels allocate in steady state", g_allocFailures);
+        return 1;
+    }
+    return 0;
+}
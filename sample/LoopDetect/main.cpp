@@ -17,12 +17,17 @@ void eventCallback(TY_EVENT_INFO *event_info, void *userdata)
 int main(int argc, char* argv[])
 {
     const char* gID = NULL;
+    bool rawDepth = false;
 
     for(int i = 1; i < argc; i++){
         if(strcmp(argv[i], "-id") == 0){
             gID = argv[++i];
+        }else if(strcmp(argv[i], "-rawdepth") == 0){
+            rawDepth = true;
         }else if(strcmp(argv[i], "-h") == 0){
-            LOGI("Usage: SimpleView_Callback [-h] [-id <ID>]");
+            LOGI("Usage: SimpleView_Callback [-h] [-id <ID>] [-rawdepth]");
+            LOGI("    -rawdepth: record depth uncoded, it is losslessly coded by default");
+            LOGI("    keys: s start/stop recording to <N>.tyrec, q reconnect, x exit");
             return 0;
         }
     }
@@ -55,9 +60,10 @@ int main(int argc, char* argv[])
             }
         }
 
+        // ID points into baseInfo, keep it alive for the whole loop
+        TY_DEVICE_BASE_INFO baseInfo;
         if(ID == NULL){
             LOGD("=== Get device info");
-            TY_DEVICE_BASE_INFO baseInfo;
             ASSERT_OK( TYGetDeviceList(&baseInfo, 1, &n) );
 
             if(n == 0){
@@ -92,13 +98,8 @@ int main(int argc, char* argv[])
         ASSERT( frameSize >= 640*480*2 );
 
         LOGD("     - Allocate & enqueue buffers");
-        char* frameBuffer[2];
-        frameBuffer[0] = new char[frameSize];
-        frameBuffer[1] = new char[frameSize];
-        LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[0], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[0], frameSize) );
-        LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[1], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[1], frameSize) );
+        FrameBufferPool pool;
+        ASSERT_OK( pool.init(hDevice, 2) );
 
         bool device_offline = false;;
         LOGD("=== Register event callback");
@@ -117,8 +118,9 @@ int main(int argc, char* argv[])
         LOGD("=== Start capture");
         ASSERT_OK( TYStartCapture(hDevice) );
 
-        bool saveFrame = false;
+        bool recording = false;
         int saveIdx = 0;
+        FrameRecordWriter recorder;
         cv::Mat depth;
         cv::Mat leftIR;
         cv::Mat rightIR;
@@ -129,18 +131,28 @@ int main(int argc, char* argv[])
         DepthViewer depthViewer;
         int count = 0;
         TY_FRAME_DATA frame;
+        FrameView view;
         while(!exit_main){
-            int err = TYFetchFrame(hDevice, &frame, 100);
+            int err = pool.fetch(&frame, 100);
             if( err == TY_STATUS_OK ) {
                 LOGD("=== Get frame %d", ++count);
-                parseFrame(frame, &depth, &leftIR, &rightIR, &color, NULL);
+                view.reset(frame);
+                depth = view.depth16();
+                leftIR = view.mono8(TY_COMPONENT_IR_CAM_LEFT);
+                rightIR = view.mono8(TY_COMPONENT_IR_CAM_RIGHT);
+                color = view.colorBGR();
 
                 if(!color.empty()){
-                    LOGI("Color format is %s", colorFormatName(TYImageInFrame(frame, TY_COMPONENT_RGB_CAM)->pixelFormat));
+                    LOGI("Color format is %s", colorFormatName(view.image(TY_COMPONENT_RGB_CAM)->pixelFormat));
+                }
+
+                // only copies the frame, the disk is written on another thread
+                if(recording && !recorder.write(frame)){
+                    LOGW("Recording fell behind, frame %d dropped", count);
                 }
 
                 LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame.userBuffer, frame.bufferSize);
-                ASSERT_OK( TYEnqueueBuffer(hDevice, frame.userBuffer, frame.bufferSize) );
+                ASSERT_OK( pool.enqueue(frame.userBuffer) );
                 if(!depth.empty()){
                     depthViewer.show("LoopDetect", depth);
                 }
@@ -154,18 +166,6 @@ int main(int argc, char* argv[])
                     cv::imshow("color", color);
                 }
 
-                if(saveFrame && !depth.empty() && !leftIR.empty() && !rightIR.empty()){
-                    LOGI(">>>> save frame %d", saveIdx);
-                    char f[32];
-                    sprintf(f, "%d.img", saveIdx++);
-                    FILE* fp = fopen(f, "wb");
-                    fwrite(depth.data, 2, depth.size().area(), fp);
-                    fwrite(color.data, 3, color.size().area(), fp);
-
-                    fclose(fp);
-
-                    saveFrame = false;
-                }
             }
               
             if(device_offline){
@@ -181,7 +181,25 @@ int main(int argc, char* argv[])
                     exit_main = true;
                     break;
                 case 's':
-                    saveFrame = true;
+                    if(!recording){
+                        char f[64];
+                        sprintf(f, "%d.tyrec", saveIdx++);
+                        if(recorder.open(f)){
+                            recorder.setDeviceId(ID);
+                            recorder.addCalibration(hDevice);
+                            recorder.setDepthCoding(!rawDepth);
+                            recording = true;
+                            LOGI(">>>> start recording %s", f);
+                        } else {
+                            LOGE("Can not create %s", f);
+                        }
+                    } else {
+                        recording = false;
+                        FrameRecordWriter::Stats stats = recorder.stats();
+                        recorder.close();
+                        LOGI(">>>> stop recording, %d frames, %d dropped"
+                                , (int)stats.frames, (int)stats.dropped);
+                    }
                     break;
                 case 'x':
                     exit_main = true;
@@ -192,10 +210,10 @@ int main(int argc, char* argv[])
             }
         }
 
+        recorder.close();
         ASSERT_OK( TYStopCapture(hDevice) );
+        pool.release();
         ASSERT_OK( TYCloseDevice(hDevice) );
-        delete frameBuffer[0];
-        delete frameBuffer[1];
     }
 
     ASSERT_OK( TYDeinitLib() );
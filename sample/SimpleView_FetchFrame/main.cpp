@@ -5,49 +5,33 @@ static int  n;
 static volatile bool exit_main;
 
 static int fps_counter = 0;
-static clock_t fps_tm = 0;
+static int64_t fps_tm = 0;
 
-#ifdef _WIN32
 int get_fps() {
-   const int kMaxCounter = 250;
-   fps_counter++;
-   if (fps_counter < kMaxCounter) {
-     return -1;
-   }
-   int elapse = (clock() - fps_tm);
-   int v = (int)(((float)fps_counter) / elapse * CLOCKS_PER_SEC);
-   fps_tm = clock();
-
-   fps_counter = 0;
-   return v;
- }
-#else
-int get_fps() {
-  const int kMaxCounter = 200;
-  struct timeval start;
-  fps_counter++;
-  if (fps_counter < kMaxCounter) {
-    return -1;
-  }
-
-  gettimeofday(&start, NULL);
-  int elapse = start.tv_sec * 1000 + start.tv_usec / 1000 - fps_tm;
-  int v = (int)(((float)fps_counter) / elapse * 1000);
-  gettimeofday(&start, NULL);
-  fps_tm = start.tv_sec * 1000 + start.tv_usec / 1000;
-
-  fps_counter = 0;
-  return v;
+    const int kMaxCounter = 200;
+    fps_counter++;
+    if (fps_counter < kMaxCounter) {
+        return -1;
+    }
+
+    int64_t now = monotonicNs();
+    int v = (int)(fps_counter * 1e9 / (now - fps_tm));
+    fps_tm = now;
+
+    fps_counter = 0;
+    return v;
 }
-#endif
 
 struct CallbackData {
     int             index;
     TY_DEV_HANDLE   hDevice;
     DepthRender*    render;
+    cv::Mat         colorDepth;     // reused every frame
+    JpegDecodeQueue* jpeg;
+    cv::Mat         color;
 };
 
-void frameHandler(TY_FRAME_DATA* frame, void* userdata) {
+void frameHandler(const Frame& frame, void* userdata, FrameTrace& trace) {
     CallbackData* pData = (CallbackData*) userdata;
     LOGD("=== Get frame %d", ++pData->index);
 
@@ -55,17 +39,35 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata) {
 	if (ret > 0)
         printf("fps: %d\n", ret);
 
+    // jpeg color is decoded on worker threads, so the frame buffer can be
+    // re-enqueued without waiting for it
+    const TY_IMAGE_DATA* colorImage = TYImageInFrame(frame.data(), TY_COMPONENT_RGB_CAM);
+    bool jpeg = colorImage && colorImage->pixelFormat == TY_PIXEL_FORMAT_JPEG;
+
     cv::Mat depth, irl, irr, color;
-    parseFrame(*frame, &depth, &irl, &irr, &color, 0);
+    parseFrame(frame.data(), &depth, &irl, &irr, jpeg ? NULL : &color, 0);
+    trace.stamp(LatencyTrace::STAGE_PARSE);
+    if(jpeg){
+        if(!depth.empty()){
+            // decode at the smallest size that still covers the depth image
+            pData->jpeg->setScale(JpegDecoder::scaleFor(colorImage->width
+                        , colorImage->height, depth.size()));
+        }
+        pData->jpeg->push(*colorImage);
+        while(pData->jpeg->pop(pData->color, 0)){
+            color = pData->color;
+        }
+    }
     if(!depth.empty()){
-        cv::Mat colorDepth = pData->render->Compute(depth);
-        cv::imshow("ColorDepth", colorDepth);
+        pData->render->Compute(depth, pData->colorDepth);
+        cv::imshow("ColorDepth", pData->colorDepth);
     }
     if(!irl.empty()){ cv::imshow("LeftIR", irl); }
     if(!irr.empty()){ cv::imshow("RightIR", irr); }
     if(!color.empty()){ cv::imshow("Color", color); }
 
     int key = cv::waitKey(1);
+    trace.stamp(LatencyTrace::STAGE_RENDER);
     switch(key & 0xff) {
     case 0xff:
         break;
@@ -75,9 +77,6 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata) {
     default:
         LOGD("Unmapped key %d", key);
     }
-
-    LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-    ASSERT_OK( TYEnqueueBuffer(pData->hDevice, frame->userBuffer, frame->bufferSize) );
 }
 
 void eventCallback(TY_EVENT_INFO *event_info, void *userdata)
@@ -97,6 +96,10 @@ int main(int argc, char* argv[]) {
     TY_DEV_HANDLE hDevice;
     int32_t color, ir, depth;
     color = ir = depth = 1;
+    int bufferCount = 2;
+    int queueDepth = 2;
+    FrameQueue::Policy policy = FrameQueue::POLICY_DROP_OLDEST;
+    const char* tracePath = NULL;
 
     for(int i = 1; i < argc; i++) {
         if(strcmp(argv[i], "-ip") == 0) {
@@ -107,8 +110,25 @@ int main(int argc, char* argv[]) {
             depth = 0;
         } else if(strcmp(argv[i], "-ir=off") == 0) {
             ir = 0;
+        } else if(strcmp(argv[i], "-buffers") == 0 && i + 1 < argc) {
+            bufferCount = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-queue") == 0 && i + 1 < argc) {
+            queueDepth = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "-policy") == 0 && i + 1 < argc) {
+            const char* p = argv[++i];
+            if(strcmp(p, "block") == 0) {
+                policy = FrameQueue::POLICY_BLOCK;
+            } else if(strcmp(p, "newest") == 0) {
+                policy = FrameQueue::POLICY_DROP_NEWEST;
+            } else {
+                policy = FrameQueue::POLICY_DROP_OLDEST;
+            }
+        } else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc) {
+            tracePath = argv[++i];
         } else if(strcmp(argv[i], "-h") == 0) {
-            LOGI("Usage: SimpleView_FetchFrame [-h] [-ip <IP>]");
+            LOGI("Usage: SimpleView_FetchFrame [-h] [-ip <IP>] [-buffers <N>] [-queue <N>]"
+                    " [-policy block|oldest|newest] [-trace <file|->]");
+            LOGI("    -trace: write per stage latency percentiles every second");
             return 0;
         }
     }
@@ -181,14 +201,15 @@ int main(int argc, char* argv[]) {
     LOGD("     - Get size of framebuffer, %d", frameSize);
     ASSERT( frameSize >= 640 * 480 * 2 );
 
-    LOGD("     - Allocate & enqueue buffers");
-    char* frameBuffer[2];
-    frameBuffer[0] = new char[frameSize];
-    frameBuffer[1] = new char[frameSize];
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[0], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[0], frameSize) );
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[1], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[1], frameSize) );
+    // frames waiting in the capture queue hold buffers too, as many as the
+    // queue really holds, its depth rounded up
+    FrameBufferPool pool;
+    CaptureEngine engine(pool, queueDepth, policy);
+    bufferCount += engine.queue().capacity() + 1;
+    LOGD("     - Allocate & enqueue %d buffers", bufferCount);
+    ASSERT_OK( pool.init(hDevice, bufferCount, FrameBufferPool::ALLOC_THP) );
+    // add buffers instead of dropping frames when rendering falls behind
+    pool.setAutoGrow(bufferCount * 4);
 
     LOGD("=== Register callback");
     LOGD("Note: Callback may block internal data receiving,");
@@ -200,6 +221,8 @@ int main(int argc, char* argv[]) {
     cb_data.index = 0;
     cb_data.hDevice = hDevice;
     cb_data.render = &render;
+    JpegDecodeQueue jpegQueue(2);
+    cb_data.jpeg = &jpegQueue;
     // ASSERT_OK( TYRegisterCallback(hDevice, frameHandler, &cb_data) );
 
     LOGD("=== Register event callback");
@@ -216,25 +239,49 @@ int main(int argc, char* argv[]) {
     LOGD("=== Start capture");
     ASSERT_OK( TYStartCapture(hDevice) );
 
-    LOGD("=== While loop to fetch frame");
-    exit_main = false;
-    TY_FRAME_DATA frame;
+    LOGD("=== Fetch frames on the capture thread");
+    engine.start();
+
+    LatencyTrace trace;
+    if(tracePath && !trace.open(tracePath)) {
+        LOGE("Can not open %s", tracePath);
+    }
 
+    exit_main = false;
     while(!exit_main) {
-        int err = TYFetchFrame(hDevice, &frame, -1);
-        if( err != TY_STATUS_OK ) {
-            LOGD("... Drop one frame");
+        Frame frame;
+        if(!engine.next(frame, 2000)) {
+            LOGD("... No frame");
         } else {
-            frameHandler(&frame, &cb_data);
+            FrameTrace frameTrace(trace, frame);
+            frameHandler(frame, &cb_data, frameTrace);
+            frame.release();
+            frameTrace.stamp(LatencyTrace::STAGE_ENQUEUE);
+            frameTrace.finish();
         }
     }
+    trace.close();
+
+    CaptureEngine::Stats engineStats = engine.stats();
+    engine.stop();
+    LOGI("=== Queue: fetched %d, dropped %d, max depth %d/%d, blocked %.1fms"
+            , (int)engineStats.fetched, (int)engineStats.queue.dropped
+            , engineStats.queue.maxDepth, engine.queue().capacity()
+            , engineStats.queue.blockedMs);
 
     ASSERT_OK( TYStopCapture(hDevice) );
+    DeviceClock::Fit clockFit = pool.clockFit();
+    FrameBufferPool::Stats stats = pool.stats();
+    pool.release();
     ASSERT_OK( TYCloseDevice(hDevice) );
     ASSERT_OK( TYDeinitLib() );
-    // MSLEEP(10); // sleep to ensure buffer is not used any more
-    delete frameBuffer[0];
-    delete frameBuffer[1];
+
+    LOGI("=== Device clock drift %.1fppm, transfer jitter %.2fms"
+            , clockFit.driftPpm(), clockFit.jitterNs / 1e6);
+
+    LOGI("=== Buffers %d (grown %d), frames %d, starved %d, timeouts %d, dwell avg %.1fms max %.1fms"
+            , stats.buffers, stats.grown, (int)stats.frames, (int)stats.starved
+            , (int)stats.timeouts, stats.dwellAvgMs, stats.dwellMaxMs);
 
     LOGD("=== Main done!");
     return 0;
@@ -185,8 +185,8 @@ int main(int argc, char* argv[]) {
     ASSERT_OK( TYCloseDevice(hDevice) );
     ASSERT_OK( TYDeinitLib() );
     // MSLEEP(10); // sleep to ensure buffer is not used any more
-    delete frameBuffer[0];
-    delete frameBuffer[1];
+    delete[] frameBuffer[0];
+    delete[] frameBuffer[1];
 
     LOGD("=== Main done!");
     return 0;
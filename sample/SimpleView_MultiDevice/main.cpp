@@ -7,27 +7,27 @@ struct CamInfo
 {
     char                sn[32];
     TY_DEV_HANDLE       hDev;
-    char*               fb[2];
-    TY_FRAME_DATA       frame;
+    FrameBufferPool     pool;
     int                 idx;
     DepthRender         render;
+    cv::Mat             colorDepth;
 
-    CamInfo() : hDev(0), idx(0) {fb[0]=0; fb[1]=0;}
+    CamInfo() : hDev(0), idx(0) {}
 };
 
 
-void frameHandler(TY_FRAME_DATA* frame, void* userdata)
+void frameHandler(const Frame& frame, void* userdata)
 {
     CamInfo* pData = (CamInfo*) userdata;
 
     cv::Mat depth, irl, irr, color;
-    parseFrame(*frame, &depth, &irl, &irr, &color, 0);
+    parseFrame(frame.data(), &depth, &irl, &irr, &color, 0);
 
     char win[64];
     if(!depth.empty()){
-        cv::Mat colorDepth = pData->render.Compute(depth);
+        pData->render.Compute(depth, pData->colorDepth);
         sprintf(win, "depth-%s", pData->sn);
-        cv::imshow(win, colorDepth);
+        cv::imshow(win, pData->colorDepth);
     }
     if(!irl.empty()){
         sprintf(win, "LeftIR-%s", pData->sn);
@@ -43,13 +43,21 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata)
     }
 
     pData->idx++;
-
-    LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-    ASSERT_OK( TYEnqueueBuffer(pData->hDev, frame->userBuffer, frame->bufferSize) );
 }
 
-int main()
+int main(int argc, char* argv[])
 {
+    bool pin = false;
+    for(int i = 1; i < argc; i++){
+        if(strcmp(argv[i], "-pin") == 0){
+            pin = true;
+        } else if(strcmp(argv[i], "-h") == 0){
+            LOGI("Usage: SimpleView_MultiDevice [-h] [-pin]");
+            LOGI("    -pin: pin the fetch thread of device i to core i");
+            return 0;
+        }
+    }
+
     LOGD("=== Init lib");
     ASSERT_OK( TYInitLib() );
     TY_VERSION_INFO* pVer = (TY_VERSION_INFO*)buffer;
@@ -70,6 +78,8 @@ int main()
     }
 
     std::vector<CamInfo> cams(n);
+    // one fetch thread per device, a dead camera does not stall the others
+    MultiDeviceCapture capture(2 * n);
     for(int i = 0; i < n; i++){
         LOGD("=== Open device %d (id: %s)", i, pBaseInfo[i].id);
         strncpy(cams[i].sn, pBaseInfo[i].id, sizeof(cams[i].sn));
@@ -98,12 +108,10 @@ int main()
         ASSERT( frameSize >= 640*480*2 );
 
         LOGD("     - Allocate & enqueue buffers");
-        cams[i].fb[0] = new char[frameSize];
-        cams[i].fb[1] = new char[frameSize];
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[0], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[0], frameSize) );
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[1], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[1], frameSize) );
+        ASSERT_OK( cams[i].pool.init(cams[i].hDev, 4) );
+        // the merged queue may hold several frames of one device
+        cams[i].pool.setAutoGrow(2 * n + 2);
+        capture.addDevice(cams[i].pool, pin ? i : -1);
 
         // bool triggerMode = true;
         bool triggerMode = false;
@@ -116,17 +124,16 @@ int main()
 
     LOGD("=== While loop to fetch frame");
     bool exit_main = false;
+    capture.start();
 
     while(!exit_main){
-        for(int i = 0; i < cams.size(); i++) {
-            int err = TYFetchFrame(cams[i].hDev, &cams[i].frame, 1000);
-            if( err != TY_STATUS_OK ){
-                LOGD("cam %s %d ... Drop one frame", cams[i].sn, cams[i].idx);
-                continue;
-            }
-
-            frameHandler(&cams[i].frame, &cams[i]);
+        // show what arrived since the last key poll
+        Frame frame;
+        int dev;
+        while(capture.next(frame, &dev, 0)){
+            frameHandler(frame, &cams[dev]);
         }
+        frame.release();
 
         int key = cv::waitKey(1);
         switch(key & 0xff){
@@ -140,12 +147,15 @@ int main()
         }
     }
 
+    capture.stop();
     for(int i = 0; i < cams.size(); i++){
+        CaptureEngine::Stats stats = capture.deviceStats(i);
+        LOGI("=== cam %s: fetched %d, shown %d, errors %d, timeouts %d"
+                , cams[i].sn, (int)stats.fetched, cams[i].idx, (int)stats.errors
+                , (int)stats.pool.timeouts);
         ASSERT_OK( TYStopCapture(cams[i].hDev) );
+        cams[i].pool.release();
         ASSERT_OK( TYCloseDevice(cams[i].hDev) );
-        // MSLEEP(10); // sleep to ensure buffer is not used any more
-        delete cams[i].fb[0];
-        delete cams[i].fb[1];
     }
     ASSERT_OK( TYDeinitLib() );
 
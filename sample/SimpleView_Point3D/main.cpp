@@ -20,32 +20,80 @@ struct CallbackData {
 
     bool saveOneFramePoint3d;
     int  fileIndex;
+    int  saveFormat;
+    PointCloudWriter* writer;
+
+    // per point color, only with -color
+    bool withColor;
+    DepthRegistration::Calibration calib;
+    TY_CAMERA_DISTORTION colorDist;
+    ColorToDepth colorToDepth;
+    cv::Mat undistorted;
+    cv::Mat aligned;
 };
 
-cv::Point3f depthToWorld(float* intr, int x, int y, int z)
+static const char* fileExtension(int format)
 {
-    cv::Point3f world;
-    world.x = (x - intr[2]) * z / intr[0];
-    world.y = (y - intr[5]) * z / intr[4];
-    world.z = z;
-
-    return world;
+    switch(format){
+        case PC_FILE_FORMAT_PLY: return "ply";
+        case PC_FILE_FORMAT_PCD: case PC_FILE_FORMAT_PCD_COMPRESSED: return "pcd";
+        default: return "xyz";
+    }
 }
 
+// BGR of every depth pixel, which with host points is every point. NULL
+// if the frame has no color.
+static const uint8_t* pointColors(const TY_FRAME_DATA& frame, const cv::Mat& depth
+        , const cv::Mat& color, CallbackData* pData)
+{
+    const TY_IMAGE_DATA* colorImage = TYImageInFrame(frame, TY_COMPONENT_RGB_CAM);
+    if(depth.empty() || color.empty() || !colorImage){
+        return NULL;
+    }
+    // ColorToDepth samples the undistorted image
+    pData->undistorted.create(color.size(), CV_8UC3);
+    TY_IMAGE_DATA src, dst;
+    src.width = dst.width = color.cols;
+    src.height = dst.height = color.rows;
+    src.size = dst.size = (int32_t)color.total() * 3;
+    src.pixelFormat = dst.pixelFormat = TY_PIXEL_FORMAT_RGB;
+    src.buffer = color.data;
+    dst.buffer = pData->undistorted.data;
+    TY_CAMERA_INTRINSIC colorIntri = pData->calib.color;
+    if(TYUndistortImage(&colorIntri, &pData->colorDist, NULL, &src, &dst) != TY_STATUS_OK
+            || !pData->colorToDepth.setup(pData->calib, depth.cols, depth.rows
+                , colorImage->width, colorImage->height, color.cols, color.rows)){
+        return NULL;
+    }
+    pData->aligned.create(depth.size(), CV_8UC3);
+    pData->colorToDepth.run(depth.ptr<uint16_t>(), (int)depth.step1()
+            , pData->undistorted.data, (int)pData->undistorted.step
+            , pData->aligned.data, (int)pData->aligned.step, ColorToDepth::OUTPUT_BGR);
+    return pData->aligned.data;
+}
 
-void frameHandler(TY_FRAME_DATA* frame, void* userdata)
+void frameHandler(const TY_FRAME_DATA& frame, void* userdata)
 {
     CallbackData* pData = (CallbackData*) userdata;
     LOGD("=== Get frame %d", ++pData->index);
 
     cv::Mat depth, color, p3d;
-    parseFrame(*frame, &depth, 0, 0, &color, &p3d);
-    if(pData->saveOneFramePoint3d){
+    parseFrame(frame, &depth, 0, 0, &color, &p3d);
+    if(pData->saveOneFramePoint3d && !p3d.empty()){
+        const uint8_t* bgr = NULL;
+        if(pData->withColor && depth.total() == p3d.total()){
+            bgr = pointColors(frame, depth, color, pData);
+        }
         char file[32];
-        sprintf(file, "points-%d.xyz", pData->fileIndex++);
-        writePointCloud((cv::Point3f*)p3d.data, p3d.total(), file, PC_FILE_FORMAT_XYZ);
-        pData->saveOneFramePoint3d = false;
-        imshow("depth", depth * 32);
+        sprintf(file, "points-%d.%s", pData->fileIndex, fileExtension(pData->saveFormat));
+        // written in the background, a save still in progress just retries
+        // with the next frame
+        if(pData->writer->write((cv::Point3f*)p3d.data, p3d.total(), file, pData->saveFormat, bgr)){
+            LOGD("Saving %s%s", file, bgr ? " with color" : "");
+            pData->fileIndex++;
+            pData->saveOneFramePoint3d = false;
+            imshow("depth", depth * 32);
+        }
     }
 
     if(!depth.empty()){
@@ -76,9 +124,6 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata)
         default:
             LOGD("Pressed key %d", key);
     }
-
-    LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-    ASSERT_OK( TYEnqueueBuffer(pData->hDevice, frame->userBuffer, frame->bufferSize) );
 }
 
 int main(int argc, char* argv[])
@@ -86,6 +131,9 @@ int main(int argc, char* argv[])
     const char* IP = NULL;
     const char* ID = NULL;
     const char* file = NULL;
+    bool hostPoints = false;
+    bool withColor = false;
+    int saveFormat = PC_FILE_FORMAT_PLY;
     TY_DEV_HANDLE hDevice;
 
     for(int i = 1; i < argc; i++){
@@ -93,8 +141,21 @@ int main(int argc, char* argv[])
             ID = argv[++i];
         }else if(strcmp(argv[i], "-ip") == 0){
             IP = argv[++i];
+        }else if(strcmp(argv[i], "-hostpoints") == 0){
+            hostPoints = true;
+        }else if(strcmp(argv[i], "-color") == 0){
+            withColor = true;
+        }else if(strcmp(argv[i], "-format") == 0 && i + 1 < argc){
+            const char* f = argv[++i];
+            saveFormat = strcmp(f, "xyz") == 0 ? PC_FILE_FORMAT_XYZ
+                    : strcmp(f, "pcd") == 0 ? PC_FILE_FORMAT_PCD
+                    : strcmp(f, "pcdc") == 0 ? PC_FILE_FORMAT_PCD_COMPRESSED
+                    : PC_FILE_FORMAT_PLY;
         }else if(strcmp(argv[i], "-h") == 0){
-            LOGI("Usage: SimpleView_Callback [-h] [-ip <IP>] [-id <ID>]");
+            LOGI("Usage: SimpleView_Callback [-h] [-ip <IP>] [-id <ID>] [-hostpoints] [-color] [-format <ply|pcd|pcdc|xyz>]");
+            LOGI("    -hostpoints: transfer depth and compute point clouds on the host");
+            LOGI("    -color: save point clouds with the color of each point, implies -hostpoints");
+            LOGI("    -format: file format of saved point clouds, default binary ply");
             return 0;
         }
     }
@@ -143,6 +204,15 @@ int main(int argc, char* argv[])
             hasColor = true;
         }
     }
+    if(withColor && !hasColor){
+        LOGE("=== Has no RGB camera, point clouds are saved without color");
+        withColor = false;
+    }
+    if(withColor){
+        ASSERT_OK( TYEnableComponents(hDevice, TY_COMPONENT_RGB_CAM) );
+        // colors are sampled per depth pixel, so depth has to come along
+        hostPoints = true;
+    }
 
     LOGD("=== Configure feature, set resolution to 640x480.");
     LOGD("Note: DM460 resolution feature is in component TY_COMPONENT_DEVICE,");
@@ -151,19 +221,16 @@ int main(int argc, char* argv[])
     ASSERT(err == TY_STATUS_OK || err == TY_STATUS_NOT_PERMITTED);
 
     LOGD("=== Prepare image buffer");
-    int32_t frameSize;
-    ASSERT_OK( TYGetFrameBufferSize(hDevice, &frameSize) );
-    LOGD("     - Get size of framebuffer, %d", frameSize);
-    ASSERT( frameSize >= 640*480*2 );
-
     LOGD("     - Allocate & enqueue buffers");
-    char* frameBuffer[2];
-    frameBuffer[0] = new char[frameSize];
-    frameBuffer[1] = new char[frameSize];
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[0], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[0], frameSize) );
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[1], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[1], frameSize) );
+    FrameBufferPool pool;
+    // depth is 2 bytes a pixel on the link where a point is 12
+    pool.setHostPoint3D(hostPoints);
+    ASSERT_OK( pool.init(hDevice, 2) );
+    LOGD("     - Get size of framebuffer, %d", pool.bufferSize());
+    ASSERT( pool.bufferSize() >= 640*480*2 );
+    if(pool.hostPoint3D()){
+        LOGD("     - Point3D computed on the host from depth");
+    }
 
     LOGD("=== Register callback");
     LOGD("Note: Callback may block internal data receiving,");
@@ -179,6 +246,15 @@ int main(int argc, char* argv[])
     cb_data.pcviewer = &pcviewer;
     cb_data.saveOneFramePoint3d = false;
     cb_data.fileIndex = 0;
+    cb_data.saveFormat = saveFormat;
+    PointCloudWriter writer;
+    cb_data.writer = &writer;
+    cb_data.withColor = withColor;
+    if(withColor){
+        ASSERT_OK( DepthRegistration::getCalibration(hDevice, cb_data.calib) );
+        ASSERT_OK( TYGetStruct(hDevice, TY_COMPONENT_RGB_CAM, TY_STRUCT_CAM_DISTORTION
+                    , &cb_data.colorDist, sizeof(cb_data.colorDist)) );
+    }
     // ASSERT_OK( TYRegisterCallback(hDevice, frameHandler, &cb_data) );
 
     LOGD("=== Disable trigger mode");
@@ -189,24 +265,25 @@ int main(int argc, char* argv[])
 
     LOGD("=== While loop to fetch frame");
     exit_main = false;
-    TY_FRAME_DATA frame;
 
     while(!exit_main){
-        int err = TYFetchFrame(hDevice, &frame, -1);
+        TY_STATUS err;
+        Frame frame = pool.fetchFrame(-1, &err);
         if( err != TY_STATUS_OK ){
             LOGD("... Drop one frame");
             continue;
         }
 
-        frameHandler(&frame, &cb_data);
+        frameHandler(frame.data(), &cb_data);
+    }
+    if(!writer.wait()){
+        LOGE("Failed to write a point cloud");
     }
 
     ASSERT_OK( TYStopCapture(hDevice) );
+    pool.release();
     ASSERT_OK( TYCloseDevice(hDevice) );
     ASSERT_OK( TYDeinitLib() );
-    // MSLEEP(10); // sleep to ensure buffer is not used any more
-    delete frameBuffer[0];
-    delete frameBuffer[1];
 
     LOGD("=== Main done!");
     return 0;
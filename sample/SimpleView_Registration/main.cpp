@@ -1,6 +1,6 @@
 #include "../common/common.hpp"
 
-static char buffer[1024*1024*20];
+static char buffer[1024*1024];
 static int  n;
 static volatile bool exit_main;
 static volatile bool save_frame;
@@ -12,23 +12,73 @@ struct CallbackData {
 
     TY_CAMERA_DISTORTION color_dist;
     TY_CAMERA_INTRINSIC color_intri;
+
+    DepthRegistration::Calibration calib;
+    DepthRegistration registration;
+    ColorToDepth colorToDepth;
+
+    cv::Mat color;      // reused every frame
+    cv::Mat undistorted;
+    cv::Mat registered;
+    cv::Mat alignedColor;   // color sampled on the depth grid
+
+    DepthStreamWriter depthStream;  // registered depth of every saved frame
 };
 
-void handleFrame(TY_FRAME_DATA* frame, void* userdata)
+// Color is converted straight to depth resolution when it is 2x or 4x
+// larger, so the full size BGR image is never built.
+static int colorDownscale(const TY_FRAME_DATA& frame)
+{
+    const TY_IMAGE_DATA* color = TYImageInFrame(frame, TY_COMPONENT_RGB_CAM);
+    const TY_IMAGE_DATA* depth = TYImageInFrame(frame, TY_COMPONENT_DEPTH_CAM);
+    if(!color || !depth || depth->width <= 0){
+        return 1;
+    }
+    int scale = color->width / depth->width;
+    if((scale == 2 || scale == 4) && color->width == depth->width * scale
+            && color->height == depth->height * scale){
+        return scale;
+    }
+    return 1;
+}
+
+static void resizeTo(const cv::Mat& src, cv::Mat& dst, cv::Size size, int interpolation)
+{
+    if(src.size() == size){
+        dst = src;
+    } else {
+        cv::resize(src, dst, size, 0, 0, interpolation);
+    }
+}
+
+// The buffer goes back to the device once the last copy of frame is
+// released, so it can be handed to other threads without copying.
+void handleFrame(const Frame& frame, CallbackData* pData, FrameTrace& trace)
 {
-    CallbackData* pData = (CallbackData*) userdata;
     LOGD("=== Get frame %d", ++pData->index);
 
-    cv::Mat depth, irl, irr, color, point3D;
-    parseFrame(*frame, &depth, &irl, &irr, &color, &point3D);
-    if(!depth.empty()){
-        cv::Mat colorDepth = pData->render->Compute(depth);
-        cv::imshow("ColorDepth", colorDepth);
+    cv::Mat depth, irl, irr, color;
+    int scale = colorDownscale(frame.data());
+    // parseFrame only assigns color when the frame has it, the reused
+    // buffer would otherwise hand on the color of an earlier frame
+    const TY_IMAGE_DATA* colorImage = TYImageInFrame(frame.data(), TY_COMPONENT_RGB_CAM);
+    parseFrame(frame.data(), &depth, &irl, &irr, colorImage ? &pData->color : NULL, NULL, scale);
+    if(colorImage){
+        color = pData->color;
     }
-    if(!irl.empty()){ cv::imshow("LeftIR", irl); }
-    if(!irr.empty()){ cv::imshow("RightIR", irr); }
+    trace.stamp(LatencyTrace::STAGE_PARSE);
+
     if(!color.empty()){
-        cv::Mat undistort_result(color.size(), CV_8UC3);
+        cv::Mat& undistort_result = pData->undistorted;
+        undistort_result.create(color.size(), CV_8UC3);
+        // intrinsic of the downscaled color image
+        TY_CAMERA_INTRINSIC color_intri = pData->color_intri;
+        if(scale > 1){
+            color_intri.data[0] /= scale;
+            color_intri.data[2] = (color_intri.data[2] + 0.5f) / scale - 0.5f;
+            color_intri.data[4] /= scale;
+            color_intri.data[5] = (color_intri.data[5] + 0.5f) / scale - 0.5f;
+        }
         TY_IMAGE_DATA dst;
         dst.width = color.cols;
         dst.height = color.rows;
@@ -44,41 +94,71 @@ void handleFrame(TY_FRAME_DATA* frame, void* userdata)
         //undistort camera image 
         //TYUndistortImage accept TY_IMAGE_DATA from TY_FRAME_DATA , pixel format RGB888 or MONO8
         //you can also use opencv API cv::undistort to do this job.
-        ASSERT_OK(TYUndistortImage(&pData->color_intri, &pData->color_dist, NULL, &src, &dst));
+        ASSERT_OK(TYUndistortImage(&color_intri, &pData->color_dist, NULL, &src, &dst));
         color = undistort_result;
-        cv::Mat resizedColor;
-        cv::resize(color, resizedColor, depth.size(), 0, 0, CV_INTER_LINEAR);
-        cv::imshow("color", resizedColor);
+        trace.stamp(LatencyTrace::STAGE_UNDISTORT);
     }
 
-    // do Registration
+    // do Registration, straight to the display size; splatting fills the
+    // holes a median filter used to hide
     cv::Mat newDepth;
-    if(!point3D.empty() && !color.empty()) {
-        ASSERT_OK( TYRegisterWorldToColor2(pData->hDevice, (TY_VECT_3F*)point3D.data, 0
-                    , point3D.cols * point3D.rows, color.cols, color.rows, (uint16_t*)buffer, sizeof(buffer)
-                    ));
-        newDepth = cv::Mat(color.rows, color.cols, CV_16U, (uint16_t*)buffer);
-        cv::Mat resized_color;
-        cv::Mat temp;
-        //you may want to use median filter to fill holes in projected depth image or do something else here
-        cv::medianBlur(newDepth,temp,5);
-        newDepth = temp;
-        //resize to the same size for display
-        cv::resize(newDepth, newDepth, depth.size(), 0, 0, 0);
-        cv::resize(color, resized_color, depth.size());
-        cv::Mat depthColor = pData->render->Compute(newDepth);
-        depthColor = depthColor / 2 + resized_color / 2;
-        cv::imshow("projected depth", depthColor);
+    if(!depth.empty() && !color.empty() && colorImage && pData->registration.setup(pData->calib
+                , depth.cols, depth.rows, colorImage->width, colorImage->height, depth.cols, depth.rows)) {
+        pData->registered.create(depth.size(), CV_16U);
+        newDepth = pData->registered;
+        pData->registration.run(depth.ptr<uint16_t>(), (int)depth.step1()
+                , newDepth.ptr<uint16_t>(), (int)newDepth.step1());
+    }
+    // and the other way, the color of every depth pixel
+    cv::Mat alignedColor;
+    if(!depth.empty() && !color.empty() && colorImage && pData->colorToDepth.setup(pData->calib
+                , depth.cols, depth.rows, colorImage->width, colorImage->height, color.cols, color.rows)) {
+        pData->alignedColor.create(depth.size(), CV_8UC3);
+        alignedColor = pData->alignedColor;
+        pData->colorToDepth.run(depth.ptr<uint16_t>(), (int)depth.step1(), color.data, (int)color.step
+                , alignedColor.data, (int)alignedColor.step, ColorToDepth::OUTPUT_BGR);
+    }
+    if(!newDepth.empty() || !alignedColor.empty()){
+        trace.stamp(LatencyTrace::STAGE_REGISTER);
     }
 
+    if(!depth.empty()){
+        cv::Mat colorDepth = pData->render->Compute(depth);
+        cv::imshow("ColorDepth", colorDepth);
+    }
+    if(!irl.empty()){ cv::imshow("LeftIR", irl); }
+    if(!irr.empty()){ cv::imshow("RightIR", irr); }
+    if(!color.empty()){
+        cv::Mat resizedColor;
+        resizeTo(color, resizedColor, depth.size(), CV_INTER_LINEAR);
+        cv::imshow("color", resizedColor);
+        if(!newDepth.empty()){
+            cv::Mat depthColor = pData->render->Compute(newDepth);
+            depthColor = depthColor / 2 + resizedColor / 2;
+            cv::imshow("projected depth", depthColor);
+        }
+    }
+    if(!alignedColor.empty()){
+        cv::imshow("color on depth", alignedColor);
+    }
+
+    int key = cv::waitKey(1);
+    trace.stamp(LatencyTrace::STAGE_RENDER);
+
     if(save_frame){
         LOGD(">>>>>>>>>> write images");
-        imwrite("depth.png", newDepth);
-        imwrite("color.png", color);
+        // lossless depth coding takes a few ms where a png takes a frame
+        if(!newDepth.empty() && (pData->depthStream.isOpen() || pData->depthStream.open("depth.tyd"))){
+            const TY_IMAGE_DATA* img = TYImageInFrame(frame.data(), TY_COMPONENT_DEPTH_CAM);
+            pData->depthStream.write(newDepth.ptr<uint16_t>(), newDepth.cols, newDepth.rows
+                    , (int)newDepth.step1(), img ? img->timestamp : 0);
+        }
+        if(!color.empty()){
+            imwrite("color.png", color);
+        }
         save_frame = false;
     }
 
-    int key = cv::waitKey(1);
     switch(key){
         case -1:
             break;
@@ -91,9 +171,6 @@ void handleFrame(TY_FRAME_DATA* frame, void* userdata)
         default:
             LOGD("Pressed key %d", key);
     }
-
-    LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-    ASSERT_OK( TYEnqueueBuffer(pData->hDevice, frame->userBuffer, frame->bufferSize) );
 }
 
 void eventCallback(TY_EVENT_INFO *event_info, void *userdata)
@@ -113,6 +190,7 @@ int main(int argc, char* argv[])
 {
     const char* IP = NULL;
     const char* ID = NULL;
+    const char* tracePath = NULL;
     TY_DEV_HANDLE hDevice;
 
     for(int i = 1; i < argc; i++){
@@ -120,8 +198,11 @@ int main(int argc, char* argv[])
             ID = argv[++i];
         }else if(strcmp(argv[i], "-ip") == 0){
             IP = argv[++i];
+        }else if(strcmp(argv[i], "-trace") == 0 && i + 1 < argc){
+            tracePath = argv[++i];
         }else if(strcmp(argv[i], "-h") == 0){
-            LOGI("Usage: SimpleView_Callback [-h] [-ip <IP>]");
+            LOGI("Usage: SimpleView_Callback [-h] [-ip <IP>] [-trace <file|->]");
+            LOGI("    -trace: write per stage latency percentiles every second");
             return 0;
         }
     }
@@ -163,7 +244,7 @@ int main(int argc, char* argv[])
     }
 
     LOGD("=== Configure components");
-    int32_t componentIDs = TY_COMPONENT_POINT3D_CAM | TY_COMPONENT_RGB_CAM;
+    int32_t componentIDs = TY_COMPONENT_DEPTH_CAM | TY_COMPONENT_RGB_CAM;
     ASSERT_OK( TYEnableComponents(hDevice, componentIDs) );
 
     LOGD("=== Prepare image buffer");
@@ -173,13 +254,8 @@ int main(int argc, char* argv[])
     ASSERT_OK( TYGetFrameBufferSize(hDevice, &frameSize) );
     LOGD("     - Get size of framebuffer, %d", frameSize);
     LOGD("     - Allocate & enqueue buffers");
-    char* frameBuffer[2];
-    frameBuffer[0] = new char[frameSize];
-    frameBuffer[1] = new char[frameSize];
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[0], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[0], frameSize) );
-    LOGD("     - Enqueue buffer (%p, %d)", frameBuffer[1], frameSize);
-    ASSERT_OK( TYEnqueueBuffer(hDevice, frameBuffer[1], frameSize) );
+    FrameBufferPool pool;
+    ASSERT_OK( pool.init(hDevice, 2) );
 
     LOGD("=== Register callback");
     LOGD("Note: Callback may block internal data receiving,");
@@ -187,10 +263,13 @@ int main(int argc, char* argv[])
     LOGD("      To avoid copying data, we pop the framebuffer from buffer queue and");
     LOGD("      give it back to user, user should call TYEnqueueBuffer to re-enqueue it.");
     DepthRender render;
+    ThreadPool threads;
     CallbackData cb_data;
     cb_data.index = 0;
     cb_data.hDevice = hDevice;
     cb_data.render = &render;
+    cb_data.registration.setThreadPool(&threads);
+    cb_data.colorToDepth.setThreadPool(&threads);
     // ASSERT_OK( TYRegisterCallback(hDevice, frameCallback, &cb_data) );
 
     LOGD("=== Register event callback");
@@ -226,24 +305,36 @@ int main(int argc, char* argv[])
         }
     }
 
+    LOGD("=== Read depth to color calibration");
+    ASSERT_OK( DepthRegistration::getCalibration(hDevice, cb_data.calib) );
+
+    LatencyTrace trace;
+    if(tracePath && !trace.open(tracePath)){
+        LOGE("Can not open %s", tracePath);
+    }
+
     LOGD("=== Wait for callback");
     exit_main = false;
     while(!exit_main){
-        TY_FRAME_DATA frame;
-        int err = TYFetchFrame(hDevice, &frame, -1);
+        TY_STATUS err;
+        Frame frame = pool.fetchFrame(-1, &err);
         if( err != TY_STATUS_OK ) {
             LOGE("Fetch frame error %d: %s", err, TYErrorString(err));
             break;
         } else {
-            handleFrame(&frame, &cb_data);
+            FrameTrace frameTrace(trace, frame);
+            handleFrame(frame, &cb_data, frameTrace);
+            frame.release();
+            frameTrace.stamp(LatencyTrace::STAGE_ENQUEUE);
+            frameTrace.finish();
         }
     }
+    trace.close();
 
     ASSERT_OK( TYStopCapture(hDevice) );
+    pool.release();
     ASSERT_OK( TYCloseDevice(hDevice) );
     ASSERT_OK( TYDeinitLib() );
-    delete frameBuffer[0];
-    delete frameBuffer[1];
 
     LOGD("=== Main done!");
     return 0;
@@ -169,8 +169,8 @@ int main(int argc, char* argv[])
     ASSERT_OK( TYStopCapture(hDevice) );
     ASSERT_OK( TYCloseDevice(hDevice) );
     ASSERT_OK( TYDeinitLib() );
-    delete frameBuffer[0];
-    delete frameBuffer[1];
+    delete[] frameBuffer[0];
+    delete[] frameBuffer[1];
 
     LOGD("=== Main done!");
     return 0;
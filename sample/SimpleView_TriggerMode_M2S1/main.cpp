@@ -9,21 +9,20 @@ struct CamInfo
 	char                sn[32];
 	char                camtag[100];
 	TY_DEV_HANDLE       hDev;
-	char*               fb[2];
-	TY_FRAME_DATA       frame;
+	FrameBufferPool     pool;
 	int                 idx;
 	DepthRender         render;
 
-	CamInfo() : hDev(0), idx(0) { fb[0] = 0; fb[1] = 0; }
+	CamInfo() : hDev(0), idx(0) {}
 };
 
 
-void frameHandler(TY_FRAME_DATA* frame, void* userdata)
+void frameHandler(const Frame& frame, void* userdata)
 {
 	CamInfo* pData = (CamInfo*)userdata;
 
 	cv::Mat depth, irl, irr, color;
-	parseFrame(*frame, &depth, &irl, &irr, &color, 0);
+	parseFrame(frame.data(), &depth, &irl, &irr, &color, 0);
 
 	char win[64];
 	if (!depth.empty()) {
@@ -45,9 +44,6 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata)
 	}
 
 	pData->idx++;
-
-	LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-	ASSERT_OK(TYEnqueueBuffer(pData->hDev, frame->userBuffer, frame->bufferSize));
 }
 
 int main()
@@ -72,6 +68,7 @@ int main()
 	}
 
 	std::vector<CamInfo> cams(n);
+	MultiDeviceCapture capture(2 * n);
 	for(int i = 0; i < n; i++){
         LOGD("=== Open device %d (id: %s)", i, pBaseInfo[i].id);
         strncpy(cams[i].sn, pBaseInfo[i].id, sizeof(cams[i].sn));
@@ -99,12 +96,8 @@ int main()
         ASSERT( frameSize >= 640*480*2 );
 
         LOGD("     - Allocate & enqueue buffers");
-        cams[i].fb[0] = new char[frameSize];
-        cams[i].fb[1] = new char[frameSize];
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[0], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[0], frameSize) );
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[1], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[1], frameSize) );
+        ASSERT_OK( cams[i].pool.init(cams[i].hDev, 4) );
+        capture.addDevice(cams[i].pool);
 
         //Set trigger mode
         if(TY_MASTER_DEVICE == i ){
@@ -126,16 +119,28 @@ int main()
 
 	LOGD("=== While loop to fetch frame");
 	bool exit_main = false;
+	// device timestamps mapped to the host clock line up without aligning
+	// on the first trigger, and stay lined up as the device clocks drift
+	FramesetSync sync(n, FramesetSync::MATCH_HOST_TIME, 5000, 2, 1000);
+	std::vector<Frame> frameset;
+	capture.start();
 
 	while (!exit_main) {
 		ASSERT_OK(TYSendSoftTrigger(cams[TY_MASTER_DEVICE].hDev));
-		for (int i = 0; i < cams.size(); i++) {
-			int err = TYFetchFrame(cams[i].hDev, &cams[i].frame, 1000);
-			if (err != TY_STATUS_OK) {
-				LOGD("cam %s %d ... Drop one frame", cams[i].camtag, cams[i].idx);
-				continue;
+		Frame frame;
+		int dev;
+		bool complete = false;
+		while (!complete && capture.next(frame, &dev, 1000)) {
+			complete = sync.push(dev, frame, frameset);
+		}
+		frame.release();
+		if (complete) {
+			for (int i = 0; i < n; i++) {
+				frameHandler(frameset[i], &cams[i]);
 			}
-			frameHandler(&cams[i].frame, &cams[i]);
+		} else {
+			LOGD("... Incomplete frameset");
+			sync.expire();
 		}
 
 		int key = cv::waitKey(1);
@@ -150,12 +155,17 @@ int main()
 		}
 	}
 
+	FramesetSync::Stats syncStats = sync.stats();
+	LOGI("=== Framesets %d, unmatched %d, overflow %d, timed out %d"
+			, (int)syncStats.sets, (int)syncStats.unmatched
+			, (int)syncStats.overflow, (int)syncStats.timedOut);
+	frameset.clear();
+	sync.clear();
+	capture.stop();
 	for (int i = 0; i < cams.size(); i++) {
 		ASSERT_OK(TYStopCapture(cams[i].hDev));
+		cams[i].pool.release();
 		ASSERT_OK(TYCloseDevice(cams[i].hDev));
-		// MSLEEP(10); // sleep to ensure buffer is not used any more
-		delete cams[i].fb[0];
-		delete cams[i].fb[1];
 	}
 	ASSERT_OK(TYDeinitLib());
 
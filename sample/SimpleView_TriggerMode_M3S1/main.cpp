@@ -9,21 +9,20 @@ struct CamInfo
     char                sn[32];
     char                camtag[100];
     TY_DEV_HANDLE       hDev;
-    char*               fb[2];
-    TY_FRAME_DATA       frame;
+    FrameBufferPool     pool;
     int                 idx;
     DepthRender         render;
 
-    CamInfo() : hDev(0), idx(0) {fb[0]=0; fb[1]=0;}
+    CamInfo() : hDev(0), idx(0) {}
 };
 
 
-void frameHandler(TY_FRAME_DATA* frame, void* userdata)
+void frameHandler(const Frame& frame, void* userdata)
 {
     CamInfo* pData = (CamInfo*) userdata;
 
     cv::Mat depth, irl, irr, color;
-    parseFrame(*frame, &depth, &irl, &irr, &color, 0);
+    parseFrame(frame.data(), &depth, &irl, &irr, &color, 0);
 
     char win[64];
     if(!depth.empty()){
@@ -45,9 +44,6 @@ void frameHandler(TY_FRAME_DATA* frame, void* userdata)
     }
 
     pData->idx++;
-
-    LOGD("=== Callback: Re-enqueue buffer(%p, %d)", frame->userBuffer, frame->bufferSize);
-    ASSERT_OK( TYEnqueueBuffer(pData->hDev, frame->userBuffer, frame->bufferSize) );
 }
 
 int main()
@@ -72,6 +68,8 @@ int main()
     }
 
     std::vector<CamInfo> cams(n);
+    // one fetch thread per device, a missed trigger does not stall the others
+    MultiDeviceCapture capture(2 * n);
     for(int i = 0; i < n; i++){
         LOGD("=== Open device %d (id: %s)", i, pBaseInfo[i].id);
         strncpy(cams[i].sn, pBaseInfo[i].id, sizeof(cams[i].sn));
@@ -99,12 +97,11 @@ int main()
         ASSERT( frameSize >= 640*480*2 );
 
         LOGD("     - Allocate & enqueue buffers");
-        cams[i].fb[0] = new char[frameSize];
-        cams[i].fb[1] = new char[frameSize];
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[0], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[0], frameSize) );
-        LOGD("     - Enqueue buffer (%p, %d)", cams[i].fb[1], frameSize);
-        ASSERT_OK( TYEnqueueBuffer(cams[i].hDev, cams[i].fb[1], frameSize) );
+        // pending in the synchronizer, shown and in flight
+        ASSERT_OK( cams[i].pool.init(cams[i].hDev, 5) );
+        // the merged queue may hold several frames of one device
+        cams[i].pool.setAutoGrow(2 * n + 2);
+        capture.addDevice(cams[i].pool);
 
         //Set trigger mode
         if(TY_MASTER_DEVICE == i ){
@@ -121,23 +118,36 @@ int main()
 			tyTriggerMode.mode = TY_TRIGGER_MODE_TRIG_SLAVE;
 			ASSERT_OK(TYSetStruct(cams[i].hDev, TY_COMPONENT_DEVICE, TY_STRUCT_WORK_MODE, (void*)&tyTriggerMode, sizeof(tyTriggerMode)));
         }
-        LOGD("=== Start capture");
+    }
+
+    // slaves first, so every device sees the first trigger of the master
+    // and the sets can be lined up on it
+    for(int i = n - 1; i >= 0; i--){
+        LOGD("=== Start capture %s", cams[i].camtag);
         ASSERT_OK( TYStartCapture(cams[i].hDev) );
     }
-    
+
     LOGD("=== While loop to fetch frame");
     bool exit_main = false;
+    // pair frames by timestamp, within 5ms of each other at 30fps. Mapped
+    // to the host clock the device clocks need no aligning, and pairing
+    // survives their drift.
+    FramesetSync sync(n, FramesetSync::MATCH_HOST_TIME, 5000, 2);
+    std::vector<Frame> frameset;
+    capture.start();
 
     while(!exit_main){
-        for(int i = 0; i < cams.size(); i++) {
-            int err = TYFetchFrame(cams[i].hDev, &cams[i].frame, 1000);
-            if( err != TY_STATUS_OK ){
-                LOGD("cam %s %d ... Drop one frame", cams[i].camtag, cams[i].idx);
-                continue;
+        Frame frame;
+        int dev;
+        while(capture.next(frame, &dev, 0)){
+            if(sync.push(dev, frame, frameset)){
+                for(int i = 0; i < n; i++){
+                    frameHandler(frameset[i], &cams[i]);
+                }
             }
-
-            frameHandler(&cams[i].frame, &cams[i]);
         }
+        frame.release();
+        sync.expire();
 
         int key = cv::waitKey(1);
         switch(key & 0xff){
@@ -151,12 +161,17 @@ int main()
         }
     }
 
+    FramesetSync::Stats syncStats = sync.stats();
+    LOGI("=== Framesets %d, unmatched %d, overflow %d, timed out %d"
+            , (int)syncStats.sets, (int)syncStats.unmatched
+            , (int)syncStats.overflow, (int)syncStats.timedOut);
+    frameset.clear();
+    sync.clear();
+    capture.stop();
     for(int i = 0; i < cams.size(); i++){
         ASSERT_OK( TYStopCapture(cams[i].hDev) );
+        cams[i].pool.release();
         ASSERT_OK( TYCloseDevice(cams[i].hDev) );
-        // MSLEEP(10); // sleep to ensure buffer is not used any more
-        delete cams[i].fb[0];
-        delete cams[i].fb[1];
     }
     ASSERT_OK( TYDeinitLib() );
 
@@ -0,0 +1,245 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_BAYER_DEMOSAIC_HPP_
+#define PERCIPIO_SAMPLE_COMMON_BAYER_DEMOSAIC_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define BAYER_DEMOSAIC_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define BAYER_DEMOSAIC_NEON
+#endif
+
+/// Demosaicing of TY_PIXEL_FORMAT_BAYER8GB into a caller owned BGR Mat,
+/// which is only reallocated when its size changes. The pattern is the one
+/// cv::COLOR_BayerGB2BGR expects, even rows G R G R, odd rows B G B G.
+
+enum BayerDemosaicMode {
+    BAYER_BIN_2X2 = 0,  ///< one BGR pixel per 2x2 cell, half width and height
+    BAYER_BILINEAR = 1, ///< full resolution bilinear interpolation
+};
+
+/// Scalar reference of the 2x2 binning, g0/r0 from the even row, b1/g1
+/// from the odd one.
+static inline void bayerBinPixel(const uint8_t* even, const uint8_t* odd, uint8_t* bgr)
+{
+    bgr[0] = odd[0];
+    bgr[1] = (uint8_t)((even[0] + odd[1] + 1) >> 1);
+    bgr[2] = even[1];
+}
+
+/// Bin one pair of source rows into n output pixels.
+static inline void bayerBinRow(const uint8_t* even, const uint8_t* odd, int n, uint8_t* dst)
+{
+    int i = 0;
+#if defined(BAYER_DEMOSAIC_SSE2)
+    const __m128i lo = _mm_set1_epi16(0xff);
+    const __m128i zero = _mm_setzero_si128();
+    uint8_t packed[32];
+    // the last output pixel is left to the scalar tail, the 4 byte stores
+    // below write one byte past each pixel
+    for(; i + 8 < n; i += 8){
+        __m128i e = _mm_loadu_si128((const __m128i*)(even + i * 2));
+        __m128i o = _mm_loadu_si128((const __m128i*)(odd + i * 2));
+        __m128i g = _mm_avg_epu16(_mm_and_si128(e, lo), _mm_srli_epi16(o, 8));
+        __m128i b = _mm_packus_epi16(_mm_and_si128(o, lo), zero);
+        __m128i r = _mm_packus_epi16(_mm_srli_epi16(e, 8), zero);
+        g = _mm_packus_epi16(g, zero);
+        __m128i bg = _mm_unpacklo_epi8(b, g);
+        __m128i r0 = _mm_unpacklo_epi8(r, zero);
+        _mm_storeu_si128((__m128i*)packed, _mm_unpacklo_epi16(bg, r0));
+        _mm_storeu_si128((__m128i*)(packed + 16), _mm_unpackhi_epi16(bg, r0));
+        uint8_t* out = dst + i * 3;
+        for(int k = 0; k < 8; k++){
+            memcpy(out + k * 3, packed + k * 4, 4);
+        }
+    }
+#elif defined(BAYER_DEMOSAIC_NEON)
+    for(; i + 8 <= n; i += 8){
+        uint8x8x2_t e = vld2_u8(even + i * 2);
+        uint8x8x2_t o = vld2_u8(odd + i * 2);
+        uint8x8x3_t bgr;
+        bgr.val[0] = o.val[0];
+        bgr.val[1] = vrhadd_u8(e.val[0], o.val[1]);
+        bgr.val[2] = e.val[1];
+        vst3_u8(dst + i * 3, bgr);
+    }
+#endif
+    for(; i < n; i++){
+        bayerBinPixel(even + i * 2, odd + i * 2, dst + i * 3);
+    }
+}
+
+/// Scalar reference of the bilinear mode for pixel (x, y), borders are
+/// reflected without repeating the edge so the color pattern is kept.
+static inline void bayerBilinearPixel(const uint8_t* src, size_t stride
+        , int width, int height, int x, int y, uint8_t* bgr)
+{
+    int xl = x > 0 ? x - 1 : x + 1;
+    int xr = x + 1 < width ? x + 1 : x - 1;
+    const uint8_t* up = src + (size_t)(y > 0 ? y - 1 : y + 1) * stride;
+    const uint8_t* mid = src + (size_t)y * stride;
+    const uint8_t* down = src + (size_t)(y + 1 < height ? y + 1 : y - 1) * stride;
+
+    int c = mid[x];
+    int hor = (mid[xl] + mid[xr] + 1) >> 1;
+    int ver = (up[x] + down[x] + 1) >> 1;
+    int cross = (mid[xl] + mid[xr] + up[x] + down[x] + 2) >> 2;
+    int diag = (up[xl] + up[xr] + down[xl] + down[xr] + 2) >> 2;
+    int b, g, r;
+    if(!(y & 1)){
+        if(!(x & 1)){ b = ver;  g = c;     r = hor; }     // G on a G R row
+        else        { b = diag; g = cross; r = c; }       // R
+    } else {
+        if(!(x & 1)){ b = c;    g = cross; r = diag; }    // B
+        else        { b = hor;  g = c;     r = ver; }     // G on a B G row
+    }
+    bgr[0] = (uint8_t)b;
+    bgr[1] = (uint8_t)g;
+    bgr[2] = (uint8_t)r;
+}
+
+/// Interpolate row y, which must have a row above and below it.
+static inline void bayerBilinearRow(const uint8_t* src, size_t stride
+        , int width, int height, int y, uint8_t* dst)
+{
+    int x = 0;
+#if defined(BAYER_DEMOSAIC_SSE2)
+    const uint8_t* up = src + (size_t)(y - 1) * stride;
+    const uint8_t* mid = src + (size_t)y * stride;
+    const uint8_t* down = src + (size_t)(y + 1) * stride;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi16(2);
+    const __m128i even = _mm_set1_epi32(0xffff);     // even columns
+    const bool evenRow = !(y & 1);
+    uint8_t packed[32];
+
+    for(x = 0; x < 2 && x < width; x++){
+        bayerBilinearPixel(src, stride, width, height, x, y, dst + x * 3);
+    }
+    // x - 1 .. x + 8 must be inside the row and the last pixel is left to
+    // the scalar tail, the 4 byte stores write one byte past each pixel
+    for(; x + 9 < width; x += 8){
+#define BAYER_LOAD(p) _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(p)), zero)
+        __m128i ul = BAYER_LOAD(up + x - 1), u = BAYER_LOAD(up + x), ur = BAYER_LOAD(up + x + 1);
+        __m128i l = BAYER_LOAD(mid + x - 1), c = BAYER_LOAD(mid + x), r = BAYER_LOAD(mid + x + 1);
+        __m128i dl = BAYER_LOAD(down + x - 1), d = BAYER_LOAD(down + x), dr = BAYER_LOAD(down + x + 1);
+#undef BAYER_LOAD
+        __m128i lr = _mm_add_epi16(l, r);
+        __m128i ud = _mm_add_epi16(u, d);
+        __m128i hor = _mm_srli_epi16(_mm_add_epi16(lr, one), 1);
+        __m128i ver = _mm_srli_epi16(_mm_add_epi16(ud, one), 1);
+        __m128i cross = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(lr, ud), two), 2);
+        __m128i diag = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_add_epi16(ul, ur)
+                        , _mm_add_epi16(dl, dr)), two), 2);
+
+#define BAYER_SELECT(a, b) _mm_or_si128(_mm_and_si128(even, a), _mm_andnot_si128(even, b))
+        __m128i vb, vg, vr;
+        if(evenRow){
+            vb = BAYER_SELECT(ver, diag);
+            vg = BAYER_SELECT(c, cross);
+            vr = BAYER_SELECT(hor, c);
+        } else {
+            vb = BAYER_SELECT(c, hor);
+            vg = BAYER_SELECT(cross, c);
+            vr = BAYER_SELECT(diag, ver);
+        }
+#undef BAYER_SELECT
+
+        __m128i bg = _mm_unpacklo_epi8(_mm_packus_epi16(vb, zero), _mm_packus_epi16(vg, zero));
+        __m128i r0 = _mm_unpacklo_epi8(_mm_packus_epi16(vr, zero), zero);
+        _mm_storeu_si128((__m128i*)packed, _mm_unpacklo_epi16(bg, r0));
+        _mm_storeu_si128((__m128i*)(packed + 16), _mm_unpackhi_epi16(bg, r0));
+        uint8_t* out = dst + x * 3;
+        for(int k = 0; k < 8; k++){
+            memcpy(out + k * 3, packed + k * 4, 4);
+        }
+    }
+#elif defined(BAYER_DEMOSAIC_NEON)
+    const uint8_t* up = src + (size_t)(y - 1) * stride;
+    const uint8_t* mid = src + (size_t)y * stride;
+    const uint8_t* down = src + (size_t)(y + 1) * stride;
+    static const uint16_t kEven[8] = { 0xffff, 0, 0xffff, 0, 0xffff, 0, 0xffff, 0 };
+    const uint16x8_t even = vld1q_u16(kEven);
+    const bool evenRow = !(y & 1);
+
+    for(x = 0; x < 2 && x < width; x++){
+        bayerBilinearPixel(src, stride, width, height, x, y, dst + x * 3);
+    }
+    for(; x + 9 <= width; x += 8){
+        uint16x8_t ul = vmovl_u8(vld1_u8(up + x - 1)), u = vmovl_u8(vld1_u8(up + x)), ur = vmovl_u8(vld1_u8(up + x + 1));
+        uint16x8_t l = vmovl_u8(vld1_u8(mid + x - 1)), c = vmovl_u8(vld1_u8(mid + x)), r = vmovl_u8(vld1_u8(mid + x + 1));
+        uint16x8_t dl = vmovl_u8(vld1_u8(down + x - 1)), d = vmovl_u8(vld1_u8(down + x)), dr = vmovl_u8(vld1_u8(down + x + 1));
+        uint16x8_t lr = vaddq_u16(l, r);
+        uint16x8_t ud = vaddq_u16(u, d);
+        uint16x8_t hor = vrshrq_n_u16(lr, 1);
+        uint16x8_t ver = vrshrq_n_u16(ud, 1);
+        uint16x8_t cross = vrshrq_n_u16(vaddq_u16(lr, ud), 2);
+        uint16x8_t diag = vrshrq_n_u16(vaddq_u16(vaddq_u16(ul, ur), vaddq_u16(dl, dr)), 2);
+
+        uint8x8x3_t bgr;
+        if(evenRow){
+            bgr.val[0] = vmovn_u16(vbslq_u16(even, ver, diag));
+            bgr.val[1] = vmovn_u16(vbslq_u16(even, c, cross));
+            bgr.val[2] = vmovn_u16(vbslq_u16(even, hor, c));
+        } else {
+            bgr.val[0] = vmovn_u16(vbslq_u16(even, c, hor));
+            bgr.val[1] = vmovn_u16(vbslq_u16(even, cross, c));
+            bgr.val[2] = vmovn_u16(vbslq_u16(even, diag, ver));
+        }
+        vst3_u8(dst + x * 3, bgr);
+    }
+#endif
+    for(; x < width; x++){
+        bayerBilinearPixel(src, stride, width, height, x, y, dst + x * 3);
+    }
+}
+
+/// Output size of bayer8GBToBGR for a width x height source.
+static inline cv::Size bayerDemosaicSize(int width, int height, BayerDemosaicMode mode)
+{
+    return mode == BAYER_BIN_2X2 ? cv::Size(width / 2, height / 2) : cv::Size(width, height);
+}
+
+/// Demosaic a BAYER8GB image into dst, (re)created as CV_8UC3 of
+/// bayerDemosaicSize.
+static inline void bayer8GBToBGR(const uint8_t* src, int width, int height
+        , cv::Mat& dst, BayerDemosaicMode mode)
+{
+    const size_t stride = (size_t)width;
+    dst.create(bayerDemosaicSize(width, height, mode), CV_8UC3);
+
+    if(mode == BAYER_BIN_2X2){
+        for(int y = 0; y < dst.rows; y++){
+            const uint8_t* even = src + (size_t)(y * 2) * stride;
+            bayerBinRow(even, even + stride, dst.cols, dst.ptr<uint8_t>(y));
+        }
+        return;
+    }
+
+    if(width < 2 || height < 2){
+        // nothing to interpolate from, show the raw values
+        for(int y = 0; y < height; y++){
+            uint8_t* out = dst.ptr<uint8_t>(y);
+            for(int x = 0; x < width; x++){
+                out[x * 3] = out[x * 3 + 1] = out[x * 3 + 2] = src[y * stride + x];
+            }
+        }
+        return;
+    }
+    for(int y = 0; y < height; y++){
+        uint8_t* out = dst.ptr<uint8_t>(y);
+        if(y == 0 || y == height - 1){
+            for(int x = 0; x < width; x++){
+                bayerBilinearPixel(src, stride, width, height, x, y, out + x * 3);
+            }
+        } else {
+            bayerBilinearRow(src, stride, width, height, y, out);
+        }
+    }
+}
+
+#endif
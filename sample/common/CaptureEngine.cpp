@@ -0,0 +1,124 @@
+#include "CaptureEngine.hpp"
+#include <chrono>
+
+#ifdef _WIN32
+# include <windows.h>
+#elif defined(__linux__)
+# include <pthread.h>
+# include <sched.h>
+#endif
+
+// short fetch timeout so stop() does not wait for a frame
+static const int32_t kFetchTimeoutMs = 100;
+
+static void pinCurrentThread(int cpu)
+{
+    if(cpu < 0){
+        return;
+    }
+#ifdef _WIN32
+    if(cpu < (int)sizeof(DWORD_PTR) * 8){
+        SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+    }
+#elif defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+
+CaptureEngine::CaptureEngine(FrameBufferPool& pool, int queueDepth, FrameQueue::Policy policy)
+    : _pool(pool)
+    , _queue(new FrameQueue(queueDepth, policy))
+    , _ownQueue(true)
+    , _cpu(-1)
+    , _running(false)
+    , _fetched(0)
+    , _errors(0)
+{
+}
+
+
+CaptureEngine::CaptureEngine(FrameBufferPool& pool, FrameQueue& output)
+    : _pool(pool)
+    , _queue(&output)
+    , _ownQueue(false)
+    , _cpu(-1)
+    , _running(false)
+    , _fetched(0)
+    , _errors(0)
+{
+}
+
+
+CaptureEngine::~CaptureEngine()
+{
+    stop();
+    if(_ownQueue){
+        delete _queue;
+    }
+}
+
+
+void CaptureEngine::start()
+{
+    if(_running.load()){
+        return;
+    }
+    if(_ownQueue){
+        _queue->reopen();
+    }
+    _running = true;
+    _thread = std::thread(&CaptureEngine::acquireLoop, this);
+}
+
+
+void CaptureEngine::stop()
+{
+    _running = false;
+    if(_ownQueue){
+        // a blocked push returns once the queue is closed
+        _queue->close();
+    }
+    if(_thread.joinable()){
+        _thread.join();
+    }
+    if(_ownQueue){
+        _queue->clear();
+    }
+}
+
+
+CaptureEngine::Stats CaptureEngine::stats() const
+{
+    Stats s;
+    s.fetched = _fetched.load();
+    s.errors = _errors.load();
+    s.queue = _queue->stats();
+    s.pool = _pool.stats();
+    return s;
+}
+
+
+void CaptureEngine::acquireLoop()
+{
+    pinCurrentThread(_cpu);
+    while(_running.load()){
+        TY_STATUS err;
+        Frame frame = _pool.fetchFrame(kFetchTimeoutMs, &err);
+        if(err == TY_STATUS_TIMEOUT){
+            continue;
+        }
+        if(frame.empty()){
+            // no buffer or device gone, do not spin on it
+            _errors++;
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        _fetched++;
+        // the engine keeps no reference, a dropped frame is re-enqueued here
+        _queue->push(frame);
+    }
+}
@@ -0,0 +1,74 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_CAPTURE_ENGINE_HPP_
+#define PERCIPIO_SAMPLE_COMMON_CAPTURE_ENGINE_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include "FrameBufferPool.hpp"
+#include "FrameQueue.hpp"
+
+/// Fetches frames on a dedicated thread and hands them to consumers
+/// through a FrameQueue, so slow parsing or rendering never delays
+/// TYFetchFrame. With the drop policies the acquisition thread never
+/// waits: frames the consumers can not keep up with are released right
+/// away and their buffers go back to the device, so the SDK does not run
+/// out of buffers. The pool needs at least queueDepth + 2 buffers for
+/// that (queued frames, one held by the consumer, one in the device).
+/// Several engines can feed one shared queue, see MultiDeviceCapture.
+class CaptureEngine
+{
+public:
+    struct Stats {
+        uint64_t                fetched;    ///< frames fetched from the pool
+        uint64_t                errors;     ///< fetches failed, timeouts excluded
+        FrameQueue::Stats       queue;
+        FrameBufferPool::Stats  pool;
+    };
+
+    explicit CaptureEngine(FrameBufferPool& pool, int queueDepth = 2
+            , FrameQueue::Policy policy = FrameQueue::POLICY_DROP_OLDEST);
+    /// Push into a queue owned by the caller. stop() then only joins the
+    /// thread, the owner closes and clears the queue.
+    CaptureEngine(FrameBufferPool& pool, FrameQueue& output);
+    /// stops the thread and releases queued frames
+    ~CaptureEngine();
+
+    /// Pin the acquisition thread to a core, -1 (default) does not pin.
+    /// Takes effect on the next start().
+    void setAffinity(int cpu) { _cpu = cpu; }
+
+    /// start the acquisition thread, capture must be started on the device
+    void start();
+    /// join the acquisition thread and release queued frames, consumers
+    /// blocked in next() return false
+    void stop();
+    bool running() const { return _running.load(); }
+
+    /// Next frame, waits up to timeoutMs (-1 forever). false on timeout or
+    /// when the engine is stopped.
+    bool next(Frame& frame, int timeoutMs = -1) { return _queue->pop(frame, timeoutMs); }
+
+    /// first stage queue, for chaining more stages behind it
+    FrameQueue& queue() { return *_queue; }
+    FrameBufferPool& pool() { return _pool; }
+
+    Stats stats() const;
+
+private:
+    CaptureEngine(const CaptureEngine&);
+    CaptureEngine& operator=(const CaptureEngine&);
+
+    void acquireLoop();
+
+    FrameBufferPool&        _pool;
+    FrameQueue*             _queue;
+    bool                    _ownQueue;
+    int                     _cpu;
+    std::thread             _thread;
+    std::atomic<bool>       _running;
+    std::atomic<uint64_t>   _fetched;
+    std::atomic<uint64_t>   _errors;
+};
+
+
+#endif
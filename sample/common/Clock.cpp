@@ -0,0 +1,148 @@
+#include "Clock.hpp"
+#include <math.h>
+
+// a device clock off by more than this is a broken fit, not drift
+static const double kMaxDrift = 1e-3;
+// host time before the line, or after it, that means the clock jumped
+static const int64_t kJumpBackNs = 1000000000LL;
+static const int64_t kJumpAheadNs = 10000000000LL;
+
+
+DeviceClock::DeviceClock(int slots, int slotMs)
+    : _slots(slots < 2 ? 2 : slots)
+    , _slotUs((int64_t)(slotMs < 1 ? 1 : slotMs) * 1000)
+    , _restarts(0)
+{
+    reset();
+}
+
+
+void DeviceClock::reset()
+{
+    _head = 0;
+    _count = 0;
+    _open = false;
+    _currentStart = 0;
+    _lastDeviceUs = 0;
+    _fit = Fit();
+}
+
+
+void DeviceClock::add(const TY_FRAME_DATA& frame, int64_t hostNs)
+{
+    for(int i = 0; i < frame.validCount; i++){
+        if(frame.image[i].timestamp){
+            add((int64_t)frame.image[i].timestamp, hostNs);
+            return;
+        }
+    }
+}
+
+
+void DeviceClock::add(int64_t deviceUs, int64_t hostNs)
+{
+    if(_open){
+        int64_t residual = hostNs - _fit.toHostNs(deviceUs);
+        if(deviceUs < _lastDeviceUs || residual < -kJumpBackNs || residual > kJumpAheadNs){
+            reset();
+            _restarts++;
+        }
+    }
+    _lastDeviceUs = deviceUs;
+
+    Point p;
+    p.deviceUs = deviceUs;
+    p.hostNs = hostNs;
+    if(!_open){
+        _open = true;
+        _currentStart = deviceUs;
+        _current = p;
+        _fit.points = 1;
+        _fit.deviceUs = deviceUs;
+        _fit.hostNs = hostNs;
+        return;
+    }
+
+    if(deviceUs - _currentStart >= _slotUs){
+        _slots[_head] = _current;
+        _head = (_head + 1) % (int)_slots.size();
+        if(_count < (int)_slots.size()){
+            _count++;
+        }
+        _currentStart = deviceUs;
+        _current = p;
+        refit();
+    } else if((hostNs - _current.hostNs) - (deviceUs - _current.deviceUs) * _fit.nsPerUs < 0){
+        _current = p;
+    }
+    lower(p);
+}
+
+
+void DeviceClock::lower(const Point& p)
+{
+    int64_t h = _fit.toHostNs(p.deviceUs);
+    if(p.hostNs < h){
+        _fit.hostNs -= h - p.hostNs;
+    }
+}
+
+
+void DeviceClock::refit()
+{
+    int size = (int)_slots.size();
+    int first = (_head - _count + size) % size;
+    const Point& oldest = _slots[first];
+    const Point& newest = _slots[(_head - 1 + size) % size];
+
+    // centered sums, absolute times do not fit a double with ns precision
+    double slope = _fit.nsPerUs;
+    if(_count >= 2 && newest.deviceUs > oldest.deviceUs){
+        double mx = 0., my = 0.;
+        for(int i = 0; i < _count; i++){
+            const Point& p = _slots[(first + i) % size];
+            mx += (double)(p.deviceUs - oldest.deviceUs);
+            my += (double)(p.hostNs - oldest.hostNs);
+        }
+        mx /= _count;
+        my /= _count;
+        double sxx = 0., sxy = 0.;
+        for(int i = 0; i < _count; i++){
+            const Point& p = _slots[(first + i) % size];
+            double dx = (double)(p.deviceUs - oldest.deviceUs) - mx;
+            double dy = (double)(p.hostNs - oldest.hostNs) - my;
+            sxx += dx * dx;
+            sxy += dx * dy;
+        }
+        slope = sxy / sxx;
+        if(slope < 1000. * (1. - kMaxDrift)){
+            slope = 1000. * (1. - kMaxDrift);
+        } else if(slope > 1000. * (1. + kMaxDrift)){
+            slope = 1000. * (1. + kMaxDrift);
+        }
+    }
+
+    _fit.nsPerUs = slope;
+    _fit.deviceUs = newest.deviceUs;
+    _fit.hostNs = newest.hostNs;
+    _fit.points = _count + 1;
+
+    // move the line under every point, the open slot included
+    int64_t low = _current.hostNs - _fit.toHostNs(_current.deviceUs);
+    for(int i = 0; i < _count; i++){
+        const Point& p = _slots[(first + i) % size];
+        int64_t r = p.hostNs - _fit.toHostNs(p.deviceUs);
+        if(r < low){
+            low = r;
+        }
+    }
+    _fit.hostNs += low;
+
+    double sum = 0.;
+    for(int i = 0; i < _count; i++){
+        const Point& p = _slots[(first + i) % size];
+        double r = (double)(p.hostNs - _fit.toHostNs(p.deviceUs));
+        sum += r * r;
+    }
+    _fit.jitterNs = sqrt(sum / _count);
+}
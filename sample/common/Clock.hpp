@@ -0,0 +1,94 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_CLOCK_HPP_
+#define PERCIPIO_SAMPLE_COMMON_CLOCK_HPP_
+
+#include <stdint.h>
+#include <chrono>
+#include <vector>
+#include "TY_API.h"
+
+/// Host monotonic clock in nanoseconds, from an arbitrary origin. It does
+/// not jump when the wall clock is set, use it for all intervals.
+inline int64_t monotonicNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline double monotonicMs()
+{
+    return monotonicNs() / 1e6;
+}
+
+
+/// Online mapping of a device clock (TY_IMAGE_DATA::timestamp, in
+/// microseconds) to monotonicNs().
+///
+/// A frame arrives some transfer time after its device timestamp, and that
+/// time only ever adds to the difference of the clocks. Samples are kept
+/// in slots of a fixed device time span, only the one with the smallest
+/// difference per slot; the line is a least squares fit of these lower
+/// envelope points over the last slots, moved down to pass under all of
+/// them. The slope gives the drift, toHostNs() of a frame is then the time
+/// it would have arrived with the fastest transfer seen. A clock that goes
+/// back or jumps, e.g. a rebooted device, starts the fit over.
+///
+/// Not thread safe, FrameBufferPool keeps one per device under its lock.
+class DeviceClock
+{
+public:
+    struct Fit {
+        int         points;     ///< samples behind the fit, 0 if none
+        int64_t     deviceUs;   ///< reference point of the line
+        int64_t     hostNs;
+        double      nsPerUs;    ///< slope, 1000 for clocks at the same rate
+        double      jitterNs;   ///< rms height of the slot points above the line
+
+        Fit() : points(0), deviceUs(0), hostNs(0), nsPerUs(1000.), jitterNs(0.) {}
+
+        bool valid() const { return points > 0; }
+        int64_t toHostNs(int64_t device) const {
+                    return hostNs + (int64_t)((device - deviceUs) * nsPerUs);
+                }
+        int64_t toDeviceUs(int64_t host) const {
+                    return deviceUs + (int64_t)((host - hostNs) / nsPerUs);
+                }
+        /// device clock rate error in parts per million, > 0 runs fast
+        double driftPpm() const { return (1000. / nsPerUs - 1.) * 1e6; }
+    };
+
+    /// slots of slotMs device time, the fit spans the last slots of them
+    explicit DeviceClock(int slots = 64, int slotMs = 500);
+
+    /// device timestamp of a frame and the host time it arrived
+    void add(int64_t deviceUs, int64_t hostNs);
+    /// adds the timestamp of the first image, frames without one are skipped
+    void add(const TY_FRAME_DATA& frame, int64_t hostNs);
+
+    const Fit& fit() const { return _fit; }
+    /// times the fit started over since construction
+    int restarts() const { return _restarts; }
+    void reset();
+
+private:
+    struct Point {
+        int64_t     deviceUs;
+        int64_t     hostNs;
+    };
+
+    void refit();
+    void lower(const Point& p);
+
+    std::vector<Point>  _slots;
+    int                 _head;
+    int                 _count;
+    int64_t             _slotUs;
+    Point               _current;       ///< lowest point of the open slot
+    int64_t             _currentStart;
+    bool                _open;
+    int64_t             _lastDeviceUs;
+    int                 _restarts;
+    Fit                 _fit;
+};
+
+
+#endif
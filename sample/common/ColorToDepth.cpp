@@ -0,0 +1,248 @@
+#include "ColorToDepth.hpp"
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define COLOR_TO_DEPTH_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define COLOR_TO_DEPTH_NEON
+#endif
+
+
+ColorToDepth::ColorToDepth()
+    : _depthWidth(0)
+    , _depthHeight(0)
+    , _colorWidth(0)
+    , _colorHeight(0)
+    , _imageWidth(0)
+    , _imageHeight(0)
+    , _pool(NULL)
+{
+    memset(&_calib, 0, sizeof(_calib));
+    memset(_offset, 0, sizeof(_offset));
+}
+
+
+bool ColorToDepth::setup(const DepthRegistration::Calibration& calib, int depthWidth, int depthHeight
+        , int colorWidth, int colorHeight, int imageWidth, int imageHeight)
+{
+    if(_depthWidth > 0 && depthWidth == _depthWidth && depthHeight == _depthHeight
+            && colorWidth == _colorWidth && colorHeight == _colorHeight
+            && imageWidth == _imageWidth && imageHeight == _imageHeight
+            && memcmp(&calib, &_calib, sizeof(calib)) == 0){
+        return true;
+    }
+    _depthWidth = 0;
+    _depthHeight = 0;
+    const float* d = calib.depth.data;
+    const float* c = calib.color.data;
+    // bilinear sampling needs two pixels each way
+    if(depthWidth <= 0 || depthHeight <= 0 || colorWidth <= 0 || colorHeight <= 0
+            || imageWidth < 2 || imageHeight < 2 || d[0] == 0.f || d[4] == 0.f){
+        return false;
+    }
+
+    // color intrinsic scaled to the sampled image and to fixed point
+    const float sx = (float)imageWidth / colorWidth;
+    const float sy = (float)imageHeight / colorHeight;
+    const float k[3][3] = {
+        {c[0] * sx * kWeightOne, 0.f, ((c[2] + 0.5f) * sx - 0.5f) * kWeightOne},
+        {0.f, c[4] * sy * kWeightOne, ((c[5] + 0.5f) * sy - 0.5f) * kWeightOne},
+        {0.f, 0.f, 1.f},
+    };
+    const float* e = calib.depthToColor.data;
+    float m[3][4];
+    for(int r = 0; r < 3; r++){
+        for(int i = 0; i < 4; i++){
+            m[r][i] = k[r][0] * e[i] + k[r][1] * e[4 + i] + k[r][2] * e[8 + i];
+        }
+    }
+
+    _col.resize(depthWidth * 3);
+    for(int u = 0; u < depthWidth; u++){
+        float ray = (u - d[2]) / d[0];
+        for(int r = 0; r < 3; r++){
+            _col[u * 3 + r] = ray * m[r][0];
+        }
+    }
+    _row.resize(depthHeight * 3);
+    for(int v = 0; v < depthHeight; v++){
+        float ray = (v - d[5]) / d[4];
+        for(int r = 0; r < 3; r++){
+            _row[v * 3 + r] = ray * m[r][1] + m[r][2];
+        }
+    }
+    for(int r = 0; r < 3; r++){
+        _offset[r] = m[r][3];
+    }
+
+    _calib = calib;
+    _depthWidth = depthWidth;
+    _depthHeight = depthHeight;
+    _colorWidth = colorWidth;
+    _colorHeight = colorHeight;
+    _imageWidth = imageWidth;
+    _imageHeight = imageHeight;
+    return true;
+}
+
+
+void ColorToDepth::run(const uint16_t* depth, int depthStride, const uint8_t* bgr, int bgrStride
+        , uint8_t* out, int outStride, OutputFormat format)
+{
+    if(!valid()){
+        return;
+    }
+    Job job;
+    job.depth = depth;
+    job.depthStride = depthStride;
+    job.bgr = bgr;
+    job.bgrStride = bgrStride;
+    job.out = out;
+    job.outStride = outStride;
+    job.format = format;
+
+    int bands = 1;
+    if(_pool){
+        bands = _depthHeight / kMinBandRows;
+        if(bands > _pool->size()){
+            bands = _pool->size();
+        }
+    }
+    BandTask task;
+    task.self = this;
+    task.job = &job;
+    task.bands = bands > 1 ? bands : 1;
+    if(task.bands > 1){
+        _pool->parallelFor(task.bands, task);
+    } else {
+        task.run(0);
+    }
+}
+
+
+void ColorToDepth::BandTask::run(int index)
+{
+    int rows = self->_depthHeight;
+    int begin = (int)((int64_t)rows * index / bands);
+    int end = (int)((int64_t)rows * (index + 1) / bands);
+    self->sampleRows(*job, begin, end);
+}
+
+
+// 6 bytes, the pixel pair, without reading past them
+static inline void load6(const uint8_t* p, uint32_t& lo, uint32_t& hi)
+{
+    uint16_t h;
+    memcpy(&lo, p, 4);
+    memcpy(&h, p + 4, 2);
+    hi = h;
+}
+
+
+// Bilinear BGR between the pixel pairs at top and bottom, weights of the
+// right and lower pixels out of 128. Gives b | g << 8 | r << 16.
+static inline uint32_t sampleBGR(const uint8_t* top, const uint8_t* bottom, int wx, int wy)
+{
+#if defined(COLOR_TO_DEPTH_SSE2) || defined(COLOR_TO_DEPTH_NEON)
+    uint32_t tlo, thi, blo, bhi;
+    load6(top, tlo, thi);
+    load6(bottom, blo, bhi);
+#endif
+#if defined(COLOR_TO_DEPTH_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    __m128i t16 = _mm_unpacklo_epi8(_mm_insert_epi16(_mm_cvtsi32_si128((int)tlo), (int)thi, 2), zero);
+    __m128i b16 = _mm_unpacklo_epi8(_mm_insert_epi16(_mm_cvtsi32_si128((int)blo), (int)bhi, 2), zero);
+    // b0 g0 r0 b1 g1 r1 between the rows, at most 255 * 128
+    __m128i vert = _mm_add_epi16(_mm_mullo_epi16(t16, _mm_set1_epi16((short)(128 - wy)))
+            , _mm_mullo_epi16(b16, _mm_set1_epi16((short)wy)));
+    // b0 b1 g0 g1 r0 r1 against 128 - wx, wx
+    __m128i pairs = _mm_unpacklo_epi16(vert, _mm_srli_si128(vert, 6));
+    __m128i sum = _mm_madd_epi16(pairs, _mm_set1_epi32((wx << 16) | (128 - wx)));
+    sum = _mm_srli_epi32(_mm_add_epi32(sum, _mm_set1_epi32(1 << 13)), 14);
+    sum = _mm_packs_epi32(sum, sum);
+    sum = _mm_packus_epi16(sum, sum);
+    return (uint32_t)_mm_cvtsi128_si32(sum) & 0xffffff;
+#elif defined(COLOR_TO_DEPTH_NEON)
+    uint8x8_t t8 = vcreate_u8((uint64_t)tlo | ((uint64_t)thi << 32));
+    uint8x8_t b8 = vcreate_u8((uint64_t)blo | ((uint64_t)bhi << 32));
+    uint16x8_t vert = vmlal_u8(vmull_u8(t8, vdup_n_u8((uint8_t)(128 - wy))), b8, vdup_n_u8((uint8_t)wy));
+    uint16x8_t next = vextq_u16(vert, vert, 3);
+    uint32x4_t sum = vmlal_n_u16(vmull_n_u16(vget_low_u16(vert), (uint16_t)(128 - wx))
+            , vget_low_u16(next), (uint16_t)wx);
+    uint16x4_t s16 = vrshrn_n_u32(sum, 14);
+    uint8x8_t s8 = vmovn_u16(vcombine_u16(s16, s16));
+    return vget_lane_u32(vreinterpret_u32_u8(s8), 0) & 0xffffff;
+#else
+    uint32_t v = 0;
+    for(int ch = 0; ch < 3; ch++){
+        int left = top[ch] * (128 - wy) + bottom[ch] * wy;
+        int right = top[3 + ch] * (128 - wy) + bottom[3 + ch] * wy;
+        v |= (uint32_t)((left * (128 - wx) + right * wx + (1 << 13)) >> 14) << (ch * 8);
+    }
+    return v;
+#endif
+}
+
+
+void ColorToDepth::sampleRows(const Job& job, int rowBegin, int rowEnd) const
+{
+    const int width = _depthWidth;
+    const int channels = ColorToDepth::channels(job.format);
+    const bool swap = job.format == OUTPUT_RGB || job.format == OUTPUT_RGBA;
+    const float ox = _offset[0], oy = _offset[1], ow = _offset[2];
+    const float* col = &_col[0];
+    // projections in [-0.5, size - 0.5) are inside, sampling is clamped
+    // so the pixel pair to the right and below always exists
+    const float minX = -0.5f * kWeightOne;
+    const float minY = -0.5f * kWeightOne;
+    const float maxX = (_imageWidth - 0.5f) * kWeightOne;
+    const float maxY = (_imageHeight - 0.5f) * kWeightOne;
+    const float limX = (float)((_imageWidth - 1) * kWeightOne - 1);
+    const float limY = (float)((_imageHeight - 1) * kWeightOne - 1);
+
+    int ix[kChunk], iy[kChunk];
+    for(int v = rowBegin; v < rowEnd; v++){
+        const uint16_t* d = job.depth + (size_t)v * job.depthStride;
+        const float* row = &_row[v * 3];
+        uint8_t* o = job.out + (size_t)v * job.outStride;
+        for(int begin = 0; begin < width; begin += kChunk){
+            const int count = width - begin < kChunk ? width - begin : kChunk;
+
+            // branch free so it vectorizes, -1 marks pixels without color
+            for(int i = 0; i < count; i++){
+                const float z = d[begin + i];
+                const float* cu = col + (begin + i) * 3;
+                float w = z * (cu[2] + row[2]) + ow;
+                float inv = 1.f / w;
+                float x = (z * (cu[0] + row[0]) + ox) * inv;
+                float y = (z * (cu[1] + row[1]) + oy) * inv;
+                bool inside = z > 0.f && w >= 1.f && x >= minX && x < maxX && y >= minY && y < maxY;
+                x = inside ? (x < 0.f ? 0.f : (x > limX ? limX : x)) : 0.f;
+                y = inside ? (y < 0.f ? 0.f : (y > limY ? limY : y)) : 0.f;
+                ix[i] = inside ? (int)x : -1;
+                iy[i] = (int)y;
+            }
+
+            for(int i = 0; i < count; i++, o += channels){
+                uint32_t c = 0;
+                uint8_t alpha = 0;
+                if(ix[i] >= 0){
+                    const uint8_t* top = job.bgr + (size_t)(iy[i] >> kWeightBits) * job.bgrStride
+                            + (ix[i] >> kWeightBits) * 3;
+                    c = sampleBGR(top, top + job.bgrStride
+                            , ix[i] & (kWeightOne - 1), iy[i] & (kWeightOne - 1));
+                    alpha = 255;
+                }
+                uint8_t b = (uint8_t)c, g = (uint8_t)(c >> 8), r = (uint8_t)(c >> 16);
+                o[0] = swap ? r : b;
+                o[1] = g;
+                o[2] = swap ? b : r;
+                if(channels == 4){
+                    o[3] = alpha;
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,98 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_COLOR_TO_DEPTH_HPP_
+#define PERCIPIO_SAMPLE_COMMON_COLOR_TO_DEPTH_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "TY_API.h"
+#include "DepthRegistration.hpp"
+#include "ThreadPool.hpp"
+
+/// Color sampled on the depth grid, the reverse of DepthRegistration.
+///
+/// Every depth pixel is moved into the color camera and the undistorted
+/// BGR image is sampled there bilinearly, giving one color per depth pixel
+/// for colored point clouds. The projection tables are kept per
+/// calibration and size, so a frame costs a fixed amount of work per depth
+/// pixel whatever the color resolution. Depth pixels that are 0 or fall
+/// outside the color image come out black with alpha 0, all others have
+/// alpha 255.
+///
+/// Row bands run on the thread pool if one is set.
+class ColorToDepth
+{
+public:
+    enum OutputFormat {
+        OUTPUT_BGR = 0,
+        OUTPUT_BGRA = 1,
+        OUTPUT_RGB = 2,
+        OUTPUT_RGBA = 3,
+    };
+
+    ColorToDepth();
+
+    void setThreadPool(ThreadPool* pool) { _pool = pool; }
+
+    /// Build the projection tables for depth images of depthWidth x
+    /// depthHeight sampling color images of imageWidth x imageHeight,
+    /// colorWidth x colorHeight being the size calib.color is for. Nothing
+    /// to do if nothing changed, false on a singular intrinsic.
+    bool setup(const DepthRegistration::Calibration& calib, int depthWidth, int depthHeight
+            , int colorWidth, int colorHeight, int imageWidth, int imageHeight);
+
+    bool valid() const { return _depthWidth > 0; }
+
+    static int channels(OutputFormat format) { return format == OUTPUT_BGRA || format == OUTPUT_RGBA ? 4 : 3; }
+
+    /// depthStride is in pixels, bgrStride and outStride in bytes. out is
+    /// depthWidth x depthHeight of channels(format) bytes per pixel.
+    void run(const uint16_t* depth, int depthStride, const uint8_t* bgr, int bgrStride
+            , uint8_t* out, int outStride, OutputFormat format);
+
+private:
+    ColorToDepth(const ColorToDepth&);
+    ColorToDepth& operator=(const ColorToDepth&);
+
+    /// below this many rows per band threading does not pay off
+    enum { kMinBandRows = 16 };
+    /// pixels projected at once before they are sampled
+    enum { kChunk = 128 };
+    /// bilinear weights are fixed point with this many fraction bits
+    enum { kWeightBits = 7, kWeightOne = 1 << kWeightBits };
+
+    struct Job {
+        const uint16_t* depth;
+        int             depthStride;
+        const uint8_t*  bgr;
+        int             bgrStride;
+        uint8_t*        out;
+        int             outStride;
+        OutputFormat    format;
+    };
+
+    struct BandTask : public ParallelTask {
+        ColorToDepth*   self;
+        const Job*      job;
+        int             bands;
+        virtual void run(int index);
+    };
+
+    void sampleRows(const Job& job, int rowBegin, int rowEnd) const;
+
+    DepthRegistration::Calibration _calib;
+    int                     _depthWidth;
+    int                     _depthHeight;
+    int                     _colorWidth;
+    int                     _colorHeight;
+    int                     _imageWidth;
+    int                     _imageHeight;
+    ThreadPool*             _pool;
+
+    // color pixel homogeneous coordinates of a point at depth z of pixel
+    // (u, v) are z * (_col[u] + _row[v]) + _offset, in 1 / kWeightOne pixels
+    std::vector<float>      _col;       ///< 3 per column
+    std::vector<float>      _row;       ///< 3 per row
+    float                   _offset[3];
+};
+
+
+#endif
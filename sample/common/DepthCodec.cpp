@@ -0,0 +1,575 @@
+#include "DepthCodec.hpp"
+#include <string.h>
+#ifdef _MSC_VER
+# include <intrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DEPTH_CODEC_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define DEPTH_CODEC_NEON
+#endif
+
+#define TY_DEPTH_STREAM_MAGIC   "TYDEPTH"
+#define TY_DEPTH_FRAME_MAGIC    0x5a445954  // "TYDZ"
+
+struct DepthFrameHeader {
+    uint32_t    magic;
+    int32_t     width;
+    int32_t     height;
+    uint32_t    codedSize;
+    uint64_t    timestamp;
+};
+
+static const int kBlock = 16;
+static const int kMaxRun = 127;
+
+
+// residuals wrap around 16 bits, so does the prediction in the decoder
+static inline uint16_t zigzag(uint16_t d)
+{
+    return (uint16_t)((d << 1) ^ (0u - (d >> 15)));
+}
+
+static inline uint16_t unzigzag(uint32_t z)
+{
+    return (uint16_t)((z >> 1) ^ (0u - (z & 1)));
+}
+
+static inline int bitLength(uint32_t v)
+{
+#if defined(__GNUC__)
+    return v ? 32 - __builtin_clz(v) : 0;
+#elif defined(_MSC_VER)
+    unsigned long i;
+    return _BitScanReverse(&i, v) ? (int)i + 1 : 0;
+#else
+    int n = 0;
+    for(; v; v >>= 1){
+        n++;
+    }
+    return n;
+#endif
+}
+
+static inline int bitCount(uint32_t v)
+{
+#if defined(__GNUC__)
+    return __builtin_popcount(v);
+#else
+    int n = 0;
+    for(; v; v &= v - 1){
+        n++;
+    }
+    return n;
+#endif
+}
+
+// The bit stream is little endian, the 8 byte loads and stores below
+// assume a little endian host (x86 and ARM).
+static inline uint64_t load64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store64(uint8_t* p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/// n values of b bits, least significant first, padded to a byte. Writes
+/// up to 8 bytes past the packed bits.
+static inline uint8_t* packBits(const uint16_t* v, int n, int b, uint8_t* out)
+{
+    uint64_t acc = 0;
+    int bits = 0;
+    for(int i = 0; i < n; i++){
+        acc |= (uint64_t)v[i] << bits;
+        bits += b;
+        store64(out, acc);
+        const int bytes = bits >> 3;
+        out += bytes;
+        acc >>= bytes * 8;
+        bits &= 7;
+    }
+    return out + (bits > 0);
+}
+
+/// packBits() of a full block. 8 values of b bits are exactly b bytes, each
+/// half block is packed as two independent groups of 4 values. B is a
+/// template parameter so that all shifts are constants.
+template<int B>
+static uint8_t* packBlock(const uint16_t* v, uint8_t* out)
+{
+    const int gb = 4 * B;
+    for(int h = 0; h < kBlock; h += 8, v += 8){
+        const uint64_t lo = (uint64_t)v[0] | (uint64_t)v[1] << B
+                | (uint64_t)v[2] << 2 * B | (uint64_t)v[3] << 3 * B;
+        const uint64_t hi = (uint64_t)v[4] | (uint64_t)v[5] << B
+                | (uint64_t)v[6] << 2 * B | (uint64_t)v[7] << 3 * B;
+        // with B odd the groups share a byte
+        const int o = gb >> 3;
+        const int sh = gb & 7;
+        store64(out, lo);
+        store64(out + o, sh ? (lo >> (o * 8 & 63)) | (hi << sh) : hi);
+        out += B;
+    }
+    return out;
+}
+
+typedef uint8_t* (*PackBlockFn)(const uint16_t*, uint8_t*);
+static const PackBlockFn kPackBlock[17] = {
+    packBlock<0>,  packBlock<1>,  packBlock<2>,  packBlock<3>,
+    packBlock<4>,  packBlock<5>,  packBlock<6>,  packBlock<7>,
+    packBlock<8>,  packBlock<9>,  packBlock<10>, packBlock<11>,
+    packBlock<12>, packBlock<13>, packBlock<14>, packBlock<15>,
+    packBlock<16>,
+};
+
+/// Residuals of the valid pixels of a block into zz, returns their count.
+/// Holes are set in mask, all is the or of the residuals.
+static inline int blockResiduals(const uint16_t* s, int n, uint16_t& prev
+        , uint16_t* zz, uint32_t& mask, uint32_t& all)
+{
+    uint16_t lo = 0xffff;
+    for(int i = 0; i < n; i++){
+        lo = s[i] < lo ? s[i] : lo;
+    }
+    mask = 0;
+    all = 0;
+    if(lo){
+        zz[0] = zigzag(s[0] - prev);
+        for(int i = 1; i < n; i++){
+            zz[i] = zigzag(s[i] - s[i - 1]);
+        }
+        for(int i = 0; i < n; i++){
+            all |= zz[i];
+        }
+        prev = s[n - 1];
+        return n;
+    }
+    int cnt = 0;
+    for(int i = 0; i < n; i++){
+        if(!s[i]){
+            mask |= 1u << i;
+            continue;
+        }
+        zz[cnt] = zigzag(s[i] - prev);
+        all |= zz[cnt++];
+        prev = s[i];
+    }
+    return cnt;
+}
+
+/// blockResiduals() of a full block
+static inline int fullBlockResiduals(const uint16_t* s, uint16_t& prev
+        , uint16_t* zz, uint32_t& mask, uint32_t& all)
+{
+#if defined(DEPTH_CODEC_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i a = _mm_loadu_si128((const __m128i*)s);
+    const __m128i b = _mm_loadu_si128((const __m128i*)(s + 8));
+    const int holes = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpeq_epi16(a, zero), _mm_cmpeq_epi16(b, zero)));
+    if(holes == 0xffff){
+        mask = 0xffff;
+        all = 0;
+        return 0;
+    }
+    if(!holes){
+        const __m128i pa = _mm_or_si128(_mm_slli_si128(a, 2), _mm_cvtsi32_si128(prev));
+        const __m128i pb = _mm_or_si128(_mm_slli_si128(b, 2), _mm_srli_si128(a, 14));
+        const __m128i da = _mm_sub_epi16(a, pa);
+        const __m128i db = _mm_sub_epi16(b, pb);
+        const __m128i za = _mm_xor_si128(_mm_slli_epi16(da, 1), _mm_srai_epi16(da, 15));
+        const __m128i zb = _mm_xor_si128(_mm_slli_epi16(db, 1), _mm_srai_epi16(db, 15));
+        _mm_storeu_si128((__m128i*)zz, za);
+        _mm_storeu_si128((__m128i*)(zz + 8), zb);
+        __m128i o = _mm_or_si128(za, zb);
+        o = _mm_or_si128(o, _mm_srli_si128(o, 8));
+        o = _mm_or_si128(o, _mm_srli_si128(o, 4));
+        o = _mm_or_si128(o, _mm_srli_si128(o, 2));
+        all = _mm_cvtsi128_si32(o) & 0xffff;
+        mask = 0;
+        prev = s[kBlock - 1];
+        return kBlock;
+    }
+#elif defined(DEPTH_CODEC_NEON)
+    const uint16x8_t a = vld1q_u16(s);
+    const uint16x8_t b = vld1q_u16(s + 8);
+    if(vmaxvq_u16(vmaxq_u16(a, b)) == 0){
+        mask = 0xffff;
+        all = 0;
+        return 0;
+    }
+    if(vminvq_u16(vminq_u16(a, b))){
+        const int16x8_t da = vreinterpretq_s16_u16(vsubq_u16(a, vextq_u16(vdupq_n_u16(prev), a, 7)));
+        const int16x8_t db = vreinterpretq_s16_u16(vsubq_u16(b, vextq_u16(a, b, 7)));
+        const uint16x8_t za = vreinterpretq_u16_s16(veorq_s16(vshlq_n_s16(da, 1), vshrq_n_s16(da, 15)));
+        const uint16x8_t zb = vreinterpretq_u16_s16(veorq_s16(vshlq_n_s16(db, 1), vshrq_n_s16(db, 15)));
+        vst1q_u16(zz, za);
+        vst1q_u16(zz + 8, zb);
+        // same bit length as the or of all
+        all = vmaxvq_u16(vmaxq_u16(za, zb));
+        mask = 0;
+        prev = s[kBlock - 1];
+        return kBlock;
+    }
+#endif
+    return blockResiduals(s, kBlock, prev, zz, mask, all);
+}
+
+
+/// Inverse of packBlock(), prev is the running prediction. Reads up to 8
+/// bytes past the packed bits.
+template<int B>
+static void unpackFullBlock(const uint8_t* in, uint16_t& prev, uint16_t* d)
+{
+    const uint32_t m = (1u << B) - 1;
+    const int gb = 4 * B;
+    for(int h = 0; h < kBlock; h += 8, in += B){
+        const uint64_t lo = load64(in);
+        const uint64_t hi = load64(in + (gb >> 3)) >> (gb & 7);
+        // unrolled by hand, -O2 keeps the loop and its variable shifts
+        d[h + 0] = prev += unzigzag((uint32_t)lo & m);
+        d[h + 1] = prev += unzigzag((uint32_t)(lo >> B) & m);
+        d[h + 2] = prev += unzigzag((uint32_t)(lo >> 2 * B) & m);
+        d[h + 3] = prev += unzigzag((uint32_t)(lo >> 3 * B) & m);
+        d[h + 4] = prev += unzigzag((uint32_t)hi & m);
+        d[h + 5] = prev += unzigzag((uint32_t)(hi >> B) & m);
+        d[h + 6] = prev += unzigzag((uint32_t)(hi >> 2 * B) & m);
+        d[h + 7] = prev += unzigzag((uint32_t)(hi >> 3 * B) & m);
+    }
+}
+
+typedef void (*UnpackBlockFn)(const uint8_t*, uint16_t&, uint16_t*);
+static const UnpackBlockFn kUnpackFullBlock[17] = {
+    unpackFullBlock<0>,  unpackFullBlock<1>,  unpackFullBlock<2>,  unpackFullBlock<3>,
+    unpackFullBlock<4>,  unpackFullBlock<5>,  unpackFullBlock<6>,  unpackFullBlock<7>,
+    unpackFullBlock<8>,  unpackFullBlock<9>,  unpackFullBlock<10>, unpackFullBlock<11>,
+    unpackFullBlock<12>, unpackFullBlock<13>, unpackFullBlock<14>, unpackFullBlock<15>,
+    unpackFullBlock<16>,
+};
+
+/// Residuals of any block, same read slack.
+static inline void unpackBlock(const uint8_t* in, int n, int b, uint32_t mask
+        , uint16_t& prev, uint16_t* d)
+{
+    const uint32_t m = (1u << b) - 1;
+    int bits = 0;
+    for(int i = 0; i < n; i++){
+        if(mask & (1u << i)){
+            d[i] = 0;
+            continue;
+        }
+        prev += unzigzag((uint32_t)(load64(in) >> bits) & m);
+        d[i] = prev;
+        bits += b;
+        in += bits >> 3;
+        bits &= 7;
+    }
+}
+
+/// unpackBlock() for the last bytes of the stream, reads byte by byte
+static void unpackBlockTail(const uint8_t* in, int n, int b, uint32_t mask
+        , uint16_t& prev, uint16_t* d)
+{
+    const uint32_t m = (1u << b) - 1;
+    uint32_t acc = 0;
+    int bits = 0;
+    for(int i = 0; i < n; i++){
+        if(mask & (1u << i)){
+            d[i] = 0;
+            continue;
+        }
+        while(bits < b){
+            acc |= (uint32_t)*in++ << bits;
+            bits += 8;
+        }
+        prev += unzigzag(acc & m);
+        acc >>= b;
+        bits -= b;
+        d[i] = prev;
+    }
+}
+
+size_t depthCodedBound(int width, int height)
+{
+    // header, mask and 16 bit residuals for every block, and the slack
+    // of the 8 byte stores
+    size_t blocks = (size_t)((width + kBlock - 1) / kBlock) * height;
+    return blocks * (1 + 2 + kBlock * 2) + 8;
+}
+
+
+size_t encodeDepth16(const uint16_t* depth, int width, int height, int stride, uint8_t* out)
+{
+    uint8_t* p = out;
+    uint16_t rowPred = 0;
+    uint16_t zz[kBlock];
+    for(int y = 0; y < height; y++){
+        const uint16_t* row = depth + (size_t)y * stride;
+        uint16_t prev = rowPred;
+        bool first = true;
+        int run = 0;
+        for(int x = 0; x < width; x += kBlock){
+            const uint16_t* s = row + x;
+            const int n = width - x < kBlock ? width - x : kBlock;
+
+            uint32_t mask;
+            uint32_t all;
+            const int cnt = n == kBlock ? fullBlockResiduals(s, prev, zz, mask, all)
+                    : blockResiduals(s, n, prev, zz, mask, all);
+
+            if(!cnt){
+                if(++run == kMaxRun){
+                    *p++ = (uint8_t)(0x80 | run);
+                    run = 0;
+                }
+                continue;
+            }
+            if(run){
+                *p++ = (uint8_t)(0x80 | run);
+                run = 0;
+            }
+            if(first){
+                first = false;
+                for(int i = 0; i < n; i++){
+                    if(s[i]){
+                        rowPred = s[i];
+                        break;
+                    }
+                }
+            }
+
+            const int b = bitLength(all);
+            if(mask){
+                p[0] = (uint8_t)(0x40 | b);
+                p[1] = (uint8_t)mask;
+                p[2] = (uint8_t)(mask >> 8);
+                p += 3;
+            } else {
+                *p++ = (uint8_t)b;
+            }
+            p = cnt == kBlock ? kPackBlock[b](zz, p) : packBits(zz, cnt, b, p);
+        }
+        if(run){
+            *p++ = (uint8_t)(0x80 | run);
+        }
+    }
+    return p - out;
+}
+
+
+bool decodeDepth16(const uint8_t* in, size_t size, uint16_t* depth, int width, int height, int stride)
+{
+    const uint8_t* end = in + size;
+    uint16_t rowPred = 0;
+    for(int y = 0; y < height; y++){
+        uint16_t* row = depth + (size_t)y * stride;
+        uint16_t prev = rowPred;
+        bool first = true;
+        int x = 0;
+        while(x < width){
+            if(in >= end){
+                return false;
+            }
+            const uint8_t h = *in++;
+            if(!first && h <= 16 && width - x >= kBlock && (size_t)(end - in) >= (size_t)2 * h + 8){
+                // full block without hole, most of an image
+                kUnpackFullBlock[h](in, prev, row + x);
+                in += 2 * h;
+                x += kBlock;
+                continue;
+            }
+            if(h & 0x80){
+                // a run ends at the row end, the last block may be short
+                int px = (h & 0x7f) * kBlock;
+                if(px == 0 || px - kBlock >= width - x){
+                    return false;
+                }
+                px = px < width - x ? px : width - x;
+                memset(row + x, 0, px * sizeof(uint16_t));
+                x += px;
+                continue;
+            }
+
+            const int n = width - x < kBlock ? width - x : kBlock;
+            const int b = h & 0x1f;
+            if(b > 16 || (h & 0x20)){
+                return false;
+            }
+            uint32_t mask = 0;
+            if(h & 0x40){
+                if(end - in < 2){
+                    return false;
+                }
+                mask = in[0] | (in[1] << 8);
+                in += 2;
+                if(mask >> n){
+                    return false;
+                }
+            }
+            const int cnt = n - bitCount(mask);
+            const size_t bytes = (size_t)(cnt * b + 7) / 8;
+            if((size_t)(end - in) < bytes){
+                return false;
+            }
+
+            uint16_t* d = row + x;
+            if((size_t)(end - in) >= bytes + 8){
+                unpackBlock(in, n, b, mask, prev, d);
+            } else {
+                unpackBlockTail(in, n, b, mask, prev, d);
+            }
+            in += bytes;
+            if(first && cnt){
+                first = false;
+                for(int i = 0; i < n; i++){
+                    if(d[i]){
+                        rowPred = d[i];
+                        break;
+                    }
+                }
+            }
+            x += n;
+        }
+    }
+    return in == end;
+}
+
+
+//------------------------------------------------------------------------------
+//  Depth stream file
+//------------------------------------------------------------------------------
+
+DepthStreamWriter::DepthStreamWriter()
+    : _fp(NULL)
+{
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+
+DepthStreamWriter::~DepthStreamWriter()
+{
+    close();
+}
+
+
+bool DepthStreamWriter::open(const char* path)
+{
+    close();
+    _fp = fopen(path, "wb");
+    if(!_fp){
+        return false;
+    }
+    memset(&_stats, 0, sizeof(_stats));
+    char magic[8] = TY_DEPTH_STREAM_MAGIC;
+    if(fwrite(magic, sizeof(magic), 1, _fp) != 1){
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+bool DepthStreamWriter::write(const uint16_t* depth, int width, int height, int stride
+        , uint64_t timestamp)
+{
+    if(!_fp || !depth || width <= 0 || height <= 0){
+        return false;
+    }
+    _coded.resize(depthCodedBound(width, height));
+    DepthFrameHeader h;
+    h.magic = TY_DEPTH_FRAME_MAGIC;
+    h.width = width;
+    h.height = height;
+    h.codedSize = (uint32_t)encodeDepth16(depth, width, height, stride, &_coded[0]);
+    h.timestamp = timestamp;
+    if(fwrite(&h, sizeof(h), 1, _fp) != 1
+            || fwrite(&_coded[0], 1, h.codedSize, _fp) != h.codedSize){
+        return false;
+    }
+    _stats.frames++;
+    _stats.rawBytes += (uint64_t)width * height * sizeof(uint16_t);
+    _stats.codedBytes += sizeof(h) + h.codedSize;
+    return true;
+}
+
+
+void DepthStreamWriter::close()
+{
+    if(_fp){
+        fclose(_fp);
+        _fp = NULL;
+    }
+}
+
+
+DepthStreamReader::DepthStreamReader()
+    : _fp(NULL)
+{
+}
+
+
+DepthStreamReader::~DepthStreamReader()
+{
+    close();
+}
+
+
+bool DepthStreamReader::open(const char* path)
+{
+    close();
+    _fp = fopen(path, "rb");
+    if(!_fp){
+        return false;
+    }
+    char magic[8];
+    if(fread(magic, sizeof(magic), 1, _fp) != 1 || memcmp(magic, TY_DEPTH_STREAM_MAGIC, sizeof(magic)) != 0){
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+bool DepthStreamReader::read(std::vector<uint16_t>& depth, int* width, int* height
+        , uint64_t* timestamp)
+{
+    DepthFrameHeader h;
+    if(!_fp || fread(&h, sizeof(h), 1, _fp) != 1){
+        return false;
+    }
+    if(h.magic != TY_DEPTH_FRAME_MAGIC || h.width <= 0 || h.height <= 0
+            || h.width > 65536 || h.height > 65536
+            || h.codedSize > depthCodedBound(h.width, h.height)){
+        return false;
+    }
+    _coded.resize(h.codedSize + 1);
+    if(fread(&_coded[0], 1, h.codedSize, _fp) != h.codedSize){
+        return false;
+    }
+    depth.resize((size_t)h.width * h.height);
+    if(!decodeDepth16(&_coded[0], h.codedSize, &depth[0], h.width, h.height, h.width)){
+        return false;
+    }
+    *width = h.width;
+    *height = h.height;
+    if(timestamp){
+        *timestamp = h.timestamp;
+    }
+    return true;
+}
+
+
+void DepthStreamReader::close()
+{
+    if(_fp){
+        fclose(_fp);
+        _fp = NULL;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_DEPTH_CODEC_HPP_
+#define PERCIPIO_SAMPLE_COMMON_DEPTH_CODEC_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <vector>
+
+// Lossless coding of TY_PIXEL_FORMAT_DEPTH16 images.
+//
+// Each row is cut in blocks of 16 pixels. Valid pixels are predicted from
+// the previous valid pixel of the row (the first valid pixel of the row
+// above at the row start), residuals are zigzag mapped and bit packed with
+// the width of the largest one. Invalid (zero) pixels are not coded, a
+// 16 bit mask marks them in mixed blocks and runs of empty blocks take one
+// byte. Block header byte:
+//
+//   000bbbbb       all pixels valid, b bits per residual
+//   010bbbbb       followed by the zero mask, b bits per valid residual
+//   1nnnnnnn       n blocks without valid pixel
+//
+// The coded stream has no header, width and height travel with it.
+
+/// Largest coded size of a width x height image.
+size_t depthCodedBound(int width, int height);
+
+/// Code depth, stride in pixels. out holds depthCodedBound() bytes.
+/// Returns the coded size.
+size_t encodeDepth16(const uint16_t* depth, int width, int height, int stride, uint8_t* out);
+
+/// Decode a stream of encodeDepth16(), false if it is corrupt.
+bool decodeDepth16(const uint8_t* in, size_t size, uint16_t* depth, int width, int height, int stride);
+
+
+/// Sequence of coded depth frames in one file, written as they come.
+class DepthStreamWriter
+{
+public:
+    struct Stats {
+        uint64_t    frames;
+        uint64_t    rawBytes;
+        uint64_t    codedBytes;
+    };
+
+    DepthStreamWriter();
+    ~DepthStreamWriter();
+
+    bool open(const char* path);
+    bool isOpen() const { return _fp != NULL; }
+    /// timestamp is stored as is, usually TY_IMAGE_DATA::timestamp
+    bool write(const uint16_t* depth, int width, int height, int stride, uint64_t timestamp);
+    void close();
+
+    Stats stats() const { return _stats; }
+
+private:
+    DepthStreamWriter(const DepthStreamWriter&);
+    DepthStreamWriter& operator=(const DepthStreamWriter&);
+
+    FILE*                   _fp;
+    std::vector<uint8_t>    _coded;
+    Stats                   _stats;
+};
+
+
+class DepthStreamReader
+{
+public:
+    DepthStreamReader();
+    ~DepthStreamReader();
+
+    bool open(const char* path);
+    bool isOpen() const { return _fp != NULL; }
+    /// Next frame, depth is resized to width * height. false at the end
+    /// of the file or on a corrupt frame.
+    bool read(std::vector<uint16_t>& depth, int* width, int* height, uint64_t* timestamp = NULL);
+    void close();
+
+private:
+    DepthStreamReader(const DepthStreamReader&);
+    DepthStreamReader& operator=(const DepthStreamReader&);
+
+    FILE*                   _fp;
+    std::vector<uint8_t>    _coded;
+};
+
+
+#endif
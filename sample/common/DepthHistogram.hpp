@@ -0,0 +1,258 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_DEPTH_HISTOGRAM_HPP_
+#define PERCIPIO_SAMPLE_COMMON_DEPTH_HISTOGRAM_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <string.h>
+#include <vector>
+
+/// Flat histogram over the whole 16 bit depth range.
+/// Counting is branch free, invalid pixels are counted into their own bin
+/// and left out when querying.
+class DepthHistogram {
+public:
+    DepthHistogram() : _hist(65536, 0)
+                     , _count(0)
+                     , _invalid(0)
+                     , _row_step(1)
+                     , _col_step(1)
+                     {}
+
+    /// only count every rowStep-th row and colStep-th column
+    void SetSubsample(int rowStep, int colStep){
+                _row_step = rowStep > 1 ? rowStep : 1;
+                _col_step = colStep > 1 ? colStep : 1;
+            }
+    void SetInvalidLabel(uint16_t invalid){
+                _invalid = invalid;
+            }
+    int RowStep() const { return _row_step; }
+    int ColStep() const { return _col_step; }
+    uint16_t InvalidLabel() const { return _invalid; }
+
+    void Reset(){
+                memset(&_hist[0], 0, _hist.size() * sizeof(_hist[0]));
+                _count = 0;
+            }
+
+    /// accumulate a 16UC1 image
+    void Add(const cv::Mat& depth){
+                AddRows(depth, 0, depth.rows);
+            }
+
+    /// accumulate rows [begin, end) of a 16UC1 image, the subsample grid is
+    /// anchored at row 0 so bands added separately sample the same pixels
+    /// as the whole image
+    void AddRows(const cv::Mat& depth, int begin, int end){
+                assert(depth.type() == CV_16U);
+                int r = (begin + _row_step - 1) / _row_step * _row_step;
+                for(; r < end; r += _row_step){
+                    AddRow(depth.ptr<uint16_t>(r), depth.cols);
+                }
+            }
+
+    void Merge(const DepthHistogram& other){
+                const uint32_t* src = &other._hist[0];
+                uint32_t* dst = &_hist[0];
+                for(int i = 0; i < 65536; i++){
+                    dst[i] += src[i];
+                }
+                _count += other._count;
+            }
+
+    /// number of valid samples
+    uint32_t Total() const {
+                return _count - _hist[_invalid];
+            }
+    uint32_t Count(uint16_t v) const {
+                return v == _invalid ? 0 : _hist[v];
+            }
+
+    /// Smallest value whose cumulative count exceeds int(total * p). For
+    /// p > 0.5 the search runs from the high end with (1 - p), so
+    /// Percentile(0.99) is the mirror of Percentile(0.01).
+    uint16_t Percentile(double p) const {
+                if(p > 0.5){
+                    return ScanHigh((uint32_t)(Total() * (1.0 - p)));
+                }
+                return ScanLow((uint32_t)(Total() * p));
+            }
+
+    /// trim ratio of the samples from both ends, false if empty
+    bool Range(double ratio, uint16_t& lo, uint16_t& hi) const {
+                uint32_t total = Total();
+                if(total == 0){
+                    return false;
+                }
+                uint32_t delta = (uint32_t)(total * ratio);
+                lo = ScanLow(delta);
+                hi = ScanHigh(delta);
+                return true;
+            }
+
+private:
+    void AddRow(const uint16_t* ptr, int n){
+                uint32_t* h = &_hist[0];
+                if(_col_step == 1){
+                    int i = 0;
+                    for(; i + 4 <= n; i += 4){
+                        h[ptr[i + 0]]++;
+                        h[ptr[i + 1]]++;
+                        h[ptr[i + 2]]++;
+                        h[ptr[i + 3]]++;
+                    }
+                    for(; i < n; i++){
+                        h[ptr[i]]++;
+                    }
+                    _count += n;
+                } else {
+                    int num = 0;
+                    for(int i = 0; i < n; i += _col_step, num++){
+                        h[ptr[i]]++;
+                    }
+                    _count += num;
+                }
+            }
+
+    uint16_t ScanLow(uint32_t delta) const {
+                uint32_t sum = 0;
+                int last = -1;
+                for(int v = 0; v < 65536; v++){
+                    uint32_t c = Count((uint16_t)v);
+                    if(c == 0){ continue; }
+                    sum += c;
+                    last = v;
+                    if(sum > delta){ break; }
+                }
+                return (uint16_t)(last < 0 ? 0 : last);
+            }
+    uint16_t ScanHigh(uint32_t delta) const {
+                uint32_t sum = 0;
+                int last = -1;
+                for(int v = 65535; v >= 0; v--){
+                    uint32_t c = Count((uint16_t)v);
+                    if(c == 0){ continue; }
+                    sum += c;
+                    last = v;
+                    if(sum > delta){ break; }
+                }
+                return (uint16_t)(last < 0 ? 0 : last);
+            }
+
+    std::vector<uint32_t> _hist;
+    uint32_t        _count;
+    uint16_t        _invalid;
+    int             _row_step;
+    int             _col_step;
+};
+
+
+/// Percentile range of a depth stream with temporal hysteresis: the range
+/// is only re-estimated when a coarse scene signature (mean depth and
+/// valid pixel count on a sparse grid) changes, or after maxHoldFrames.
+class DepthRangeTracker {
+public:
+    DepthRangeTracker() : _tolerance(0.f)
+                        , _max_hold(0)
+                        , _held(0)
+                        , _valid(false)
+                        , _sig_mean(0.)
+                        , _sig_count(0)
+                        , _pending_mean(0.)
+                        , _pending_count(0)
+                        , _lo(0)
+                        , _hi(0)
+                        {}
+
+    /// tolerance is the relative signature change that triggers a new
+    /// estimate, 0 re-estimates every frame
+    void SetHysteresis(float tolerance, int maxHoldFrames){
+                _tolerance = tolerance > 0.f ? tolerance : 0.f;
+                _max_hold = maxHoldFrames;
+            }
+
+    DepthHistogram& Histogram() { return _hist; }
+    const DepthHistogram& Histogram() const { return _hist; }
+
+    /// false if the image has no valid pixel
+    bool Update(const cv::Mat& depth, uint16_t invalid, double ratio
+            , uint16_t& lo, uint16_t& hi){
+                if(Check(depth, invalid)){
+                    _hist.SetInvalidLabel(invalid);
+                    _hist.Reset();
+                    _hist.Add(depth);
+                    Estimate(ratio);
+                }
+                return Current(lo, hi);
+            }
+
+    /// Split form of Update for callers that build the histogram
+    /// themselves (e.g. in parallel): if Check returns true, fill
+    /// Histogram() for this frame and call Estimate.
+    bool Check(const cv::Mat& depth, uint16_t invalid){
+                Signature(depth, invalid, _pending_mean, _pending_count);
+                if(_valid && !SceneChanged(_pending_mean, _pending_count)){
+                    _held++;
+                    return false;
+                }
+                return true;
+            }
+    void Estimate(double ratio){
+                _valid = _hist.Range(ratio, _lo, _hi);
+                _sig_mean = _pending_mean;
+                _sig_count = _pending_count;
+                _held = 0;
+            }
+    bool Current(uint16_t& lo, uint16_t& hi) const {
+                lo = _lo;
+                hi = _hi;
+                return _valid;
+            }
+
+    /// force a new estimate on next Update
+    void Invalidate() { _valid = false; }
+
+private:
+    enum { kSignatureStep = 16 };
+
+    static void Signature(const cv::Mat& depth, uint16_t invalid
+            , double& mean, int& count){
+                double sum = 0.;
+                count = 0;
+                for(int r = kSignatureStep / 2; r < depth.rows; r += kSignatureStep){
+                    const uint16_t* ptr = depth.ptr<uint16_t>(r);
+                    for(int c = kSignatureStep / 2; c < depth.cols; c += kSignatureStep){
+                        if(ptr[c] != invalid){
+                            sum += ptr[c];
+                            count++;
+                        }
+                    }
+                }
+                mean = count ? sum / count : 0.;
+            }
+
+    bool SceneChanged(double mean, int count) const {
+                if(_tolerance <= 0.f){
+                    return true;
+                }
+                if(_max_hold > 0 && _held + 1 >= _max_hold){
+                    return true;
+                }
+                double dm = mean > _sig_mean ? mean - _sig_mean : _sig_mean - mean;
+                int dc = count > _sig_count ? count - _sig_count : _sig_count - count;
+                return dm > _tolerance * _sig_mean || dc > _tolerance * (_sig_count + 1);
+            }
+
+    DepthHistogram  _hist;
+    float           _tolerance;
+    int             _max_hold;
+    int             _held;
+    bool            _valid;
+    double          _sig_mean;
+    int             _sig_count;
+    double          _pending_mean;
+    int             _pending_count;
+    uint16_t        _lo;
+    uint16_t        _hi;
+};
+
+#endif
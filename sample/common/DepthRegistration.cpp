@@ -0,0 +1,296 @@
+#include "DepthRegistration.hpp"
+#include "ReplayDispatch.hpp"
+#include <string.h>
+#include <math.h>
+
+
+TY_STATUS DepthRegistration::getCalibration(TY_DEV_HANDLE hDevice, Calibration& calib)
+{
+    TY_STATUS err = TYGetStruct(hDevice, TY_COMPONENT_DEPTH_CAM, TY_STRUCT_CAM_INTRINSIC
+            , &calib.depth, sizeof(calib.depth));
+    if(err == TY_STATUS_OK){
+        err = TYGetStruct(hDevice, TY_COMPONENT_RGB_CAM, TY_STRUCT_CAM_INTRINSIC
+                , &calib.color, sizeof(calib.color));
+    }
+    TY_CAMERA_EXTRINSIC colorToDepth;
+    if(err == TY_STATUS_OK){
+        // depth is in the left IR camera
+        err = TYGetStruct(hDevice, TY_COMPONENT_RGB_CAM, TY_STRUCT_EXTRINSIC_TO_LEFT_IR
+                , &colorToDepth, sizeof(colorToDepth));
+    }
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+
+    // rigid transform, the inverse is [R^T | -R^T t]
+    const float* e = colorToDepth.data;
+    float* inv = calib.depthToColor.data;
+    memset(inv, 0, sizeof(calib.depthToColor.data));
+    for(int r = 0; r < 3; r++){
+        for(int c = 0; c < 3; c++){
+            inv[r * 4 + c] = e[c * 4 + r];
+        }
+        inv[r * 4 + 3] = -(e[r] * e[3] + e[4 + r] * e[7] + e[8 + r] * e[11]);
+    }
+    inv[15] = 1.f;
+    return TY_STATUS_OK;
+}
+
+
+DepthRegistration::DepthRegistration()
+    : _depthWidth(0)
+    , _depthHeight(0)
+    , _colorWidth(0)
+    , _colorHeight(0)
+    , _outWidth(0)
+    , _outHeight(0)
+    , _splat(true)
+    , _pool(NULL)
+    , _splatSize(1)
+    , _zbuf(NULL)
+    , _zbufSize(0)
+{
+    memset(&_calib, 0, sizeof(_calib));
+    memset(_offset, 0, sizeof(_offset));
+}
+
+
+DepthRegistration::~DepthRegistration()
+{
+    delete[] _zbuf;
+}
+
+
+bool DepthRegistration::setup(const Calibration& calib, int depthWidth, int depthHeight
+        , int colorWidth, int colorHeight, int outWidth, int outHeight)
+{
+    if(_outWidth > 0 && depthWidth == _depthWidth && depthHeight == _depthHeight
+            && colorWidth == _colorWidth && colorHeight == _colorHeight
+            && outWidth == _outWidth && outHeight == _outHeight
+            && memcmp(&calib, &_calib, sizeof(calib)) == 0){
+        return true;
+    }
+    _outWidth = 0;
+    _outHeight = 0;
+    const float* d = calib.depth.data;
+    const float* c = calib.color.data;
+    if(depthWidth <= 0 || depthHeight <= 0 || colorWidth <= 0 || colorHeight <= 0
+            || outWidth <= 0 || outHeight <= 0 || d[0] == 0.f || d[4] == 0.f){
+        return false;
+    }
+
+    // color intrinsic scaled to the output, pixel centers stay centers
+    const float sx = (float)outWidth / colorWidth;
+    const float sy = (float)outHeight / colorHeight;
+    const float k[3][3] = {
+        {c[0] * sx, 0.f, (c[2] + 0.5f) * sx - 0.5f},
+        {0.f, c[4] * sy, (c[5] + 0.5f) * sy - 0.5f},
+        {0.f, 0.f, 1.f},
+    };
+    // m = K [R | t] of the output camera
+    const float* e = calib.depthToColor.data;
+    float m[3][4];
+    for(int r = 0; r < 3; r++){
+        for(int i = 0; i < 4; i++){
+            m[r][i] = k[r][0] * e[i] + k[r][1] * e[4 + i] + k[r][2] * e[8 + i];
+        }
+    }
+
+    _col.resize(depthWidth * 3);
+    for(int u = 0; u < depthWidth; u++){
+        float ray = (u - d[2]) / d[0];
+        for(int r = 0; r < 3; r++){
+            _col[u * 3 + r] = ray * m[r][0];
+        }
+    }
+    _row.resize(depthHeight * 3);
+    for(int v = 0; v < depthHeight; v++){
+        float ray = (v - d[5]) / d[4];
+        for(int r = 0; r < 3; r++){
+            _row[v * 3 + r] = ray * m[r][1] + m[r][2];
+        }
+    }
+    for(int r = 0; r < 3; r++){
+        _offset[r] = m[r][3];
+    }
+    // output pixels across one depth pixel, the depth of a point hardly
+    // changes between the cameras
+    float fx = k[0][0] / d[0];
+    float fy = k[1][1] / d[4];
+    _splatSize = (int)ceilf(fx > fy ? fx : fy);
+    if(_splatSize < 1){
+        _splatSize = 1;
+    }
+
+    size_t size = (size_t)outWidth * outHeight;
+    if(size != _zbufSize){
+        delete[] _zbuf;
+        _zbuf = new std::atomic<uint16_t>[size];
+        _zbufSize = size;
+    }
+    for(size_t i = 0; i < size; i++){
+        _zbuf[i].store(kEmpty, std::memory_order_relaxed);
+    }
+
+    _calib = calib;
+    _depthWidth = depthWidth;
+    _depthHeight = depthHeight;
+    _colorWidth = colorWidth;
+    _colorHeight = colorHeight;
+    _outWidth = outWidth;
+    _outHeight = outHeight;
+    return true;
+}
+
+
+int DepthRegistration::bandCount(int rows) const
+{
+    if(!_pool){
+        return 1;
+    }
+    int bands = rows / kMinBandRows;
+    if(bands > _pool->size()){
+        bands = _pool->size();
+    }
+    return bands > 1 ? bands : 1;
+}
+
+
+void DepthRegistration::runBands(int bands, ParallelTask& task)
+{
+    if(bands > 1){
+        _pool->parallelFor(bands, task);
+    } else {
+        task.run(0);
+    }
+}
+
+
+void DepthRegistration::run(const uint16_t* depth, int depthStride, uint16_t* out, int outStride)
+{
+    if(!valid()){
+        return;
+    }
+    // the z-buffer is left empty by the resolve pass of the last run
+    ProjectTask project;
+    project.self = this;
+    project.depth = depth;
+    project.stride = depthStride;
+    project.bands = bandCount(_depthHeight);
+    runBands(project.bands, project);
+
+    ResolveTask resolve;
+    resolve.self = this;
+    resolve.out = out;
+    resolve.stride = outStride;
+    resolve.bands = bandCount(_outHeight);
+    runBands(resolve.bands, resolve);
+}
+
+
+void DepthRegistration::ProjectTask::run(int index)
+{
+    int rows = self->_depthHeight;
+    int begin = (int)((int64_t)rows * index / bands);
+    int end = (int)((int64_t)rows * (index + 1) / bands);
+    if(bands > 1){
+        self->projectRows<true>(depth, stride, begin, end);
+    } else {
+        self->projectRows<false>(depth, stride, begin, end);
+    }
+}
+
+
+void DepthRegistration::ResolveTask::run(int index)
+{
+    int rows = self->_outHeight;
+    int begin = (int)((int64_t)rows * index / bands);
+    int end = (int)((int64_t)rows * (index + 1) / bands);
+    self->resolveRows(out, stride, begin, end);
+}
+
+
+template <bool Shared>
+void DepthRegistration::projectRows(const uint16_t* depth, int stride, int rowBegin, int rowEnd)
+{
+    // members in locals, the z-buffer stores could alias them otherwise
+    const int width = _depthWidth;
+    const int outWidth = _outWidth;
+    const int outHeight = _outHeight;
+    const float outW = (float)outWidth;
+    const float outH = (float)outHeight;
+    const float ox = _offset[0], oy = _offset[1], ow = _offset[2];
+    const float* col = &_col[0];
+    std::atomic<uint16_t>* zbuf = _zbuf;
+    // a box of n x n output pixels around the projection, n is fixed so the
+    // loops below do not mispredict; half moves the projection to its first
+    // pixel
+    const int n = _splat ? _splatSize : 1;
+    const float half = 1.f - 0.5f * n;
+
+    float bx[kChunk], by[kChunk], bw[kChunk];
+    for(int v = rowBegin; v < rowEnd; v++){
+        const uint16_t* d = depth + (size_t)v * stride;
+        const float* row = &_row[v * 3];
+        for(int begin = 0; begin < width; begin += kChunk){
+            const int count = width - begin < kChunk ? width - begin : kChunk;
+
+            // branch free so it vectorizes, pixels without depth are
+            // dropped below
+            for(int i = 0; i < count; i++){
+                const float z = d[begin + i];
+                const float* cu = col + (begin + i) * 3;
+                float w = z * (cu[2] + row[2]) + ow;
+                float inv = 1.f / w;
+                bx[i] = (z * (cu[0] + row[0]) + ox) * inv + half;
+                by[i] = (z * (cu[1] + row[1]) + oy) * inv + half;
+                bw[i] = w;
+            }
+
+            for(int i = 0; i < count; i++){
+                const float w = bw[i];
+                const float fx = bx[i];
+                const float fy = by[i];
+                if(!d[begin + i] || w < 1.f
+                        || !(fx > -n && fx < outW && fy > -n && fy < outH)){
+                    continue;
+                }
+                int x0 = (int)(fx + n) - n;
+                int y0 = (int)(fy + n) - n;
+                int x1 = x0 + n < outWidth ? x0 + n : outWidth;
+                int y1 = y0 + n < outHeight ? y0 + n : outHeight;
+                if(x0 < 0){ x0 = 0; }
+                if(y0 < 0){ y0 = 0; }
+
+                uint16_t zc = w < (float)(kEmpty - 1) ? (uint16_t)(w + 0.5f) : (uint16_t)(kEmpty - 1);
+                for(int y = y0; y < y1; y++){
+                    std::atomic<uint16_t>* cell = zbuf + (size_t)y * outWidth;
+                    for(int x = x0; x < x1; x++){
+                        uint16_t cur = cell[x].load(std::memory_order_relaxed);
+                        if(Shared){
+                            while(zc < cur && !cell[x].compare_exchange_weak(cur, zc
+                                        , std::memory_order_relaxed)){
+                            }
+                        } else if(zc < cur){
+                            cell[x].store(zc, std::memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+
+void DepthRegistration::resolveRows(uint16_t* out, int stride, int rowBegin, int rowEnd)
+{
+    for(int y = rowBegin; y < rowEnd; y++){
+        std::atomic<uint16_t>* cell = _zbuf + (size_t)y * _outWidth;
+        uint16_t* o = out + (size_t)y * stride;
+        for(int x = 0; x < _outWidth; x++){
+            uint16_t z = cell[x].load(std::memory_order_relaxed);
+            o[x] = z == kEmpty ? 0 : z;
+            cell[x].store(kEmpty, std::memory_order_relaxed);
+        }
+    }
+}
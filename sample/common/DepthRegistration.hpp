@@ -0,0 +1,111 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_DEPTH_REGISTRATION_HPP_
+#define PERCIPIO_SAMPLE_COMMON_DEPTH_REGISTRATION_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include "TY_API.h"
+#include "ThreadPool.hpp"
+
+/// Host side TYRegisterWorldToColor2 straight from DEPTH16.
+///
+/// Every depth pixel is moved into the color camera and projected onto an
+/// output image of any size with the undistorted color intrinsic, the
+/// value written is its depth seen from the color camera. Where several
+/// pixels land on the same output pixel the nearest one wins, so
+/// foreground edges occlude the background behind them whatever order the
+/// rows are done in. With splatting each pixel covers the square of output
+/// pixels its footprint spans instead of a single one, which closes the
+/// holes an output finer than the depth image would otherwise have.
+/// Output pixels nothing lands on are 0.
+///
+/// Row bands run on the thread pool if one is set; they share the z-buffer
+/// through an atomic min.
+class DepthRegistration
+{
+public:
+    struct Calibration {
+        TY_CAMERA_INTRINSIC depth;
+        TY_CAMERA_INTRINSIC color;          ///< at colorWidth x colorHeight of setup()
+        TY_CAMERA_EXTRINSIC depthToColor;   ///< depth camera points to color camera points
+    };
+
+    /// Read depth and color intrinsics and the extrinsic between them
+    static TY_STATUS getCalibration(TY_DEV_HANDLE hDevice, Calibration& calib);
+
+    DepthRegistration();
+    ~DepthRegistration();
+
+    void setThreadPool(ThreadPool* pool) { _pool = pool; }
+    /// on by default
+    void setSplat(bool on) { _splat = on; }
+
+    /// Build the projection tables for depth images of depthWidth x
+    /// depthHeight registered to outWidth x outHeight, nothing to do if
+    /// nothing changed. false on a singular intrinsic.
+    bool setup(const Calibration& calib, int depthWidth, int depthHeight
+            , int colorWidth, int colorHeight, int outWidth, int outHeight);
+
+    bool valid() const { return _outWidth > 0; }
+    int outWidth() const { return _outWidth; }
+    int outHeight() const { return _outHeight; }
+
+    /// depthStride and outStride are in pixels
+    void run(const uint16_t* depth, int depthStride, uint16_t* out, int outStride);
+
+private:
+    DepthRegistration(const DepthRegistration&);
+    DepthRegistration& operator=(const DepthRegistration&);
+
+    /// below this many rows per band threading does not pay off
+    enum { kMinBandRows = 16 };
+    /// z-buffer value of an empty pixel
+    enum { kEmpty = 0xffff };
+    /// pixels projected at once before they are written
+    enum { kChunk = 128 };
+
+    struct ProjectTask : public ParallelTask {
+        DepthRegistration*  self;
+        const uint16_t*     depth;
+        int                 stride;
+        int                 bands;
+        virtual void run(int index);
+    };
+
+    struct ResolveTask : public ParallelTask {
+        DepthRegistration*  self;
+        uint16_t*           out;
+        int                 stride;
+        int                 bands;
+        virtual void run(int index);
+    };
+
+    template <bool Shared>
+    void projectRows(const uint16_t* depth, int stride, int rowBegin, int rowEnd);
+    void resolveRows(uint16_t* out, int stride, int rowBegin, int rowEnd);
+    int bandCount(int rows) const;
+    void runBands(int bands, ParallelTask& task);
+
+    Calibration             _calib;
+    int                     _depthWidth;
+    int                     _depthHeight;
+    int                     _colorWidth;
+    int                     _colorHeight;
+    int                     _outWidth;
+    int                     _outHeight;
+    bool                    _splat;
+    ThreadPool*             _pool;
+
+    // output pixel homogeneous coordinates of a point at depth z of pixel
+    // (u, v) are z * (_col[u] + _row[v]) + _offset
+    std::vector<float>      _col;       ///< 3 per column
+    std::vector<float>      _row;       ///< 3 per row
+    float                   _offset[3];
+    int                     _splatSize; ///< output pixels one depth pixel covers across
+
+    std::atomic<uint16_t>*  _zbuf;
+    size_t                  _zbufSize;
+};
+
+
+#endif
@@ -2,8 +2,21 @@
 #define PERCIPIO_SAMPLE_COMMON_DEPTH_RENDER_HPP_
 
 #include <opencv2/opencv.hpp>
-#include <map>
+#include <string.h>
 #include <vector>
+#include "DepthHistogram.hpp"
+#include "ThreadPool.hpp"
+
+#if defined(__AVX2__)
+#  include <immintrin.h>
+#  define DEPTH_RENDER_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DEPTH_RENDER_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define DEPTH_RENDER_NEON
+#endif
 
 class DepthRender {
 public:
@@ -24,6 +37,10 @@ public:
                   , min_distance(0)
                   , max_distance(0)
                   , invalid_label(0)
+                  , hist_step(1)
+                  , range_tolerance(0.f)
+                  , range_max_hold(0)
+                  , _pool(NULL)
                   {}
 
     void SetColorType( OutputColorType ct = COLORTYPE_BLUERED ){
@@ -42,180 +59,457 @@ public:
 
     /// for abs mode
     void SetColorRange(int minDis, int maxDis){
-                min_distance = minDis;
-                max_distance = maxDis;
+                if(min_distance != minDis || max_distance != maxDis){
+                    needResetColorTable = true;
+                    min_distance = minDis;
+                    max_distance = maxDis;
+                }
             }
 
-    /// input 16UC1 output 8UC3
-    void    Compute(const cv::Mat &src, cv::Mat& dst ){
-                dst = Compute(src);
+    /// for dynamic mode, estimate range on every Nth row/column only
+    void SetHistSubsample(int step){
+                hist_step = step > 1 ? step : 1;
+            }
+
+    /// for dynamic mode, keep the range until the scene changes by more than
+    /// tolerance (relative), see DepthRangeTracker
+    void SetRangeHysteresis(float tolerance, int maxHoldFrames = 30){
+                range_tolerance = tolerance;
+                range_max_hold = maxHoldFrames;
+            }
+
+    /// Split frames into row bands rendered on pool, NULL renders on the
+    /// calling thread. The pool is not owned and may be shared.
+    void SetThreadPool(ThreadPool* pool){
+                _pool = pool;
             }
-    cv::Mat Compute(const cv::Mat &src){
-                cv::Mat src16U;
-                if(src.type() != CV_16U){
-                    src.convertTo(src16U, CV_16U);
-                }else{
-                    src16U = src;
-                }
 
+    /// percentiles of the last dynamic range estimate of Compute
+    const DepthHistogram& Histogram() const { return _scratch.range.Histogram(); }
+
+    /// Per call state of Render, give each rendering thread its own.
+    struct Scratch {
+        cv::Mat                     src16U;
+        DepthRangeTracker           range;
+        std::vector<DepthHistogram> bands;
+    };
+
+    /// Build color tables after settings changed, Render needs them.
+    void Prepare(){
                 if(needResetColorTable){
                     BuildColorTable();
+                    if(COLOR_RANGE_ABS == range_mode) {
+                        BuildDepthLUT();
+                    }
                     needResetColorTable = false;
                 }
+            }
 
-                cv::Mat dst;
-                filtered_mask = (src16U == invalid_label);
-                clr_disp = src16U.clone();
-                if(COLOR_RANGE_ABS == range_mode) {
-                    TruncValue(clr_disp, filtered_mask, min_distance, max_distance);
-                    clr_disp -= min_distance;
-                    clr_disp = clr_disp * 255 / (max_distance - min_distance);
-                    clr_disp.convertTo(clr_disp, CV_8UC1);
-                } else {
-                    short vmax, vmin;
-                    HistAdjustRange(clr_disp, invalid_label, min_distance, vmin, vmax);
-                    clr_disp = (clr_disp - vmin) * 255 / (vmax - vmin);
-                    //clr_disp = 255 - clr_disp;
-                    clr_disp.convertTo(clr_disp, CV_8UC1);
+    /// Reentrant render: only reads renderer state, so one prepared
+    /// instance can serve several threads, each with its own scratch.
+    /// input 16UC1 output 8UC3
+    void Render(const cv::Mat &src, cv::Mat &dst, Scratch &scratch) const {
+                assert(!needResetColorTable);
+                const cv::Mat* src16U = &src;
+                if(src.type() != CV_16U){
+                    src.convertTo(scratch.src16U, CV_16U);
+                    src16U = &scratch.src16U;
                 }
+                dst.create(src16U->size(), CV_8UC3);
 
-                switch (color_type) {
-                case COLORTYPE_GRAY:
-                    clr_disp = 255 - clr_disp;
-                    cv::cvtColor(clr_disp, dst, CV_GRAY2BGR);
-                    break;
-                case COLORTYPE_BLUERED:
-                    //temp = 255 - clr_disp;
-                    CalcColorMap(clr_disp, dst);
-                    //cv::applyColorMap(temp, color_img, cv::COLORMAP_COOL);
-                    break;
-                case COLORTYPE_RAINBOW:
-                    //cv::cvtColor(color_img, color_img, CV_GRAY2BGR);
-                    cv::applyColorMap(clr_disp, dst, cv::COLORMAP_RAINBOW);
-                    break;
+                BandTask task;
+                task.src = src16U;
+                task.dst = &dst;
+                task.bands = BandCount(src16U->rows);
+                if(COLOR_RANGE_ABS == range_mode) {
+                    // mapping is fixed, one lookup per pixel
+                    task.lut = &_depth_lut[0];
+                } else {
+                    int vmax, vmin;
+                    HistAdjustRange(*src16U, scratch, task.bands, vmin, vmax);
+                    task.lut = NULL;
+                    task.params.invalid = invalid_label;
+                    task.params.clip = false;
+                    task.params.table = &_color_lookup_table[0];
+                    SetKernelRange(task.params, vmin, vmax);
                 }
-                ClearInvalidArea(dst, filtered_mask);
+                RunBands(task);
+            }
 
+    /// input 16UC1 output 8UC3
+    /// dst is reused when it already has the right size and type, so after
+    /// the first frame of a resolution this does not allocate
+    void    Compute(const cv::Mat &src, cv::Mat& dst ){
+                Prepare();
+                Render(src, dst, _scratch);
+            }
+    cv::Mat Compute(const cv::Mat &src){
+                Prepare();
+                cv::Mat dst;
+                Render(src, dst, _scratch);
                 return dst;
             }
 
 private:
-    void CalcColorMap(const cv::Mat &src, cv::Mat &dst){
-                std::vector<cv::Scalar> &table = _color_lookup_table;
-                assert(table.size() == 256);
-                assert(!src.empty());
-                assert(src.type() == CV_8UC1);
-                dst.create(src.size(), CV_8UC3);
-                const unsigned char* sptr = src.ptr<unsigned char>();
-                unsigned char* dptr = dst.ptr<unsigned char>();
-                for (int i = src.size().area(); i != 0; i--) {
-                    cv::Scalar &v = table[*sptr];
-                    dptr[0] = (unsigned char)v.val[0];
-                    dptr[1] = (unsigned char)v.val[1];
-                    dptr[2] = (unsigned char)v.val[2];
-                    dptr += 3;
-                    sptr += 1;
+    /// Entry kTableSize - 1 of the color table is black, every pixel that is
+    /// invalid (or clipped in abs mode) is routed to it.
+    enum { kTableSize = 257, kBlankIndex = 256 };
+
+    struct KernelParams {
+        uint16_t        invalid;
+        bool            clip;
+        uint16_t        lo;
+        uint16_t        hi;
+        float           scale;
+        const uint32_t* table;
+    };
+
+    /// below this many rows per band threading does not pay off
+    enum { kMinBandRows = 32 };
+
+    struct BandTask : public ParallelTask {
+        const cv::Mat*  src;
+        cv::Mat*        dst;
+        int             bands;
+        const uint32_t* lut;
+        KernelParams    params;
+
+        virtual void run(int index){
+                    int begin, end;
+                    BandRows(src->rows, bands, index, begin, end);
+                    for(int r = begin; r < end; r++){
+                        if(lut){
+                            LookupRow(src->ptr<uint16_t>(r), dst->ptr<unsigned char>(r)
+                                    , src->cols, lut);
+                        } else {
+                            ColorizeRow(src->ptr<uint16_t>(r), dst->ptr<unsigned char>(r)
+                                    , src->cols, params);
+                        }
+                    }
                 }
+    };
+
+    struct HistTask : public ParallelTask {
+        const cv::Mat*  src;
+        DepthHistogram* hists;
+        int             bands;
+
+        virtual void run(int index){
+                    int begin, end;
+                    BandRows(src->rows, bands, index, begin, end);
+                    hists[index].Reset();
+                    hists[index].AddRows(*src, begin, end);
+                }
+    };
+
+    static void BandRows(int rows, int bands, int index, int& begin, int& end){
+                begin = (int)((int64_t)rows * index / bands);
+                end = (int)((int64_t)rows * (index + 1) / bands);
             }
-    void BuildColorTable(){
-                _color_lookup_table.resize(256);
-                cv::Scalar from(50, 0, 0xff), to(50, 200, 255);
-                for (int i = 0; i < 128; i++) {
-                    float a = (float)i / 128;
-                    cv::Scalar &v = _color_lookup_table[i];
-                    for (int j = 0; j < 3; j++) {
-                        v.val[j] = from.val[j] * (1 - a) + to.val[j] * a;
+
+    int BandCount(int rows) const {
+                if(!_pool){
+                    return 1;
+                }
+                int bands = rows / kMinBandRows;
+                if(bands > _pool->size()){
+                    bands = _pool->size();
+                }
+                return bands > 1 ? bands : 1;
+            }
+
+    void RunBands(BandTask& task) const {
+                if(task.bands > 1){
+                    _pool->parallelFor(task.bands, task);
+                } else {
+                    task.run(0);
+                }
+            }
+
+    static uint32_t PackBGR(unsigned char b, unsigned char g, unsigned char r){
+                unsigned char bgr[4] = {b, g, r, 0};
+                uint32_t v;
+                memcpy(&v, bgr, 4);
+                return v;
+            }
+
+    static void SetKernelRange(KernelParams& p, int lo, int hi){
+                if(lo < 0){ lo = 0; }
+                if(hi > 0xffff){ hi = 0xffff; }
+                if(hi < lo){ hi = lo; }
+                p.lo = (uint16_t)lo;
+                p.hi = (uint16_t)hi;
+                p.scale = hi > lo ? 255.0f / (hi - lo) : 0.0f;
+            }
+
+    /// Scalar reference for the per-pixel index, the SIMD paths below must
+    /// produce exactly the same value (round to nearest even).
+    static int ColorIndex(uint16_t v, const KernelParams& p){
+                if(v == p.invalid){
+                    return kBlankIndex;
+                }
+                if(v < p.lo){
+                    if(p.clip){ return kBlankIndex; }
+                    v = p.lo;
+                } else if(v > p.hi){
+                    if(p.clip){ return kBlankIndex; }
+                    v = p.hi;
+                }
+                int idx = cvRound((float)(v - p.lo) * p.scale);
+                return idx > 255 ? 255 : idx;
+            }
+
+    /// Compute color table indices of one chunk of 8/16 pixels, returns
+    /// number of pixels processed.
+    static int ColorIndexSIMD(const uint16_t* src, int n, const KernelParams& p
+            , uint16_t* idx){
+#if defined(DEPTH_RENDER_AVX2)
+                int i = 0;
+                const __m256i inv   = _mm256_set1_epi16((short)p.invalid);
+                const __m256i lo    = _mm256_set1_epi16((short)p.lo);
+                const __m256i hi    = _mm256_set1_epi16((short)p.hi);
+                const __m256i range = _mm256_set1_epi16((short)(p.hi - p.lo));
+                const __m256i zero  = _mm256_setzero_si256();
+                const __m256i c255  = _mm256_set1_epi16(255);
+                const __m256i blank = _mm256_set1_epi16(kBlankIndex);
+                const __m256  scale = _mm256_set1_ps(p.scale);
+                for(; i + 16 <= n; i += 16){
+                    __m256i v = _mm256_loadu_si256((const __m256i*)(src + i));
+                    __m256i mask = _mm256_cmpeq_epi16(v, inv);
+                    if(p.clip){
+                        __m256i below = _mm256_subs_epu16(lo, v);
+                        __m256i above = _mm256_subs_epu16(v, hi);
+                        __m256i in = _mm256_cmpeq_epi16(_mm256_or_si256(below, above), zero);
+                        mask = _mm256_or_si256(mask, _mm256_andnot_si256(in, _mm256_cmpeq_epi16(zero, zero)));
+                    }
+                    // clamp(v, lo, hi) - lo
+                    __m256i t = _mm256_subs_epu16(v, lo);
+                    t = _mm256_sub_epi16(t, _mm256_subs_epu16(t, range));
+                    __m256 f0 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(t)));
+                    __m256 f1 = _mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(t, 1)));
+                    __m256i i0 = _mm256_cvtps_epi32(_mm256_mul_ps(f0, scale));
+                    __m256i i1 = _mm256_cvtps_epi32(_mm256_mul_ps(f1, scale));
+                    __m256i r = _mm256_permute4x64_epi64(_mm256_packs_epi32(i0, i1), 0xD8);
+                    r = _mm256_min_epi16(r, c255);
+                    r = _mm256_or_si256(_mm256_andnot_si256(mask, r), _mm256_and_si256(mask, blank));
+                    _mm256_storeu_si256((__m256i*)(idx + i), r);
+                }
+                return i;
+#elif defined(DEPTH_RENDER_SSE2)
+                int i = 0;
+                const __m128i inv   = _mm_set1_epi16((short)p.invalid);
+                const __m128i lo    = _mm_set1_epi16((short)p.lo);
+                const __m128i hi    = _mm_set1_epi16((short)p.hi);
+                const __m128i range = _mm_set1_epi16((short)(p.hi - p.lo));
+                const __m128i zero  = _mm_setzero_si128();
+                const __m128i c255  = _mm_set1_epi16(255);
+                const __m128i blank = _mm_set1_epi16(kBlankIndex);
+                const __m128  scale = _mm_set1_ps(p.scale);
+                for(; i + 8 <= n; i += 8){
+                    __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+                    __m128i mask = _mm_cmpeq_epi16(v, inv);
+                    if(p.clip){
+                        __m128i below = _mm_subs_epu16(lo, v);
+                        __m128i above = _mm_subs_epu16(v, hi);
+                        __m128i in = _mm_cmpeq_epi16(_mm_or_si128(below, above), zero);
+                        mask = _mm_or_si128(mask, _mm_andnot_si128(in, _mm_cmpeq_epi16(zero, zero)));
                     }
+                    __m128i t = _mm_subs_epu16(v, lo);
+                    t = _mm_sub_epi16(t, _mm_subs_epu16(t, range));
+                    __m128 f0 = _mm_cvtepi32_ps(_mm_unpacklo_epi16(t, zero));
+                    __m128 f1 = _mm_cvtepi32_ps(_mm_unpackhi_epi16(t, zero));
+                    __m128i i0 = _mm_cvtps_epi32(_mm_mul_ps(f0, scale));
+                    __m128i i1 = _mm_cvtps_epi32(_mm_mul_ps(f1, scale));
+                    __m128i r = _mm_min_epi16(_mm_packs_epi32(i0, i1), c255);
+                    r = _mm_or_si128(_mm_andnot_si128(mask, r), _mm_and_si128(mask, blank));
+                    _mm_storeu_si128((__m128i*)(idx + i), r);
                 }
-                from = to;
-                to = cv::Scalar(255, 104, 0);
-                for (int i = 128; i < 256; i++) {
-                    float a = (float)(i - 128) / 128;
-                    cv::Scalar &v = _color_lookup_table[i];
-                    for (int j = 0; j < 3; j++) {
-                        v.val[j] = from.val[j] * (1 - a) + to.val[j] * a;
+                return i;
+#elif defined(DEPTH_RENDER_NEON)
+                int i = 0;
+                const uint16x8_t inv   = vdupq_n_u16(p.invalid);
+                const uint16x8_t lo    = vdupq_n_u16(p.lo);
+                const uint16x8_t hi    = vdupq_n_u16(p.hi);
+                const uint16x8_t c255  = vdupq_n_u16(255);
+                const uint16x8_t blank = vdupq_n_u16(kBlankIndex);
+                const float32x4_t scale = vdupq_n_f32(p.scale);
+                for(; i + 8 <= n; i += 8){
+                    uint16x8_t v = vld1q_u16(src + i);
+                    uint16x8_t mask = vceqq_u16(v, inv);
+                    if(p.clip){
+                        mask = vorrq_u16(mask, vorrq_u16(vcltq_u16(v, lo), vcgtq_u16(v, hi)));
                     }
+                    uint16x8_t t = vsubq_u16(vminq_u16(vmaxq_u16(v, lo), hi), lo);
+                    float32x4_t f0 = vcvtq_f32_u32(vmovl_u16(vget_low_u16(t)));
+                    float32x4_t f1 = vcvtq_f32_u32(vmovl_u16(vget_high_u16(t)));
+                    uint32x4_t i0 = vcvtnq_u32_f32(vmulq_f32(f0, scale));
+                    uint32x4_t i1 = vcvtnq_u32_f32(vmulq_f32(f1, scale));
+                    uint16x8_t r = vminq_u16(vcombine_u16(vqmovn_u32(i0), vqmovn_u32(i1)), c255);
+                    vst1q_u16(idx + i, vbslq_u16(mask, blank, r));
                 }
+                return i;
+#else
+                (void)src; (void)n; (void)p; (void)idx;
+                return 0;
+#endif
             }
-    //keep value in range
-    void TruncValue(cv::Mat &img, cv::Mat &mask, short min_val, short max_val){
-                assert(max_val >= min_val);
-                assert(img.type() == CV_16SC1);
-                assert(mask.type() == CV_8UC1);
-                short* ptr = img.ptr<short>();
-                unsigned char* mask_ptr = mask.ptr<unsigned char>();
-                for (int i = img.size().area(); i != 0; i--) {
-                  if (*ptr > max_val) {
-                    *ptr = max_val;
-                    *mask_ptr = 0xff;
-                  } else if (*ptr < min_val) {
-                    *ptr = min_val;
-                    *mask_ptr = 0xff;
-                  }
-                  ptr++;
-                  mask_ptr++;
-                }
-            }
-    void ClearInvalidArea(cv::Mat &clr_disp, cv::Mat &filtered_mask){
-                assert(clr_disp.type() == CV_8UC3);
-                assert(filtered_mask.type() == CV_8UC1);
-                assert(clr_disp.size().area() == filtered_mask.size().area());
-                unsigned char* filter_ptr = filtered_mask.ptr<unsigned char>();
-                unsigned char* ptr = clr_disp.ptr<unsigned char>();
-                int len = clr_disp.size().area();
-                for (int i = 0; i < len; i++) {
-                    if (*filter_ptr != 0) {
-                      ptr[0] = ptr[1] = ptr[2] = 0;
+
+    /// Fused kernel: read DEPTH16 once, write BGR once. Invalid pixel
+    /// blanking and range scaling are folded into the color index.
+    static void ColorizeRow(const uint16_t* src, unsigned char* dst, int n
+            , const KernelParams& p){
+                enum { kChunk = 64 };
+                uint16_t idx[kChunk];
+                const uint32_t* table = p.table;
+                for(int base = 0; base < n; base += kChunk){
+                    int len = n - base < kChunk ? n - base : kChunk;
+                    int i = ColorIndexSIMD(src + base, len, p, idx);
+                    for(; i < len; i++){
+                        idx[i] = (uint16_t)ColorIndex(src[base + i], p);
                     }
-                    filter_ptr++;
-                    ptr += 3;
-                }
-            }
-    void HistAdjustRange(const cv::Mat &dist, short invalid, int min_display_distance_range
-            , short &min_val, short &max_val) {
-                std::map<short, int> hist;
-                int sz = dist.size().area();
-                const short* ptr = dist.ptr < short>();
-                int total_num = 0;
-                for (int idx = sz; idx != 0; idx--, ptr++) {
-                    if (invalid == *ptr) {
-                        continue;
+                    // 4 byte stores overlap the next pixel, which is rewritten
+                    // right after; the last pixel of the row is stored exactly
+                    unsigned char* d = dst + base * 3;
+                    int last = base + len == n ? len - 1 : len;
+                    for(i = 0; i < last; i++, d += 3){
+                        memcpy(d, &table[idx[i]], 4);
                     }
-                    total_num++;
-                    if (hist.find(*ptr) != hist.end()) {
-                        hist[*ptr]++;
-                    } else {
-                        hist.insert(std::make_pair(*ptr, 1));
+                    if(last != len){
+                        memcpy(d, &table[idx[last]], 3);
                     }
                 }
-                if (hist.empty()) {
-                    min_val = 0;
-                    max_val = 2000;
+            }
+
+    /// Gather kernel for abs mode, see BuildDepthLUT.
+    static void LookupRow(const uint16_t* src, unsigned char* dst, int n
+            , const uint32_t* lut){
+                if(n <= 0){
                     return;
                 }
-                const int delta = total_num * 0.01;
-                int sum = 0;
-                min_val = hist.begin()->first;
-                for (std::map<short, int>::iterator it = hist.begin(); it != hist.end();it++){
-                    sum += it->second;
-                    if (sum > delta) {
-                        min_val = it->first;
-                        break;
+                int i = 0;
+                for(; i + 4 < n; i += 4, dst += 12){
+                    memcpy(dst + 0, &lut[src[i + 0]], 4);
+                    memcpy(dst + 3, &lut[src[i + 1]], 4);
+                    memcpy(dst + 6, &lut[src[i + 2]], 4);
+                    memcpy(dst + 9, &lut[src[i + 3]], 4);
+                }
+                for(; i < n - 1; i++, dst += 3){
+                    memcpy(dst, &lut[src[i]], 4);
+                }
+                memcpy(dst, &lut[src[n - 1]], 3);
+            }
+
+    /// In abs mode the color of a raw depth value only depends on settings,
+    /// so bake the whole mapping, including invalid and out of range
+    /// blanking, into a 65536 entry table.
+    void BuildDepthLUT(){
+                KernelParams p;
+                p.invalid = invalid_label;
+                p.clip = true;
+                p.table = &_color_lookup_table[0];
+                SetKernelRange(p, min_distance, max_distance);
+                _depth_lut.resize(65536);
+                for(int v = 0; v < 65536; v++){
+                    _depth_lut[v] = p.table[ColorIndex((uint16_t)v, p)];
+                }
+            }
+
+    void BuildColorTable(){
+                _color_lookup_table.resize(kTableSize);
+                switch (color_type) {
+                case COLORTYPE_GRAY:
+                    for (int i = 0; i < 256; i++) {
+                        unsigned char v = (unsigned char)(255 - i);
+                        _color_lookup_table[i] = PackBGR(v, v, v);
+                    }
+                    break;
+                case COLORTYPE_RAINBOW: {
+                    // sample opencv's colormap once, so output stays identical
+                    // to cv::applyColorMap
+                    cv::Mat ramp(1, 256, CV_8UC1), clr;
+                    for (int i = 0; i < 256; i++) {
+                        ramp.at<unsigned char>(0, i) = (unsigned char)i;
+                    }
+                    cv::applyColorMap(ramp, clr, cv::COLORMAP_RAINBOW);
+                    for (int i = 0; i < 256; i++) {
+                        const unsigned char* c = clr.ptr<unsigned char>() + i * 3;
+                        _color_lookup_table[i] = PackBGR(c[0], c[1], c[2]);
+                    }
+                    break;
+                }
+                case COLORTYPE_BLUERED:
+                default: {
+                    cv::Scalar from(50, 0, 0xff), to(50, 200, 255);
+                    for (int i = 0; i < 128; i++) {
+                        float a = (float)i / 128;
+                        unsigned char v[3];
+                        for (int j = 0; j < 3; j++) {
+                            v[j] = (unsigned char)(from.val[j] * (1 - a) + to.val[j] * a);
+                        }
+                        _color_lookup_table[i] = PackBGR(v[0], v[1], v[2]);
                     }
+                    from = to;
+                    to = cv::Scalar(255, 104, 0);
+                    for (int i = 128; i < 256; i++) {
+                        float a = (float)(i - 128) / 128;
+                        unsigned char v[3];
+                        for (int j = 0; j < 3; j++) {
+                            v[j] = (unsigned char)(from.val[j] * (1 - a) + to.val[j] * a);
+                        }
+                        _color_lookup_table[i] = PackBGR(v[0], v[1], v[2]);
+                    }
+                    break;
+                }
+                }
+                _color_lookup_table[kBlankIndex] = PackBGR(0, 0, 0);
+            }
+    /// Range statistics are reduced across bands first: every band fills
+    /// its own histogram, the merged one gives the percentiles.
+    void HistAdjustRange(const cv::Mat &dist, Scratch &scratch, int bands
+            , int &min_val, int &max_val) const {
+                DepthRangeTracker& range = scratch.range;
+                DepthHistogram& hist = range.Histogram();
+                range.SetHysteresis(range_tolerance, range_max_hold);
+                if (hist.RowStep() != hist_step) {
+                    hist.SetSubsample(hist_step, hist_step);
+                    range.Invalidate();
                 }
 
-                sum = 0;
-                max_val = hist.rbegin()->first;
-                for (std::map<short, int>::reverse_iterator s = hist.rbegin()
-                        ; s != hist.rend(); s++) {
-                    sum += s->second;
-                    if (sum > delta) {
-                        max_val = s->first;
-                        break;
+                if (range.Check(dist, invalid_label)) {
+                    hist.SetInvalidLabel(invalid_label);
+                    hist.Reset();
+                    if (bands > 1) {
+                        if ((int)scratch.bands.size() < bands) {
+                            scratch.bands.resize(bands);
+                        }
+                        for (int i = 0; i < bands; i++) {
+                            scratch.bands[i].SetSubsample(hist_step, hist_step);
+                            scratch.bands[i].SetInvalidLabel(invalid_label);
+                        }
+                        HistTask task;
+                        task.src = &dist;
+                        task.hists = &scratch.bands[0];
+                        task.bands = bands;
+                        _pool->parallelFor(bands, task);
+                        for (int i = 0; i < bands; i++) {
+                            hist.Merge(scratch.bands[i]);
+                        }
+                    } else {
+                        hist.Add(dist);
                     }
+                    range.Estimate(0.01);
+                }
+
+                uint16_t lo, hi;
+                if (!range.Current(lo, hi)) {
+                    min_val = 0;
+                    max_val = 2000;
+                    return;
                 }
+                min_val = lo;
+                max_val = hi;
 
-                const int min_display_dist = min_display_distance_range;
+                const int min_display_dist = min_distance;
                 if (max_val - min_val < min_display_dist) {
                     int m = (max_val + min_val) / 2;
                     max_val = m + min_display_dist / 2;
@@ -232,9 +526,13 @@ private:
     int             min_distance;
     int             max_distance;
     uint16_t        invalid_label;
-    cv::Mat         clr_disp ;
-    cv::Mat         filtered_mask;
-    std::vector<cv::Scalar> _color_lookup_table;
+    int             hist_step;
+    float           range_tolerance;
+    int             range_max_hold;
+    std::vector<uint32_t> _color_lookup_table;
+    std::vector<uint32_t> _depth_lut;
+    ThreadPool*     _pool;
+    Scratch         _scratch;
 };
 
 #endif
@@ -0,0 +1,218 @@
+#include "DepthToWorld.hpp"
+#include "ReplayDispatch.hpp"
+#include <string.h>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define DEPTH_TO_WORLD_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define DEPTH_TO_WORLD_NEON
+#endif
+
+
+DepthToWorld::DepthToWorld()
+    : _width(0)
+    , _height(0)
+{
+    memset(&_intrinsic, 0, sizeof(_intrinsic));
+}
+
+
+bool DepthToWorld::setup(const TY_CAMERA_INTRINSIC& intrinsic, int width, int height)
+{
+    if(width == _width && height == _height && width > 0
+            && memcmp(&intrinsic, &_intrinsic, sizeof(intrinsic)) == 0){
+        return true;
+    }
+    const float fx = intrinsic.data[0];
+    const float cx = intrinsic.data[2];
+    const float fy = intrinsic.data[4];
+    const float cy = intrinsic.data[5];
+    _width = 0;
+    _height = 0;
+    if(width <= 0 || height <= 0 || fx == 0.f || fy == 0.f){
+        return false;
+    }
+
+    // the vector loops may read the table up to the next multiple of 8
+    _rayX.assign((width + 7) & ~7, 0.f);
+    for(int u = 0; u < width; u++){
+        _rayX[u] = (u - cx) / fx;
+    }
+    _rayY.resize(height);
+    for(int v = 0; v < height; v++){
+        _rayY[v] = (v - cy) / fy;
+    }
+    _intrinsic = intrinsic;
+    _width = width;
+    _height = height;
+    return true;
+}
+
+
+TY_STATUS DepthToWorld::setup(TY_DEV_HANDLE hDevice, int width, int height)
+{
+    TY_CAMERA_INTRINSIC intrinsic;
+    TY_STATUS err = TYGetStruct(hDevice, TY_COMPONENT_DEPTH_CAM, TY_STRUCT_CAM_INTRINSIC
+            , &intrinsic, sizeof(intrinsic));
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+    return setup(intrinsic, width, height) ? TY_STATUS_OK : TY_STATUS_INVALID_PARAMETER;
+}
+
+
+#if defined(DEPTH_TO_WORLD_SSE2)
+
+// x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+static inline void storeXYZ(float* out, __m128 x, __m128 y, __m128 z)
+{
+    __m128 xy0 = _mm_unpacklo_ps(x, y);     // x0 y0 x1 y1
+    __m128 xy1 = _mm_unpackhi_ps(x, y);     // x2 y2 x3 y3
+    __m128 a = _mm_shuffle_ps(z, xy0, _MM_SHUFFLE(2, 2, 0, 0));
+    __m128 b = _mm_shuffle_ps(xy0, z, _MM_SHUFFLE(1, 1, 3, 3));
+    __m128 c = _mm_shuffle_ps(z, xy1, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 d = _mm_shuffle_ps(xy1, z, _MM_SHUFFLE(3, 3, 3, 3));
+    _mm_storeu_ps(out, _mm_shuffle_ps(xy0, a, _MM_SHUFFLE(2, 0, 1, 0)));
+    _mm_storeu_ps(out + 4, _mm_shuffle_ps(b, xy1, _MM_SHUFFLE(1, 0, 2, 0)));
+    _mm_storeu_ps(out + 8, _mm_shuffle_ps(c, d, _MM_SHUFFLE(2, 0, 2, 0)));
+}
+
+// 4 depths to points, a zero depth sets all bits which is a NaN
+static inline void project4(__m128i depth, const float* rayX, __m128 rayY
+        , __m128& x, __m128& y, __m128& z)
+{
+    __m128 invalid = _mm_castsi128_ps(_mm_cmpeq_epi32(depth, _mm_setzero_si128()));
+    __m128 fz = _mm_cvtepi32_ps(depth);
+    x = _mm_or_ps(_mm_mul_ps(_mm_loadu_ps(rayX), fz), invalid);
+    y = _mm_or_ps(_mm_mul_ps(rayY, fz), invalid);
+    z = _mm_or_ps(fz, invalid);
+}
+
+#elif defined(DEPTH_TO_WORLD_NEON)
+
+static inline void project4(uint32x4_t depth, const float* rayX, float32x4_t rayY
+        , float32x4x3_t& p)
+{
+    uint32x4_t invalid = vceqq_u32(depth, vdupq_n_u32(0));
+    float32x4_t fz = vcvtq_f32_u32(depth);
+    p.val[0] = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(vmulq_f32(vld1q_f32(rayX), fz)), invalid));
+    p.val[1] = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(vmulq_f32(rayY, fz)), invalid));
+    p.val[2] = vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(fz), invalid));
+}
+
+#endif
+
+
+void DepthToWorld::convert(const uint16_t* depth, int depthStride, TY_VECT_3F* world, int worldStride
+        , int rowBegin, int rowEnd) const
+{
+    if(rowEnd < 0 || rowEnd > _height){
+        rowEnd = _height;
+    }
+    const size_t step = worldStride > 0 ? (size_t)worldStride : sizeof(TY_VECT_3F);
+    const bool packed = step == sizeof(TY_VECT_3F);
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float* rayX = _rayX.empty() ? NULL : &_rayX[0];
+
+    for(int v = rowBegin; v < rowEnd; v++){
+        const uint16_t* d = depth + (size_t)v * depthStride;
+        uint8_t* out = (uint8_t*)world + (size_t)v * _width * step;
+        const float ry = _rayY[v];
+        int u = 0;
+        if(packed){
+            float* p = (float*)out;
+#if defined(DEPTH_TO_WORLD_SSE2)
+            const __m128 vy = _mm_set1_ps(ry);
+            const __m128i zero = _mm_setzero_si128();
+            for(; u + 8 <= _width; u += 8, p += 24){
+                __m128i d8 = _mm_loadu_si128((const __m128i*)(d + u));
+                __m128 x, y, z;
+                project4(_mm_unpacklo_epi16(d8, zero), rayX + u, vy, x, y, z);
+                storeXYZ(p, x, y, z);
+                project4(_mm_unpackhi_epi16(d8, zero), rayX + u + 4, vy, x, y, z);
+                storeXYZ(p + 12, x, y, z);
+            }
+#elif defined(DEPTH_TO_WORLD_NEON)
+            const float32x4_t vy = vdupq_n_f32(ry);
+            for(; u + 8 <= _width; u += 8, p += 24){
+                uint16x8_t d8 = vld1q_u16(d + u);
+                float32x4x3_t pt;
+                project4(vmovl_u16(vget_low_u16(d8)), rayX + u, vy, pt);
+                vst3q_f32(p, pt);
+                project4(vmovl_u16(vget_high_u16(d8)), rayX + u + 4, vy, pt);
+                vst3q_f32(p + 12, pt);
+            }
+#endif
+            out = (uint8_t*)p;
+        }
+        for(; u < _width; u++, out += step){
+            TY_VECT_3F* w = (TY_VECT_3F*)out;
+            float z = d[u];
+            if(z > 0.f){
+                w->x = rayX[u] * z;
+                w->y = ry * z;
+                w->z = z;
+            } else {
+                w->x = w->y = w->z = nan;
+            }
+        }
+    }
+}
+
+
+void DepthToWorld::convertPlanar(const uint16_t* depth, int depthStride, float* x, float* y, float* z
+        , int rowBegin, int rowEnd) const
+{
+    if(rowEnd < 0 || rowEnd > _height){
+        rowEnd = _height;
+    }
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float* rayX = _rayX.empty() ? NULL : &_rayX[0];
+
+    for(int v = rowBegin; v < rowEnd; v++){
+        const uint16_t* d = depth + (size_t)v * depthStride;
+        const size_t row = (size_t)v * _width;
+        float* px = x ? x + row : NULL;
+        float* py = y ? y + row : NULL;
+        float* pz = z ? z + row : NULL;
+        const float ry = _rayY[v];
+        int u = 0;
+#if defined(DEPTH_TO_WORLD_SSE2)
+        const __m128 vy = _mm_set1_ps(ry);
+        const __m128i zero = _mm_setzero_si128();
+        for(; u + 8 <= _width; u += 8){
+            __m128i d8 = _mm_loadu_si128((const __m128i*)(d + u));
+            for(int h = 0; h < 2; h++){
+                __m128 vx, vyz, vz;
+                project4(h ? _mm_unpackhi_epi16(d8, zero) : _mm_unpacklo_epi16(d8, zero)
+                        , rayX + u + h * 4, vy, vx, vyz, vz);
+                if(px){ _mm_storeu_ps(px + u + h * 4, vx); }
+                if(py){ _mm_storeu_ps(py + u + h * 4, vyz); }
+                if(pz){ _mm_storeu_ps(pz + u + h * 4, vz); }
+            }
+        }
+#elif defined(DEPTH_TO_WORLD_NEON)
+        const float32x4_t vy = vdupq_n_f32(ry);
+        for(; u + 8 <= _width; u += 8){
+            uint16x8_t d8 = vld1q_u16(d + u);
+            for(int h = 0; h < 2; h++){
+                float32x4x3_t pt;
+                project4(vmovl_u16(h ? vget_high_u16(d8) : vget_low_u16(d8)), rayX + u + h * 4, vy, pt);
+                if(px){ vst1q_f32(px + u + h * 4, pt.val[0]); }
+                if(py){ vst1q_f32(py + u + h * 4, pt.val[1]); }
+                if(pz){ vst1q_f32(pz + u + h * 4, pt.val[2]); }
+            }
+        }
+#endif
+        for(; u < _width; u++){
+            float fz = d[u];
+            bool valid = fz > 0.f;
+            if(px){ px[u] = valid ? rayX[u] * fz : nan; }
+            if(py){ py[u] = valid ? ry * fz : nan; }
+            if(pz){ pz[u] = valid ? fz : nan; }
+        }
+    }
+}
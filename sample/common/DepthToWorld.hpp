@@ -0,0 +1,56 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_DEPTH_TO_WORLD_HPP_
+#define PERCIPIO_SAMPLE_COMMON_DEPTH_TO_WORLD_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "TY_API.h"
+
+/// Host side TYDepthToWorld on DEPTH16 images, without building the
+/// TY_VECT_3F input array.
+///
+/// Depth images are undistorted, so a pixel (u, v) of depth z is the point
+/// ((u - cx) / fx * z, (v - cy) / fy * z, z). The ray factors of every
+/// column and of every row are computed once per intrinsic and resolution
+/// and kept until either changes; per pixel there are only two multiplies
+/// left. Pixels without depth give NaN points, as skipped by
+/// PointCloudViewer. Points are in the unit of the depth image.
+///
+/// convert() is const and may be called from several threads on different
+/// rows once setup() is done.
+class DepthToWorld
+{
+public:
+    DepthToWorld();
+
+    /// Build the ray tables, nothing to do if intrinsic and size did not
+    /// change. false on a singular intrinsic.
+    bool setup(const TY_CAMERA_INTRINSIC& intrinsic, int width, int height);
+    /// setup() from TY_STRUCT_CAM_INTRINSIC of the depth camera of hDevice
+    TY_STATUS setup(TY_DEV_HANDLE hDevice, int width, int height);
+
+    bool valid() const { return _width > 0; }
+    int width() const { return _width; }
+    int height() const { return _height; }
+
+    /// Rows [rowBegin, rowEnd) to interleaved points. depthStride is in
+    /// pixels, worldStride in bytes between points, 0 means packed
+    /// TY_VECT_3F; row r starts at point r * width. Bytes between points
+    /// are left alone.
+    void convert(const uint16_t* depth, int depthStride, TY_VECT_3F* world, int worldStride = 0
+            , int rowBegin = 0, int rowEnd = -1) const;
+
+    /// Rows [rowBegin, rowEnd) to separate x, y and z planes of width
+    /// floats per row, any of them may be NULL.
+    void convertPlanar(const uint16_t* depth, int depthStride, float* x, float* y, float* z
+            , int rowBegin = 0, int rowEnd = -1) const;
+
+private:
+    TY_CAMERA_INTRINSIC     _intrinsic;
+    int                     _width;
+    int                     _height;
+    std::vector<float>      _rayX;      ///< (u - cx) / fx, padded to 4
+    std::vector<float>      _rayY;      ///< (v - cy) / fy
+};
+
+
+#endif
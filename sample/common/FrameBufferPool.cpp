@@ -0,0 +1,455 @@
+#include "FrameBufferPool.hpp"
+#include "ReplayDispatch.hpp"
+
+#ifdef _WIN32
+# include <windows.h>
+#else
+# include <sys/mman.h>
+# include <unistd.h>
+# if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#  define MAP_ANONYMOUS MAP_ANON
+# endif
+#endif
+
+
+static const size_t kHugePageSize = 2 * 1024 * 1024;
+
+static size_t roundUp(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+
+FrameBufferPool::FrameBufferPool()
+    : _device(NULL)
+    , _bufferSize(0)
+    , _flags(ALLOC_PAGE_ALIGNED)
+    , _maxBuffers(0)
+    , _inDevice(0)
+    , _hostPoint3D(false)
+    , _hostPointsDevice(NULL)
+{
+    resetStats();
+}
+
+
+FrameBufferPool::~FrameBufferPool()
+{
+    // the device must not keep buffers that are freed
+    release();
+}
+
+
+TY_STATUS FrameBufferPool::init(TY_DEV_HANDLE hDevice, int count, int flags)
+{
+    release();
+
+    _device = hDevice;
+    if(_hostPoint3D && _hostPointsDevice != hDevice){
+        TY_STATUS err = moveToHost();
+        if(err != TY_STATUS_OK){
+            return err;
+        }
+    }
+
+    // the buffer size follows the enabled components
+    int32_t size;
+    TY_STATUS err = TYGetFrameBufferSize(hDevice, &size);
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+
+    std::lock_guard<std::mutex> lk(_lock);
+    _bufferSize = size;
+    _flags = flags;
+    _clock.reset();
+    for(int i = 0; i < count; i++){
+        err = addBuffer();
+        if(err != TY_STATUS_OK){
+            return err;
+        }
+    }
+    return TY_STATUS_OK;
+}
+
+
+void FrameBufferPool::release()
+{
+    if(_device){
+        TYClearBufferQueue(_device);
+    }
+    std::lock_guard<std::mutex> lk(_lock);
+    freeAll();
+    _device = NULL;
+    _inDevice = 0;
+}
+
+
+void FrameBufferPool::setAutoGrow(int maxBuffers)
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _maxBuffers = maxBuffers;
+}
+
+
+TY_STATUS FrameBufferPool::fetch(TY_FRAME_DATA* frame, int32_t timeout)
+{
+    TY_STATUS err = TYFetchFrame(_device, frame, timeout);
+    int64_t now = monotonicNs();
+
+    FrameBlock* block = NULL;
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        if(err == TY_STATUS_TIMEOUT){
+            _timeouts++;
+            return err;
+        }
+        if(err == TY_STATUS_NO_BUFFER){
+            _noBuffer++;
+            if((int)_buffers.size() < _maxBuffers && addBuffer() == TY_STATUS_OK){
+                _grown++;
+            }
+            return err;
+        }
+        if(err != TY_STATUS_OK){
+            return err;
+        }
+
+        _frames++;
+        _clock.add(*frame, now);
+        Buffer* buf = find(frame->userBuffer);
+        if(buf && buf->inDevice){
+            buf->inDevice = false;
+            buf->fetchedNs = now;
+            _inDevice--;
+            block = buf->block;
+        }
+        if(_inDevice == 0){
+            // every buffer is held by the user, the next frame has nowhere to go
+            _starved++;
+            if((int)_buffers.size() < _maxBuffers && addBuffer() == TY_STATUS_OK){
+                _grown++;
+            }
+        }
+    }
+
+    // the block is ours until the buffer is enqueued again
+    if(block && hostPoint3D()){
+        addHostPoints(*frame, *block);
+    }
+    return err;
+}
+
+
+TY_STATUS FrameBufferPool::enqueue(void* buffer)
+{
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        Buffer* buf = find(buffer);
+        if(!buf || buf->inDevice){
+            return TY_STATUS_INVALID_PARAMETER;
+        }
+        double dwell = (monotonicNs() - buf->fetchedNs) / 1e6;
+        _dwellSum += dwell;
+        _dwellCount++;
+        if(dwell > _dwellMax){
+            _dwellMax = dwell;
+        }
+        buf->inDevice = true;
+        _inDevice++;
+    }
+
+    TY_STATUS err = TYEnqueueBuffer(_device, buffer, _bufferSize);
+    if(err != TY_STATUS_OK){
+        std::lock_guard<std::mutex> lk(_lock);
+        Buffer* buf = find(buffer);
+        if(buf){
+            buf->inDevice = false;
+            _inDevice--;
+        }
+    }
+    return err;
+}
+
+
+Frame FrameBufferPool::fetchFrame(int32_t timeout, TY_STATUS* status)
+{
+    TY_FRAME_DATA data;
+    TY_STATUS err = fetch(&data, timeout);
+    if(status){
+        *status = err;
+    }
+    if(err != TY_STATUS_OK){
+        return Frame();
+    }
+
+    FrameBlock* block = NULL;
+    int64_t fetchedNs = 0;
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        Buffer* buf = find(data.userBuffer);
+        if(buf){
+            block = buf->block;
+            fetchedNs = buf->fetchedNs;
+        }
+    }
+    if(!block){
+        if(status){
+            *status = TY_STATUS_ERROR;
+        }
+        return Frame();
+    }
+    block->data = data;
+    block->fetchedNs = fetchedNs;
+    block->refs.store(1, std::memory_order_relaxed);
+    return Frame(block);
+}
+
+
+FrameBufferPool::Stats FrameBufferPool::stats() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    Stats s;
+    s.buffers = (int)_buffers.size();
+    s.inDevice = _inDevice;
+    s.grown = _grown;
+    s.frames = _frames;
+    s.noBuffer = _noBuffer;
+    s.timeouts = _timeouts;
+    s.starved = _starved;
+    s.dwellAvgMs = _dwellCount ? _dwellSum / _dwellCount : 0.;
+    s.dwellMaxMs = _dwellMax;
+    return s;
+}
+
+
+DeviceClock::Fit FrameBufferPool::clockFit() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    return _clock.fit();
+}
+
+
+void FrameBufferPool::resetStats()
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _grown = 0;
+    _frames = 0;
+    _noBuffer = 0;
+    _timeouts = 0;
+    _starved = 0;
+    _dwellCount = 0;
+    _dwellSum = 0.;
+    _dwellMax = 0.;
+}
+
+
+TY_STATUS FrameBufferPool::addBuffer()
+{
+    Buffer buf;
+    if(!allocate(_bufferSize, _flags, buf)){
+        return TY_STATUS_OUT_OF_MEMORY;
+    }
+    TY_STATUS err = TYEnqueueBuffer(_device, buf.data, _bufferSize);
+    if(err != TY_STATUS_OK){
+        deallocate(buf);
+        return err;
+    }
+    buf.inDevice = true;
+    buf.fetchedNs = 0;
+    buf.block = new FrameBlock;
+    buf.block->refs = 0;
+    buf.block->pool = this;
+    buf.block->fetchedNs = 0;
+    _buffers.push_back(buf);
+    _inDevice++;
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS FrameBufferPool::moveToHost()
+{
+    int32_t enabled = 0;
+    TY_STATUS err = TYGetEnabledComponentIDs(_device, &enabled);
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+    if(!(enabled & TY_COMPONENT_POINT3D_CAM)){
+        _hostPointsDevice = NULL;
+        return TY_STATUS_OK;
+    }
+    err = TYGetStruct(_device, TY_COMPONENT_DEPTH_CAM, TY_STRUCT_CAM_INTRINSIC
+            , &_depthIntrinsic, sizeof(_depthIntrinsic));
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+    err = TYDisableComponents(_device, TY_COMPONENT_POINT3D_CAM);
+    if(err == TY_STATUS_OK){
+        err = TYEnableComponents(_device, TY_COMPONENT_DEPTH_CAM);
+    }
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+    _hostPointsDevice = _device;
+    return TY_STATUS_OK;
+}
+
+
+void FrameBufferPool::addHostPoints(TY_FRAME_DATA& frame, FrameBlock& block)
+{
+    const int slots = (int)(sizeof(frame.image) / sizeof(frame.image[0]));
+    const TY_IMAGE_DATA* depth = NULL;
+    for(int i = 0; i < frame.validCount; i++){
+        const TY_IMAGE_DATA& img = frame.image[i];
+        if(img.componentID == TY_COMPONENT_POINT3D_CAM){
+            return;
+        }
+        if(img.componentID == TY_COMPONENT_DEPTH_CAM && img.pixelFormat == TY_PIXEL_FORMAT_DEPTH16){
+            depth = &img;
+        }
+    }
+    if(!depth || frame.validCount >= slots){
+        return;
+    }
+    TY_CAMERA_INTRINSIC intrinsic;
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        intrinsic = _depthIntrinsic;
+    }
+    // the tables of a block only change with the resolution
+    if(!block.toWorld.setup(intrinsic, depth->width, depth->height)){
+        return;
+    }
+
+    const size_t count = (size_t)depth->width * depth->height;
+    if(block.points.size() < count){
+        block.points.resize(count);
+    }
+    block.toWorld.convert((const uint16_t*)depth->buffer, depth->width, &block.points[0]);
+
+    TY_IMAGE_DATA& img = frame.image[frame.validCount++];
+    img = *depth;
+    img.componentID = TY_COMPONENT_POINT3D_CAM;
+    img.pixelFormat = TY_PIXEL_FORMAT_FPOINT3D;
+    img.size = (int32_t)(count * sizeof(TY_VECT_3F));
+    img.buffer = &block.points[0];
+}
+
+
+FrameBufferPool::Buffer* FrameBufferPool::find(void* data)
+{
+    for(size_t i = 0; i < _buffers.size(); i++){
+        if(_buffers[i].data == data){
+            return &_buffers[i];
+        }
+    }
+    return NULL;
+}
+
+
+void FrameBufferPool::freeAll()
+{
+    for(size_t i = 0; i < _buffers.size(); i++){
+        deallocate(_buffers[i]);
+        delete _buffers[i].block;
+    }
+    _buffers.clear();
+}
+
+
+#ifdef _WIN32
+
+bool FrameBufferPool::allocate(size_t size, int flags, Buffer& buf)
+{
+    if(flags != ALLOC_PAGE_ALIGNED){
+        // large pages need SeLockMemoryPrivilege, fall back without it
+        SIZE_T large = GetLargePageMinimum();
+        if(large){
+            size_t n = roundUp(size, large);
+            void* p = VirtualAlloc(NULL, n, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES
+                    , PAGE_READWRITE);
+            if(p){
+                buf.data = p;
+                buf.mapped = n;
+                return true;
+            }
+        }
+    }
+    void* p = VirtualAlloc(NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    if(!p){
+        return false;
+    }
+    buf.data = p;
+    buf.mapped = size;
+    return true;
+}
+
+
+void FrameBufferPool::deallocate(Buffer& buf)
+{
+    VirtualFree(buf.data, 0, MEM_RELEASE);
+    buf.data = NULL;
+}
+
+#else
+
+bool FrameBufferPool::allocate(size_t size, int flags, Buffer& buf)
+{
+    const int prot = PROT_READ | PROT_WRITE;
+    const int map = MAP_PRIVATE | MAP_ANONYMOUS;
+
+    if(flags == ALLOC_HUGETLB){
+#ifdef MAP_HUGETLB
+        size_t n = roundUp(size, kHugePageSize);
+        void* p = mmap(NULL, n, prot, map | MAP_HUGETLB, -1, 0);
+        if(p != MAP_FAILED){
+            buf.data = p;
+            buf.mapped = n;
+            return true;
+        }
+#endif
+        // no hugepages reserved (vm.nr_hugepages), try transparent ones
+        flags = ALLOC_THP;
+    }
+
+    if(flags == ALLOC_THP){
+        // map one hugepage more and trim to a 2MB aligned range, so the
+        // kernel can back all of it with hugepages
+        size_t n = roundUp(size, kHugePageSize);
+        size_t total = n + kHugePageSize;
+        uint8_t* p = (uint8_t*)mmap(NULL, total, prot, map, -1, 0);
+        if(p == (uint8_t*)MAP_FAILED){
+            return false;
+        }
+        uint8_t* aligned = (uint8_t*)roundUp((size_t)p, kHugePageSize);
+        if(aligned > p){
+            munmap(p, aligned - p);
+        }
+        if(p + total > aligned + n){
+            munmap(aligned + n, p + total - (aligned + n));
+        }
+#ifdef MADV_HUGEPAGE
+        madvise(aligned, n, MADV_HUGEPAGE);
+#endif
+        buf.data = aligned;
+        buf.mapped = n;
+        return true;
+    }
+
+    void* p = mmap(NULL, size, prot, map, -1, 0);
+    if(p == MAP_FAILED){
+        return false;
+    }
+    buf.data = p;
+    buf.mapped = size;
+    return true;
+}
+
+
+void FrameBufferPool::deallocate(Buffer& buf)
+{
+    munmap(buf.data, buf.mapped);
+    buf.data = NULL;
+}
+
+#endif
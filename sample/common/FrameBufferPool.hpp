@@ -0,0 +1,194 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_FRAME_BUFFER_POOL_HPP_
+#define PERCIPIO_SAMPLE_COMMON_FRAME_BUFFER_POOL_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include "TY_API.h"
+#include "Clock.hpp"
+#include "DepthToWorld.hpp"
+
+class FrameBufferPool;
+
+/// Per buffer bookkeeping of a fetched frame, owned by the pool.
+struct FrameBlock {
+    std::atomic<int>    refs;
+    TY_FRAME_DATA       data;
+    FrameBufferPool*    pool;
+    int64_t             fetchedNs;  ///< monotonicNs() when fetch returned
+    std::vector<TY_VECT_3F> points; ///< host point cloud, see setHostPoint3D()
+    DepthToWorld        toWorld;    ///< ray tables of points, one per block so
+                                    ///< fetching threads do not share them
+};
+
+
+/// Shared handle on a fetched frame. Copies share the same frame buffer
+/// without copying it; when the last copy is released the buffer goes
+/// back to its device. All frames must be released before their pool is
+/// destroyed.
+class Frame
+{
+public:
+    Frame() : _block(NULL) {}
+    Frame(const Frame& other) : _block(other._block) {
+                if(_block){
+                    _block->refs.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+    Frame& operator=(const Frame& other){
+                if(other._block){
+                    other._block->refs.fetch_add(1, std::memory_order_relaxed);
+                }
+                release();
+                _block = other._block;
+                return *this;
+            }
+    ~Frame() { release(); }
+
+    bool empty() const { return _block == NULL; }
+    const TY_FRAME_DATA& data() const { return _block->data; }
+    const TY_FRAME_DATA* operator->() const { return &_block->data; }
+    int useCount() const { return _block ? _block->refs.load() : 0; }
+    /// pool the frame was fetched from, tells devices apart
+    FrameBufferPool* pool() const { return _block ? _block->pool : NULL; }
+    /// monotonicNs() when the frame was fetched
+    int64_t fetchedNs() const { return _block ? _block->fetchedNs : 0; }
+
+    /// drop this reference now, re-enqueues the buffer if it was the last
+    inline void release();
+
+    void swap(Frame& other){
+                FrameBlock* t = _block;
+                _block = other._block;
+                other._block = t;
+            }
+
+private:
+    friend class FrameBufferPool;
+    explicit Frame(FrameBlock* block) : _block(block) {}
+
+    FrameBlock* _block;
+};
+
+/// Owns the frame buffers of one device. Buffers are page aligned, and can
+/// be placed on transparent or explicit hugepages to cut TLB misses on
+/// multi megabyte frames. Fetching and enqueueing through the pool keeps
+/// statistics on how long user code holds buffers and on how often the
+/// SDK ran out of them; with auto grow the pool adds buffers when that
+/// happens instead of letting the SDK drop frames.
+class FrameBufferPool
+{
+public:
+    enum AllocFlags {
+        ALLOC_PAGE_ALIGNED  = 0,    ///< page aligned memory
+        ALLOC_THP           = 1,    ///< 2MB aligned, advised for transparent hugepages
+        ALLOC_HUGETLB       = 2,    ///< explicit hugepages, falls back to ALLOC_THP
+    };
+
+    struct Stats {
+        int         buffers;        ///< allocated buffers
+        int         inDevice;       ///< buffers queued in the SDK right now
+        int         grown;          ///< buffers added by auto grow
+        uint64_t    frames;         ///< frames fetched
+        uint64_t    noBuffer;       ///< fetches failed with TY_STATUS_NO_BUFFER
+        uint64_t    timeouts;       ///< fetches failed with TY_STATUS_TIMEOUT
+        uint64_t    starved;        ///< frames fetched with no buffer left in the SDK
+        double      dwellAvgMs;     ///< mean time from fetch to enqueue
+        double      dwellMaxMs;
+    };
+
+    FrameBufferPool();
+    /// release(), capture must be stopped before. Call release() before the
+    /// device is closed, the device queue can not be cleared after.
+    ~FrameBufferPool();
+
+    /// Allocate count buffers of TYGetFrameBufferSize and enqueue them.
+    TY_STATUS init(TY_DEV_HANDLE hDevice, int count = 2, int flags = ALLOC_PAGE_ALIGNED);
+    /// clear the SDK queue and free all buffers, capture must be stopped
+    void release();
+
+    /// Add a buffer each time the SDK is found starved, up to maxBuffers.
+    /// 0 turns it off.
+    void setAutoGrow(int maxBuffers);
+
+    /// Compute point clouds on the host. When on, init() swaps an enabled
+    /// TY_COMPONENT_POINT3D_CAM for TY_COMPONENT_DEPTH_CAM, a sixth of the
+    /// bytes on the link, and each fetched frame gets a FPOINT3D image of
+    /// TY_COMPONENT_POINT3D_CAM made from its depth, next to the depth
+    /// image. Code reading point clouds from frames sees no difference.
+    /// Set it before init().
+    void setHostPoint3D(bool on) { _hostPoint3D = on; }
+    /// true if init() moved point clouds to the host
+    bool hostPoint3D() const { return _device && _hostPointsDevice == _device; }
+
+    /// TYFetchFrame with accounting.
+    TY_STATUS fetch(TY_FRAME_DATA* frame, int32_t timeout);
+    /// Give a fetched buffer back to the SDK.
+    TY_STATUS enqueue(void* buffer);
+
+    /// Fetch wrapped in a Frame that re-enqueues itself, empty on error.
+    Frame fetchFrame(int32_t timeout, TY_STATUS* status = NULL);
+
+    TY_DEV_HANDLE device() const { return _device; }
+    int32_t bufferSize() const { return _bufferSize; }
+
+    /// Device to host clock mapping, fitted on the timestamps and arrival
+    /// times of all fetched frames.
+    DeviceClock::Fit clockFit() const;
+
+    Stats stats() const;
+    void resetStats();
+
+private:
+    FrameBufferPool(const FrameBufferPool&);
+    FrameBufferPool& operator=(const FrameBufferPool&);
+
+    struct Buffer {
+        void*       data;
+        size_t      mapped;     // bytes to unmap
+        bool        inDevice;
+        int64_t     fetchedNs;
+        FrameBlock* block;
+    };
+
+    TY_STATUS addBuffer();
+    TY_STATUS moveToHost();
+    void addHostPoints(TY_FRAME_DATA& frame, FrameBlock& block);
+    Buffer* find(void* data);
+    static bool allocate(size_t size, int flags, Buffer& buf);
+    static void deallocate(Buffer& buf);
+    void freeAll();
+
+    mutable std::mutex      _lock;
+    std::vector<Buffer>     _buffers;
+    DeviceClock             _clock;
+    TY_DEV_HANDLE           _device;
+    int32_t                 _bufferSize;
+    int                     _flags;
+    int                     _maxBuffers;
+    int                     _inDevice;
+    int                     _grown;
+    uint64_t                _frames;
+    uint64_t                _noBuffer;
+    uint64_t                _timeouts;
+    uint64_t                _starved;
+    uint64_t                _dwellCount;
+    double                  _dwellSum;
+    double                  _dwellMax;
+    bool                    _hostPoint3D;
+    TY_DEV_HANDLE           _hostPointsDevice;  ///< device moved to host points
+    TY_CAMERA_INTRINSIC     _depthIntrinsic;
+};
+
+
+inline void Frame::release()
+{
+    if(_block && _block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1){
+        _block->pool->enqueue(_block->data.userBuffer);
+    }
+    _block = NULL;
+}
+
+
+#endif
@@ -0,0 +1,284 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_FRAME_QUEUE_HPP_
+#define PERCIPIO_SAMPLE_COMMON_FRAME_QUEUE_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include "FrameBufferPool.hpp"
+
+/// Bounded lock free multi producer / multi consumer ring (D. Vyukov).
+/// Capacity is rounded up to a power of two.
+template<typename T>
+class MPMCRing
+{
+public:
+    explicit MPMCRing(size_t capacity) : _enqueue(0), _dequeue(0) {
+                size_t n = 1;
+                while(n < capacity){
+                    n <<= 1;
+                }
+                _mask = n - 1;
+                _cells = new Cell[n];
+                for(size_t i = 0; i < n; i++){
+                    _cells[i].seq.store(i, std::memory_order_relaxed);
+                }
+            }
+    ~MPMCRing() { delete[] _cells; }
+
+    size_t capacity() const { return _mask + 1; }
+
+    /// approximate when called concurrently with push / pop
+    size_t size() const {
+                size_t e = _enqueue.load(std::memory_order_relaxed);
+                size_t d = _dequeue.load(std::memory_order_relaxed);
+                return e > d ? e - d : 0;
+            }
+
+    bool tryPush(const T& value){
+                Cell* cell;
+                size_t pos = _enqueue.load(std::memory_order_relaxed);
+                while(true){
+                    cell = &_cells[pos & _mask];
+                    size_t seq = cell->seq.load(std::memory_order_acquire);
+                    intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+                    if(diff == 0){
+                        if(_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                            break;
+                        }
+                    } else if(diff < 0){
+                        return false;   // full
+                    } else {
+                        pos = _enqueue.load(std::memory_order_relaxed);
+                    }
+                }
+                cell->data = value;
+                cell->seq.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+
+    /// the cell is reset to T() so it does not keep the value alive
+    bool tryPop(T& value){
+                Cell* cell;
+                size_t pos = _dequeue.load(std::memory_order_relaxed);
+                while(true){
+                    cell = &_cells[pos & _mask];
+                    size_t seq = cell->seq.load(std::memory_order_acquire);
+                    intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+                    if(diff == 0){
+                        if(_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)){
+                            break;
+                        }
+                    } else if(diff < 0){
+                        return false;   // empty
+                    } else {
+                        pos = _dequeue.load(std::memory_order_relaxed);
+                    }
+                }
+                value = cell->data;
+                cell->data = T();
+                cell->seq.store(pos + _mask + 1, std::memory_order_release);
+                return true;
+            }
+
+private:
+    MPMCRing(const MPMCRing&);
+    MPMCRing& operator=(const MPMCRing&);
+
+    struct Cell {
+        std::atomic<size_t> seq;
+        T                   data;
+    };
+
+    Cell*               _cells;
+    size_t              _mask;
+    char                _pad0[64];
+    std::atomic<size_t> _enqueue;
+    char                _pad1[64];
+    std::atomic<size_t> _dequeue;
+    char                _pad2[64];
+};
+
+
+/// One pipeline stage: a bounded queue of Frames with a backpressure
+/// policy and depth statistics. Push and pop never take a lock unless the
+/// caller has to wait.
+class FrameQueue
+{
+public:
+    enum Policy {
+        POLICY_BLOCK,       ///< producer waits for room
+        POLICY_DROP_OLDEST, ///< oldest queued frame is released
+        POLICY_DROP_NEWEST, ///< incoming frame is released
+    };
+
+    struct Stats {
+        uint64_t    pushed;
+        uint64_t    popped;
+        uint64_t    dropped;
+        int         depth;
+        int         maxDepth;
+        double      blockedMs;  ///< producer time spent waiting, POLICY_BLOCK
+    };
+
+    FrameQueue(int capacity, Policy policy)
+        : _ring(capacity > 0 ? capacity : 1)
+        , _policy(policy)
+        , _closed(false)
+        , _waiters(0)
+        , _pushed(0)
+        , _popped(0)
+        , _dropped(0)
+        , _maxDepth(0)
+        , _blockedUs(0)
+        {}
+
+    Policy policy() const { return _policy; }
+    int capacity() const { return (int)_ring.capacity(); }
+
+    /// false if the frame was not queued (dropped or queue closed)
+    bool push(const Frame& frame){
+                if(_closed.load()){
+                    return false;
+                }
+                if(!_ring.tryPush(frame)){
+                    if(_policy == POLICY_DROP_NEWEST){
+                        _dropped++;
+                        return false;
+                    }
+                    if(_policy == POLICY_DROP_OLDEST){
+                        Frame old;
+                        while(!_ring.tryPush(frame)){
+                            if(_ring.tryPop(old)){
+                                old.release();
+                                _dropped++;
+                            }
+                        }
+                    } else if(!pushBlocking(frame)){
+                        return false;
+                    }
+                }
+                _pushed++;
+                updateMaxDepth();
+                wake(_notEmpty);
+                return true;
+            }
+
+    /// Wait up to timeoutMs (-1 forever) for a frame. false on timeout, or
+    /// when the queue is closed and drained.
+    bool pop(Frame& frame, int timeoutMs){
+                if(!_ring.tryPop(frame)){
+                    if(timeoutMs == 0){
+                        return false;
+                    }
+                    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                            + std::chrono::milliseconds(timeoutMs < 0 ? 0 : timeoutMs);
+                    std::unique_lock<std::mutex> lk(_waitLock);
+                    _waiters++;
+                    // pairs with the fence in wake()
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    bool ok;
+                    while(!(ok = _ring.tryPop(frame)) && !_closed.load()){
+                        if(timeoutMs < 0){
+                            _notEmpty.wait_for(lk, std::chrono::milliseconds(kRecheckMs));
+                        } else if(_notEmpty.wait_until(lk, deadline) == std::cv_status::timeout){
+                            ok = _ring.tryPop(frame);
+                            break;
+                        }
+                    }
+                    _waiters--;
+                    if(!ok){
+                        return false;
+                    }
+                }
+                _popped++;
+                wake(_notFull);
+                return true;
+            }
+
+    /// wake all waiters, later pushes fail; queued frames can still be popped
+    void close(){
+                _closed = true;
+                std::lock_guard<std::mutex> lk(_waitLock);
+                _notEmpty.notify_all();
+                _notFull.notify_all();
+            }
+    void reopen() { _closed = false; }
+
+    /// release all queued frames
+    void clear(){
+                Frame f;
+                while(_ring.tryPop(f)){
+                    f.release();
+                }
+            }
+
+    Stats stats() const {
+                Stats s;
+                s.pushed = _pushed.load();
+                s.popped = _popped.load();
+                s.dropped = _dropped.load();
+                s.depth = (int)_ring.size();
+                s.maxDepth = _maxDepth.load();
+                s.blockedMs = _blockedUs.load() / 1000.;
+                return s;
+            }
+
+private:
+    FrameQueue(const FrameQueue&);
+    FrameQueue& operator=(const FrameQueue&);
+
+    /// waits without a deadline re-check the ring this often as a backstop
+    enum { kRecheckMs = 100 };
+
+    bool pushBlocking(const Frame& frame){
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                std::unique_lock<std::mutex> lk(_waitLock);
+                _waiters++;
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                bool ok;
+                while(!(ok = _ring.tryPush(frame)) && !_closed.load()){
+                    _notFull.wait_for(lk, std::chrono::milliseconds(kRecheckMs));
+                }
+                _waiters--;
+                _blockedUs += (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                        std::chrono::steady_clock::now() - start).count();
+                return ok;
+            }
+
+    // The fence orders the ring update before the _waiters load, as the
+    // waiter's fence orders its _waiters increment before the ring check:
+    // either the waiter sees the update or this sees the waiter. Waiters
+    // re-check the ring under _waitLock, so the notify can not be missed.
+    void wake(std::condition_variable& cv){
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if(_waiters.load() > 0){
+                    std::lock_guard<std::mutex> lk(_waitLock);
+                    cv.notify_all();
+                }
+            }
+
+    void updateMaxDepth(){
+                int depth = (int)_ring.size();
+                int prev = _maxDepth.load(std::memory_order_relaxed);
+                while(depth > prev && !_maxDepth.compare_exchange_weak(prev, depth)){
+                }
+            }
+
+    MPMCRing<Frame>         _ring;
+    Policy                  _policy;
+    std::atomic<bool>       _closed;
+    std::atomic<int>        _waiters;
+    std::mutex              _waitLock;
+    std::condition_variable _notEmpty;
+    std::condition_variable _notFull;
+    std::atomic<uint64_t>   _pushed;
+    std::atomic<uint64_t>   _popped;
+    std::atomic<uint64_t>   _dropped;
+    std::atomic<int>        _maxDepth;
+    std::atomic<uint64_t>   _blockedUs;
+};
+
+
+#endif
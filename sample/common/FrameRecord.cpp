@@ -0,0 +1,795 @@
+#include "FrameRecord.hpp"
+#include "DepthCodec.hpp"
+#include "ReplayDispatch.hpp"
+#include <algorithm>
+#include <chrono>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+# include <windows.h>
+# include <malloc.h>
+#else
+# include <errno.h>
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+
+static const size_t kPage = TY_RECORD_PAGE;
+
+static size_t roundUp(size_t v, size_t align)
+{
+    return (v + align - 1) / align * align;
+}
+
+// O_DIRECT needs page aligned memory, offsets and sizes
+static uint8_t* alignedAlloc(size_t size)
+{
+#ifdef _WIN32
+    return (uint8_t*)_aligned_malloc(size, kPage);
+#else
+    void* p = NULL;
+    if(posix_memalign(&p, kPage, size) != 0){
+        return NULL;
+    }
+    return (uint8_t*)p;
+#endif
+}
+
+static void alignedFree(uint8_t* p)
+{
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+static uint64_t hostTimeUs()
+{
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+
+#ifdef _WIN32
+FrameRecordWriter::FileHandle const FrameRecordWriter::INVALID_FD = INVALID_HANDLE_VALUE;
+#endif
+
+
+FrameRecordWriter::FrameRecordWriter()
+    : _fd(INVALID_FD)
+    , _direct(false)
+    , _chunkSize(0)
+    , _current(-1)
+    , _fileOffset(0)
+    , _structCount(0)
+    , _bufferSize(0)
+    , _started(false)
+    , _depthCoding(false)
+    , _exit(false)
+    , _dropped(0)
+    , _bytes(0)
+    , _errors(0)
+    , _maxQueued(0)
+{
+    memset(_deviceId, 0, sizeof(_deviceId));
+}
+
+
+FrameRecordWriter::~FrameRecordWriter()
+{
+    close();
+}
+
+
+bool FrameRecordWriter::open(const char* path, bool direct, int chunkMB, int chunks)
+{
+    close();
+
+#ifdef _WIN32
+    DWORD flags = FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN;
+    _fd = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS
+            , flags | (direct ? FILE_FLAG_NO_BUFFERING : 0), NULL);
+    _direct = direct && _fd != INVALID_FD;
+    if(_fd == INVALID_FD && direct){
+        _fd = CreateFileA(path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, flags, NULL);
+    }
+#else
+    const int mode = O_WRONLY | O_CREAT | O_TRUNC;
+    _direct = false;
+# ifdef O_DIRECT
+    if(direct){
+        // tmpfs and some network file systems refuse O_DIRECT
+        _fd = ::open(path, mode | O_DIRECT, 0644);
+        _direct = _fd != INVALID_FD;
+    }
+# endif
+    if(_fd == INVALID_FD){
+        _fd = ::open(path, mode, 0644);
+    }
+#endif
+    if(_fd == INVALID_FD){
+        return false;
+    }
+
+    _chunkSize = roundUp((size_t)(chunkMB > 0 ? chunkMB : 1) << 20, kPage);
+    for(int i = 0; i < (chunks > 1 ? chunks : 2); i++){
+        Chunk c;
+        c.data = alignedAlloc(_chunkSize);
+        c.capacity = c.data ? _chunkSize : 0;
+        c.fill = 0;
+        _chunks.push_back(c);
+        _free.push_back(i);
+    }
+    _full.clear();
+    _current = -1;
+    _fileOffset = 0;
+    _structs.clear();
+    _structCount = 0;
+    _bufferSize = 0;
+    _index.clear();
+    _started = false;
+    _exit = false;
+    _dropped = 0;
+    _bytes = 0;
+    _errors = 0;
+    _maxQueued = 0;
+    _thread = std::thread(&FrameRecordWriter::writerLoop, this);
+    return true;
+}
+
+
+void FrameRecordWriter::setDeviceId(const char* id)
+{
+    memset(_deviceId, 0, sizeof(_deviceId));
+    strncpy(_deviceId, id, sizeof(_deviceId) - 1);
+}
+
+
+bool FrameRecordWriter::addStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature
+        , const void* data, int32_t size)
+{
+    std::lock_guard<std::mutex> lk(_writeLock);
+    size_t need = sizeof(RecStructHeader) + roundUp(size, 8);
+    if(_started || size <= 0
+            || roundUp(sizeof(RecFileHeader), 8) + _structs.size() + need > kPage){
+        return false;
+    }
+    RecStructHeader h;
+    memset(&h, 0, sizeof(h));
+    h.componentID = comp;
+    h.featureID = feature;
+    h.size = size;
+    size_t at = _structs.size();
+    _structs.resize(at + need, 0);
+    memcpy(&_structs[at], &h, sizeof(h));
+    memcpy(&_structs[at + sizeof(h)], data, size);
+    _structCount++;
+    return true;
+}
+
+
+int FrameRecordWriter::addCalibration(TY_DEV_HANDLE hDevice)
+{
+    static const TY_COMPONENT_ID comps[] = {
+        TY_COMPONENT_DEPTH_CAM, TY_COMPONENT_IR_CAM_LEFT
+        , TY_COMPONENT_IR_CAM_RIGHT, TY_COMPONENT_RGB_CAM
+    };
+    int32_t allComps = 0;
+    if(TYGetComponentIDs(hDevice, &allComps) != TY_STATUS_OK){
+        return 0;
+    }
+
+    int added = 0;
+    for(size_t i = 0; i < sizeof(comps) / sizeof(comps[0]); i++){
+        if(!(allComps & comps[i])){
+            continue;
+        }
+        TY_CAMERA_INTRINSIC intri;
+        TY_CAMERA_DISTORTION dist;
+        TY_CAMERA_EXTRINSIC extri;
+        if(TYGetStruct(hDevice, comps[i], TY_STRUCT_CAM_INTRINSIC, &intri, sizeof(intri)) == TY_STATUS_OK
+                && addStruct(comps[i], TY_STRUCT_CAM_INTRINSIC, &intri, sizeof(intri))){
+            added++;
+        }
+        if(TYGetStruct(hDevice, comps[i], TY_STRUCT_CAM_DISTORTION, &dist, sizeof(dist)) == TY_STATUS_OK
+                && addStruct(comps[i], TY_STRUCT_CAM_DISTORTION, &dist, sizeof(dist))){
+            added++;
+        }
+        if(TYGetStruct(hDevice, comps[i], TY_STRUCT_EXTRINSIC_TO_LEFT_IR, &extri, sizeof(extri)) == TY_STATUS_OK
+                && addStruct(comps[i], TY_STRUCT_EXTRINSIC_TO_LEFT_IR, &extri, sizeof(extri))){
+            added++;
+        }
+        if(TYGetStruct(hDevice, comps[i], TY_STRUCT_EXTRINSIC_TO_LEFT_RGB, &extri, sizeof(extri)) == TY_STATUS_OK
+                && addStruct(comps[i], TY_STRUCT_EXTRINSIC_TO_LEFT_RGB, &extri, sizeof(extri))){
+            added++;
+        }
+    }
+    return added;
+}
+
+
+bool FrameRecordWriter::write(const TY_FRAME_DATA& frame)
+{
+    std::lock_guard<std::mutex> lk(_writeLock);
+    if(!isOpen()){
+        return false;
+    }
+
+    // code depth first, the record size depends on it
+    size_t codedAt[10];
+    size_t codedSize[10];
+    size_t coded = 0;
+    for(int i = 0; i < frame.validCount && i < 10; i++){
+        const TY_IMAGE_DATA& img = frame.image[i];
+        codedSize[i] = 0;
+        if(!_depthCoding || !img.buffer || img.pixelFormat != TY_PIXEL_FORMAT_DEPTH16
+                || img.width <= 0 || img.height <= 0
+                || (int64_t)img.width * img.height * 2 > img.size){
+            continue;
+        }
+        _coded.resize(coded + depthCodedBound(img.width, img.height));
+        codedAt[i] = coded;
+        codedSize[i] = encodeDepth16((const uint16_t*)img.buffer, img.width, img.height
+                , img.width, &_coded[coded]);
+        if(codedSize[i] >= (size_t)img.size){
+            // noise does not compress, keep it raw
+            codedSize[i] = 0;
+            continue;
+        }
+        coded += codedSize[i];
+    }
+
+    const size_t headerBytes = roundUp(sizeof(RecFrameHeader), kPage);
+    size_t recordSize = headerBytes;
+    for(int i = 0; i < frame.validCount && i < 10; i++){
+        const TY_IMAGE_DATA& img = frame.image[i];
+        if(img.buffer && img.size > 0){
+            recordSize += roundUp(codedSize[i] ? codedSize[i] : img.size, kPage);
+        }
+    }
+    size_t need = recordSize + (_started ? 0 : kPage);
+
+    Chunk* chunk = _current >= 0 ? &_chunks[_current] : NULL;
+    if(!chunk || chunk->capacity - chunk->fill < need){
+        if(!nextChunk(need)){
+            std::lock_guard<std::mutex> lk2(_lock);
+            _dropped++;
+            return false;
+        }
+        chunk = &_chunks[_current];
+    }
+
+    if(!_started){
+        buildHeader(chunk->data + chunk->fill);
+        chunk->fill += kPage;
+        _fileOffset += kPage;
+        _started = true;
+    }
+
+    uint8_t* rec = chunk->data + chunk->fill;
+    memset(rec, 0, headerBytes);
+    RecFrameHeader* h = (RecFrameHeader*)rec;
+    h->magic = TY_RECORD_FRAME_MAGIC;
+    h->recordSize = (uint32_t)recordSize;
+    h->bufferSize = frame.bufferSize;
+    h->frameIndex = _index.size();
+    h->hostTimeUs = hostTimeUs();
+
+    size_t offset = headerBytes;
+    int n = 0;
+    for(int i = 0; i < frame.validCount && i < 10; i++){
+        const TY_IMAGE_DATA& img = frame.image[i];
+        if(!img.buffer || img.size <= 0){
+            continue;
+        }
+        RecImage& r = h->image[n++];
+        r.timestamp = img.timestamp;
+        r.imageIndex = img.imageIndex;
+        r.status = img.status;
+        r.componentID = img.componentID;
+        r.size = img.size;
+        r.width = img.width;
+        r.height = img.height;
+        r.pixelFormat = img.pixelFormat;
+        r.offset = (uint32_t)offset;
+        r.codedSize = (uint32_t)codedSize[i];
+        const size_t payload = codedSize[i] ? codedSize[i] : img.size;
+        memcpy(rec + offset, codedSize[i] ? &_coded[codedAt[i]] : img.buffer, payload);
+        size_t padded = roundUp(payload, kPage);
+        memset(rec + offset + payload, 0, padded - payload);
+        offset += padded;
+    }
+    h->validCount = n;
+
+    RecIndexEntry e;
+    e.offset = _fileOffset;
+    e.timestamp = n ? h->image[0].timestamp : 0;
+    e.recordSize = (uint32_t)recordSize;
+    e.reserved = 0;
+    _index.push_back(e);
+    _fileOffset += recordSize;
+    chunk->fill += recordSize;
+    _bufferSize = std::max(_bufferSize, frame.bufferSize);
+    return true;
+}
+
+
+bool FrameRecordWriter::nextChunk(size_t need)
+{
+    int idx;
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        if(_current >= 0){
+            _full.push_back(_current);
+            _maxQueued = std::max(_maxQueued, (int)_full.size());
+            _current = -1;
+            _wake.notify_one();
+        }
+        if(_free.empty()){
+            return false;
+        }
+        idx = _free.back();
+        _free.pop_back();
+    }
+
+    Chunk& c = _chunks[idx];
+    if(c.capacity < need){
+        // a frame larger than a chunk, only happens once per size
+        alignedFree(c.data);
+        c.data = alignedAlloc(roundUp(need, kPage));
+        c.capacity = c.data ? roundUp(need, kPage) : 0;
+    }
+    c.fill = 0;
+    if(c.capacity < need){
+        std::lock_guard<std::mutex> lk(_lock);
+        _free.push_back(idx);
+        return false;
+    }
+    _current = idx;
+    return true;
+}
+
+
+void FrameRecordWriter::writerLoop()
+{
+    uint64_t offset = 0;
+    while(true){
+        int idx;
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            while(_full.empty() && !_exit){
+                _wake.wait(lk);
+            }
+            if(_full.empty()){
+                break;
+            }
+            idx = _full.front();
+            _full.erase(_full.begin());
+        }
+
+        Chunk& c = _chunks[idx];
+        if(writeAt(c.data, c.fill, offset)){
+            _bytes += c.fill;
+        } else {
+            _errors++;
+        }
+        offset += c.fill;
+
+        std::lock_guard<std::mutex> lk(_lock);
+        _free.push_back(idx);
+    }
+}
+
+
+bool FrameRecordWriter::close()
+{
+    if(!isOpen()){
+        return false;
+    }
+
+    {
+        std::lock_guard<std::mutex> wl(_writeLock);
+        std::lock_guard<std::mutex> lk(_lock);
+        if(_current >= 0 && _chunks[_current].fill > 0){
+            _full.push_back(_current);
+        } else if(_current >= 0){
+            _free.push_back(_current);
+        }
+        _current = -1;
+        _exit = true;
+        _wake.notify_one();
+    }
+    _thread.join();
+
+    if(!_started){
+        // no frame, the header page is written below
+        _fileOffset = kPage;
+    }
+
+    size_t indexBytes = roundUp(_index.size() * sizeof(RecIndexEntry), kPage);
+    bool ok = true;
+    if(indexBytes){
+        uint8_t* buf = alignedAlloc(indexBytes);
+        ok = buf != NULL;
+        if(buf){
+            memset(buf, 0, indexBytes);
+            memcpy(buf, &_index[0], _index.size() * sizeof(RecIndexEntry));
+            ok = writeAt(buf, indexBytes, _fileOffset);
+            alignedFree(buf);
+        }
+    }
+
+    uint8_t* page = alignedAlloc(kPage);
+    if(page){
+        buildHeader(page);
+        RecFileHeader* h = (RecFileHeader*)page;
+        h->indexOffset = ok ? _fileOffset : 0;
+        ok = writeAt(page, kPage, 0) && ok;
+        alignedFree(page);
+    } else {
+        ok = false;
+    }
+
+#ifdef _WIN32
+    CloseHandle(_fd);
+#else
+    ::close(_fd);
+#endif
+    _fd = INVALID_FD;
+
+    for(size_t i = 0; i < _chunks.size(); i++){
+        alignedFree(_chunks[i].data);
+    }
+    _chunks.clear();
+    _free.clear();
+    _full.clear();
+    return ok && _errors.load() == 0;
+}
+
+
+FrameRecordWriter::Stats FrameRecordWriter::stats() const
+{
+    std::lock_guard<std::mutex> wl(_writeLock);
+    std::lock_guard<std::mutex> lk(_lock);
+    Stats s;
+    s.frames = _index.size();
+    s.dropped = _dropped;
+    s.bytes = _bytes.load();
+    s.errors = _errors.load();
+    s.maxQueued = _maxQueued;
+    return s;
+}
+
+
+void FrameRecordWriter::buildHeader(uint8_t* page)
+{
+    memset(page, 0, kPage);
+    RecFileHeader* h = (RecFileHeader*)page;
+    memcpy(h->magic, TY_RECORD_MAGIC, sizeof(h->magic));
+    h->version = TY_RECORD_VERSION;
+    h->pageSize = (uint32_t)kPage;
+    h->indexOffset = 0;
+    h->frameCount = _index.size();
+    h->bufferSize = _bufferSize;
+    h->structCount = _structCount;
+    memcpy(h->deviceId, _deviceId, sizeof(h->deviceId));
+    if(!_structs.empty()){
+        memcpy(page + roundUp(sizeof(RecFileHeader), 8), &_structs[0], _structs.size());
+    }
+}
+
+
+bool FrameRecordWriter::writeAt(const void* data, size_t size, int64_t offset)
+{
+#ifdef _WIN32
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.Offset = (DWORD)offset;
+    ov.OffsetHigh = (DWORD)(offset >> 32);
+    DWORD written = 0;
+    return WriteFile(_fd, data, (DWORD)size, &written, &ov) && written == size;
+#else
+    const uint8_t* p = (const uint8_t*)data;
+    while(size > 0){
+        ssize_t n = pwrite(_fd, p, size, (off_t)offset);
+        if(n < 0 && errno == EINTR){
+            continue;
+        }
+        if(n <= 0){
+            return false;
+        }
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+#endif
+}
+
+
+FrameRecordReader::FrameRecordReader()
+    : _data(NULL)
+    , _size(0)
+    , _mapping(NULL)
+{
+    memset(&_header, 0, sizeof(_header));
+}
+
+
+FrameRecordReader::~FrameRecordReader()
+{
+    close();
+}
+
+
+bool FrameRecordReader::open(const char* path)
+{
+    close();
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING
+            , FILE_ATTRIBUTE_NORMAL, NULL);
+    if(file == INVALID_HANDLE_VALUE){
+        return false;
+    }
+    LARGE_INTEGER size;
+    if(!GetFileSizeEx(file, &size) || size.QuadPart < (LONGLONG)kPage){
+        CloseHandle(file);
+        return false;
+    }
+    _mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if(!_mapping){
+        return false;
+    }
+    _data = (const uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+    _size = (size_t)size.QuadPart;
+    if(!_data){
+        CloseHandle(_mapping);
+        _mapping = NULL;
+        return false;
+    }
+#else
+    int fd = ::open(path, O_RDONLY);
+    if(fd < 0){
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)kPage){
+        ::close(fd);
+        return false;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(p == MAP_FAILED){
+        return false;
+    }
+    _data = (const uint8_t*)p;
+    _size = st.st_size;
+#endif
+
+    memcpy(&_header, _data, sizeof(_header));
+    // other versions lay the records out differently
+    if(memcmp(_header.magic, TY_RECORD_MAGIC, sizeof(_header.magic)) != 0
+            || _header.version != TY_RECORD_VERSION
+            || _header.pageSize == 0 || !loadIndex()){
+        close();
+        return false;
+    }
+    return true;
+}
+
+
+void FrameRecordReader::close()
+{
+    if(_data){
+#ifdef _WIN32
+        UnmapViewOfFile(_data);
+        CloseHandle(_mapping);
+        _mapping = NULL;
+#else
+        munmap((void*)_data, _size);
+#endif
+    }
+    _data = NULL;
+    _size = 0;
+    _index.clear();
+    memset(&_header, 0, sizeof(_header));
+}
+
+
+bool FrameRecordReader::loadIndex()
+{
+    // frameCount is checked first so the size of the index can not overflow
+    if(_header.indexOffset && _header.indexOffset <= _size
+            && _header.frameCount <= (_size - _header.indexOffset) / sizeof(RecIndexEntry)){
+        size_t bytes = (size_t)_header.frameCount * sizeof(RecIndexEntry);
+        _index.resize((size_t)_header.frameCount);
+        if(bytes){
+            memcpy(&_index[0], _data + _header.indexOffset, bytes);
+        }
+        // record() trusts the entries, so every record has to be mapped
+        for(size_t i = 0; i < _index.size(); i++){
+            const RecIndexEntry& e = _index[i];
+            if(e.offset > _size || e.recordSize < sizeof(RecFrameHeader)
+                    || e.recordSize > _size - e.offset){
+                _index.clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // not closed, walk the records
+    size_t off = _header.pageSize;
+    while(off + sizeof(RecFrameHeader) <= _size){
+        const RecFrameHeader* h = (const RecFrameHeader*)(_data + off);
+        if(h->magic != TY_RECORD_FRAME_MAGIC || h->recordSize < sizeof(RecFrameHeader)
+                || off + h->recordSize > _size){
+            break;
+        }
+        RecIndexEntry e;
+        e.offset = off;
+        e.timestamp = h->validCount > 0 ? h->image[0].timestamp : 0;
+        e.recordSize = h->recordSize;
+        e.reserved = 0;
+        _index.push_back(e);
+        off += h->recordSize;
+    }
+    return true;
+}
+
+
+const RecFrameHeader* FrameRecordReader::record(int index) const
+{
+    if(index < 0 || index >= (int)_index.size()){
+        return NULL;
+    }
+    const RecIndexEntry& e = _index[index];
+    const RecFrameHeader* h = (const RecFrameHeader*)(_data + e.offset);
+    if(h->magic != TY_RECORD_FRAME_MAGIC || h->validCount < 0 || h->validCount > 10){
+        return NULL;
+    }
+    for(int i = 0; i < h->validCount; i++){
+        const RecImage& r = h->image[i];
+        uint32_t payload = r.codedSize ? r.codedSize : (uint32_t)r.size;
+        if(r.size < 0 || (uint64_t)r.offset + payload > e.recordSize){
+            return NULL;
+        }
+    }
+    return h;
+}
+
+
+bool FrameRecordReader::frame(int index, TY_FRAME_DATA& frame) const
+{
+    const RecFrameHeader* h = record(index);
+    if(!h){
+        return false;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.userBuffer = (void*)h;
+    frame.bufferSize = (int32_t)_index[index].recordSize;
+    frame.validCount = h->validCount;
+    for(int i = 0; i < h->validCount; i++){
+        const RecImage& r = h->image[i];
+        TY_IMAGE_DATA& img = frame.image[i];
+        img.timestamp = r.timestamp;
+        img.imageIndex = r.imageIndex;
+        img.status = r.status;
+        img.componentID = r.componentID;
+        img.size = r.size;
+        img.buffer = r.codedSize ? NULL : (void*)((const uint8_t*)h + r.offset);
+        img.width = r.width;
+        img.height = r.height;
+        img.pixelFormat = r.pixelFormat;
+    }
+    return true;
+}
+
+
+bool FrameRecordReader::unpack(int index, int32_t components, void* buffer, int32_t size
+        , TY_FRAME_DATA& frame) const
+{
+    const RecFrameHeader* h = record(index);
+    if(!h || !buffer){
+        return false;
+    }
+
+    memset(&frame, 0, sizeof(frame));
+    frame.userBuffer = buffer;
+    frame.bufferSize = size;
+    size_t offset = 0;
+    int n = 0;
+    for(int i = 0; i < h->validCount; i++){
+        const RecImage& r = h->image[i];
+        if(!(r.componentID & components)){
+            continue;
+        }
+        if(offset + r.size > (size_t)size){
+            return false;
+        }
+        TY_IMAGE_DATA& img = frame.image[n++];
+        img.timestamp = r.timestamp;
+        img.imageIndex = r.imageIndex;
+        img.status = r.status;
+        img.componentID = r.componentID;
+        img.size = r.size;
+        img.buffer = (uint8_t*)buffer + offset;
+        img.width = r.width;
+        img.height = r.height;
+        img.pixelFormat = r.pixelFormat;
+        const uint8_t* payload = (const uint8_t*)h + r.offset;
+        if(!r.codedSize){
+            memcpy(img.buffer, payload, r.size);
+        } else if((int64_t)r.width * r.height * 2 > r.size
+                || !decodeDepth16(payload, r.codedSize, (uint16_t*)img.buffer
+                        , r.width, r.height, r.width)){
+            return false;
+        }
+        offset += roundUp(r.size, 64);
+    }
+    frame.validCount = n;
+    return true;
+}
+
+
+int32_t FrameRecordReader::unpackedSize(int index) const
+{
+    const RecFrameHeader* h = record(index);
+    if(!h){
+        return 0;
+    }
+    size_t size = 0;
+    for(int i = 0; i < h->validCount; i++){
+        size += roundUp(h->image[i].size, 64);
+    }
+    return (int32_t)size;
+}
+
+
+int FrameRecordReader::seek(uint64_t ts) const
+{
+    int lo = 0;
+    int hi = (int)_index.size();
+    while(lo < hi){
+        int mid = (lo + hi) / 2;
+        if(_index[mid].timestamp < ts){
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+
+const void* FrameRecordReader::findStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature
+        , int32_t* size) const
+{
+    size_t off = roundUp(sizeof(RecFileHeader), 8);
+    for(int i = 0; i < _header.structCount; i++){
+        if(off + sizeof(RecStructHeader) > kPage){
+            break;
+        }
+        const RecStructHeader* h = (const RecStructHeader*)(_data + off);
+        // the structs all live in the header page
+        if(h->size < 0 || (size_t)h->size > kPage - off - sizeof(RecStructHeader)){
+            break;
+        }
+        if(h->componentID == comp && h->featureID == feature){
+            if(size){
+                *size = h->size;
+            }
+            return h + 1;
+        }
+        off += sizeof(RecStructHeader) + roundUp(h->size, 8);
+    }
+    return NULL;
+}
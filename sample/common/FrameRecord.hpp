@@ -0,0 +1,226 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_FRAME_RECORD_HPP_
+#define PERCIPIO_SAMPLE_COMMON_FRAME_RECORD_HPP_
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "TY_API.h"
+
+// Raw frame recording, little endian:
+//
+//   page 0     RecFileHeader, then calibration structs (RecStructHeader
+//              followed by the struct, 8 byte aligned)
+//   records    one per frame, page aligned: RecFrameHeader, then each
+//              image payload on its own page boundary, DEPTH16 payloads
+//              raw or coded with encodeDepth16() (DepthCodec.hpp)
+//   index      frameCount RecIndexEntry, written on close
+//
+// A file that was not closed has indexOffset 0, the reader then rebuilds
+// the index by walking the records.
+
+#define TY_RECORD_MAGIC         "TYREC01"
+#define TY_RECORD_VERSION       2           // layout of the structs below, 2 added RecImage::codedSize
+#define TY_RECORD_FRAME_MAGIC   0x52465954  // "TYFR"
+#define TY_RECORD_PAGE          4096
+
+struct RecFileHeader {
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    pageSize;
+    uint64_t    indexOffset;    ///< 0 until the writer is closed
+    uint64_t    frameCount;
+    int32_t     bufferSize;     ///< largest TY_FRAME_DATA::bufferSize recorded
+    int32_t     structCount;
+    char        deviceId[32];
+    int32_t     reserved[8];
+};
+
+struct RecStructHeader {
+    int32_t     componentID;
+    int32_t     featureID;
+    int32_t     size;
+    int32_t     reserved;
+};
+
+struct RecImage {
+    uint64_t    timestamp;
+    int32_t     imageIndex;
+    int32_t     status;
+    int32_t     componentID;
+    int32_t     size;
+    int32_t     width;
+    int32_t     height;
+    int32_t     pixelFormat;
+    uint32_t    offset;         ///< payload offset from the record start
+    uint32_t    codedSize;      ///< coded DEPTH16 payload size, 0 if raw
+    int32_t     reserved;
+};
+
+struct RecFrameHeader {
+    uint32_t    magic;
+    uint32_t    recordSize;     ///< header and payloads, page multiple
+    int32_t     validCount;
+    int32_t     bufferSize;
+    uint64_t    frameIndex;
+    uint64_t    hostTimeUs;
+    RecImage    image[10];
+};
+
+struct RecIndexEntry {
+    uint64_t    offset;
+    uint64_t    timestamp;      ///< of the first image
+    uint32_t    recordSize;
+    int32_t     reserved;
+};
+
+
+/// Records frames into one file. write() only copies the frame into a
+/// staging chunk, so the capture buffer can be re-enqueued right away; a
+/// writer thread stores full chunks with large sequential writes, with
+/// O_DIRECT (FILE_FLAG_NO_BUFFERING on windows) when the file system
+/// allows it. If the disk falls behind and all chunks are full, frames are
+/// dropped and counted instead of blocking the caller.
+class FrameRecordWriter
+{
+public:
+    struct Stats {
+        uint64_t    frames;     ///< frames accepted
+        uint64_t    dropped;    ///< frames dropped, no free chunk
+        uint64_t    bytes;      ///< bytes written to disk
+        uint64_t    errors;     ///< failed writes
+        int         maxQueued;  ///< most chunks waiting for the disk
+    };
+
+    FrameRecordWriter();
+    /// closes the file
+    ~FrameRecordWriter();
+
+    /// Create path. chunkMB is the size of one disk write, chunks the
+    /// number of staging buffers.
+    bool open(const char* path, bool direct = true, int chunkMB = 16, int chunks = 4);
+    bool isOpen() const { return _fd != INVALID_FD; }
+    /// false if open fell back to buffered io
+    bool isDirect() const { return _direct; }
+
+    // Stored in the file header, only before the first write().
+    void setDeviceId(const char* id);
+    bool addStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature, const void* data, int32_t size);
+    /// intrinsics, distortion and extrinsics of all components of hDevice
+    int addCalibration(TY_DEV_HANDLE hDevice);
+    /// Code DEPTH16 images losslessly, about a third of the disk bandwidth
+    /// for the encode time in write().
+    void setDepthCoding(bool on) { _depthCoding = on; }
+
+    /// Copy (or code) frame into the staging chunk, never waits for the
+    /// disk. false if the frame was dropped. Calls are serialized.
+    bool write(const TY_FRAME_DATA& frame);
+
+    /// Flush, write the index and the final header.
+    bool close();
+
+    Stats stats() const;
+
+private:
+    FrameRecordWriter(const FrameRecordWriter&);
+    FrameRecordWriter& operator=(const FrameRecordWriter&);
+
+#ifdef _WIN32
+    typedef void* FileHandle;
+    static FileHandle const INVALID_FD;
+#else
+    typedef int FileHandle;
+    enum { INVALID_FD = -1 };
+#endif
+
+    struct Chunk {
+        uint8_t*    data;
+        size_t      capacity;
+        size_t      fill;
+    };
+
+    bool nextChunk(size_t need);
+    void writerLoop();
+    bool writeAt(const void* data, size_t size, int64_t offset);
+    void buildHeader(uint8_t* page);
+
+    FileHandle              _fd;
+    bool                    _direct;
+    size_t                  _chunkSize;
+    std::vector<Chunk>      _chunks;
+    std::vector<int>        _free;
+    std::vector<int>        _full;      // FIFO, front is next to write
+    int                     _current;   // chunk being filled, -1 none
+    uint64_t                _fileOffset;    // end of the data handed to the writer
+    std::vector<uint8_t>    _structs;
+    int32_t                 _structCount;
+    char                    _deviceId[32];
+    int32_t                 _bufferSize;
+    std::vector<RecIndexEntry> _index;
+    bool                    _started;   // header emitted
+    bool                    _depthCoding;
+    std::vector<uint8_t>    _coded;     // coded depth of the frame being written
+
+    mutable std::mutex      _writeLock; // serializes write()
+    mutable std::mutex      _lock;
+    std::condition_variable _wake;
+    std::thread             _thread;
+    bool                    _exit;
+    uint64_t                _dropped;
+    std::atomic<uint64_t>   _bytes;
+    std::atomic<uint64_t>   _errors;
+    int                     _maxQueued;
+};
+
+
+/// Memory maps a recording for random access. Frames are returned as
+/// TY_FRAME_DATA whose image buffers point into the mapping, no copy;
+/// unpack() copies them out and decodes coded depth.
+class FrameRecordReader
+{
+public:
+    FrameRecordReader();
+    ~FrameRecordReader();
+
+    bool open(const char* path);
+    void close();
+    bool isOpen() const { return _data != NULL; }
+
+    int frameCount() const { return (int)_index.size(); }
+    int32_t bufferSize() const { return _header.bufferSize; }
+    const char* deviceId() const { return _header.deviceId; }
+
+    /// Fill frame with the images of record index, valid until close().
+    /// userBuffer points to the record, bufferSize is its size. Coded
+    /// depth images have a NULL buffer, see unpack().
+    bool frame(int index, TY_FRAME_DATA& frame) const;
+    /// Copy the images of components in record index to buffer, 64 byte
+    /// aligned like a camera frame, decoding coded depth.
+    bool unpack(int index, int32_t components, void* buffer, int32_t size, TY_FRAME_DATA& frame) const;
+    /// buffer size unpack() needs for all components of record index
+    int32_t unpackedSize(int index) const;
+    uint64_t timestamp(int index) const { return _index[index].timestamp; }
+    /// first frame with a timestamp >= ts, frameCount() if none
+    int seek(uint64_t ts) const;
+
+    /// calibration struct stored by the writer, NULL if missing
+    const void* findStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature, int32_t* size = NULL) const;
+
+private:
+    FrameRecordReader(const FrameRecordReader&);
+    FrameRecordReader& operator=(const FrameRecordReader&);
+
+    bool loadIndex();
+    const RecFrameHeader* record(int index) const;
+
+    const uint8_t*              _data;
+    size_t                      _size;
+    void*                       _mapping;   // windows mapping handle
+    RecFileHeader               _header;
+    std::vector<RecIndexEntry>  _index;
+};
+
+
+#endif
@@ -0,0 +1,159 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_FRAME_VIEW_HPP_
+#define PERCIPIO_SAMPLE_COMMON_FRAME_VIEW_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <string.h>
+#include "TY_API.h"
+#include "BayerDemosaic.hpp"
+#include "YuvConvert.hpp"
+
+/// Convert a color image of any TY_PIXEL_FORMAT to BGR into dst, reusing
+/// its buffer when the size matches. downscale (1, 2 or 4) is folded into
+/// the conversion where the format allows it.
+static inline void colorImageToBGR(const TY_IMAGE_DATA& image, cv::Mat& dst
+        , int downscale = 1)
+{
+    int scaled = 1;     // downscale done by the conversion itself
+    if (image.pixelFormat == TY_PIXEL_FORMAT_YVYU
+            || image.pixelFormat == TY_PIXEL_FORMAT_YUYV){
+        if(yuv422ToBGR((const uint8_t*)image.buffer, image.width, image.height
+                    , image.pixelFormat, dst, downscale)){
+            scaled = downscale;
+        } else {
+            yuv422ToBGR((const uint8_t*)image.buffer, image.width, image.height
+                    , image.pixelFormat, dst);
+        }
+    } else if (image.pixelFormat == TY_PIXEL_FORMAT_JPEG){
+        cv::Mat jpeg(image.height, image.width, CV_8UC1, image.buffer);
+        cv::imdecode(jpeg, CV_LOAD_IMAGE_COLOR, &dst);
+    } else if(image.pixelFormat == TY_PIXEL_FORMAT_RGB){
+        cv::Mat rgb(image.height, image.width, CV_8UC3, image.buffer);
+        cv::cvtColor(rgb, dst, cv::COLOR_RGB2BGR);
+    } else if(image.pixelFormat == TY_PIXEL_FORMAT_MONO){
+        cv::Mat gray(image.height, image.width, CV_8U, image.buffer);
+        cv::cvtColor(gray, dst, cv::COLOR_GRAY2BGR);
+    } else if(image.pixelFormat == TY_PIXEL_FORMAT_BAYER8GB){
+        // 2x2 binning is both the demosaic and the first 2x
+        BayerDemosaicMode mode = downscale > 1 ? BAYER_BIN_2X2 : BAYER_BILINEAR;
+        bayer8GBToBGR((const uint8_t*)image.buffer, image.width, image.height, dst, mode);
+        scaled = mode == BAYER_BIN_2X2 ? 2 : 1;
+    } else {
+        // not left with a reused buffer's last image
+        dst.release();
+    }
+    if(downscale > scaled && !dst.empty()){
+        cv::resize(dst, dst, yuv422ScaledSize(image.width, image.height, downscale)
+                , 0, 0, cv::INTER_AREA);
+    }
+}
+
+
+/// Index of a TY_FRAME_DATA: the image slots are looked up once per frame
+/// and each component is then found with a table lookup. Views share the
+/// frame buffer, so they are only valid until it is re-enqueued. Keep one
+/// FrameView across frames to reuse the color buffer.
+class FrameView
+{
+public:
+    FrameView() : _frame(NULL), _colorScale(0) {
+                memset(_slot, -1, sizeof(_slot));
+            }
+    explicit FrameView(const TY_FRAME_DATA& frame) : _frame(NULL), _colorScale(0) {
+                reset(frame);
+            }
+
+    /// index a new frame, the decoded color of the previous one is dropped
+    void reset(const TY_FRAME_DATA& frame){
+                _frame = &frame;
+                _colorScale = 0;
+                memset(_slot, -1, sizeof(_slot));
+                for(int i = 0; i < frame.validCount && i < 10; i++){
+                    int bit = bitIndex(frame.image[i].componentID);
+                    if(bit >= 0 && _slot[bit] < 0){
+                        _slot[bit] = (int8_t)i;
+                    }
+                }
+            }
+
+    const TY_FRAME_DATA* frame() const { return _frame; }
+
+    /// NULL if comp is not in the frame
+    const TY_IMAGE_DATA* image(TY_COMPONENT_ID comp) const {
+                int bit = bitIndex(comp);
+                if(bit < 0 || _slot[bit] < 0){
+                    return NULL;
+                }
+                return &_frame->image[(int)_slot[bit]];
+            }
+    bool has(TY_COMPONENT_ID comp) const { return image(comp) != NULL; }
+
+    // Zero copy views, empty if the component is missing or has another
+    // pixel format.
+
+    /// CV_16U depth
+    cv::Mat depth16() const {
+                return view(TY_COMPONENT_DEPTH_CAM, TY_PIXEL_FORMAT_DEPTH16, CV_16U);
+            }
+    /// CV_8U IR or mono color
+    cv::Mat mono8(TY_COMPONENT_ID comp) const {
+                return view(comp, TY_PIXEL_FORMAT_MONO, CV_8U);
+            }
+    /// CV_8UC2 packed YUYV or YVYU color
+    cv::Mat yuyv() const {
+                const TY_IMAGE_DATA* img = image(TY_COMPONENT_RGB_CAM);
+                if(!img || (img->pixelFormat != TY_PIXEL_FORMAT_YUYV
+                            && img->pixelFormat != TY_PIXEL_FORMAT_YVYU)){
+                    return cv::Mat();
+                }
+                return cv::Mat(img->height, img->width, CV_8UC2, img->buffer);
+            }
+    /// CV_32FC3 point cloud
+    cv::Mat point3f() const {
+                return view(TY_COMPONENT_POINT3D_CAM, TY_PIXEL_FORMAT_FPOINT3D, CV_32FC3);
+            }
+
+    /// Color as BGR, converted on the first call for this frame and cached
+    /// until the next reset. Empty if the frame has no color.
+    const cv::Mat& colorBGR(int downscale = 1){
+                const TY_IMAGE_DATA* img = image(TY_COMPONENT_RGB_CAM);
+                if(!img){
+                    _empty.release();
+                    return _empty;
+                }
+                if(_colorScale != downscale){
+                    colorImageToBGR(*img, _color, downscale);
+                    _colorScale = downscale;
+                }
+                return _color;
+            }
+
+private:
+    static int bitIndex(int32_t comp){
+                uint32_t v = (uint32_t)comp;
+                if(v == 0 || (v & (v - 1)) != 0){
+                    return -1;
+                }
+                int i = 0;
+                while(v >>= 1){
+                    i++;
+                }
+                return i;
+            }
+
+    cv::Mat view(TY_COMPONENT_ID comp, TY_PIXEL_FORMAT fmt, int type) const {
+                const TY_IMAGE_DATA* img = image(comp);
+                if(!img || img->pixelFormat != fmt){
+                    return cv::Mat();
+                }
+                return cv::Mat(img->height, img->width, type, img->buffer);
+            }
+
+    const TY_FRAME_DATA*    _frame;
+    int8_t                  _slot[32];
+    cv::Mat                 _color;
+    cv::Mat                 _empty;
+    int                     _colorScale;
+};
+
+
+#endif
@@ -0,0 +1,159 @@
+#include "FramesetSync.hpp"
+#include "Clock.hpp"
+
+
+FramesetSync::FramesetSync(int devices, MatchKey key, int64_t tolerance, int depth, int timeoutMs)
+    : _devices(devices)
+    , _key(key)
+    , _tolerance(tolerance)
+    , _timeoutMs(timeoutMs)
+    , _autoAlign(false)
+    , _aligned(false)
+{
+    if(depth < 1){
+        depth = 1;
+    }
+    for(size_t i = 0; i < _devices.size(); i++){
+        _devices[i].ring.resize(depth);
+        _devices[i].head = 0;
+        _devices[i].count = 0;
+        _devices[i].offset = 0;
+    }
+    _stats.sets = 0;
+    _stats.unmatched = 0;
+    _stats.overflow = 0;
+    _stats.timedOut = 0;
+}
+
+
+int64_t FramesetSync::frameKey(const TY_FRAME_DATA& frame, MatchKey key)
+{
+    if(frame.validCount <= 0){
+        return 0;
+    }
+    const TY_IMAGE_DATA& img = frame.image[0];
+    return key == MATCH_INDEX ? (int64_t)img.imageIndex : (int64_t)img.timestamp;
+}
+
+
+int64_t FramesetSync::frameKey(const Frame& frame, MatchKey key)
+{
+    if(key != MATCH_HOST_TIME){
+        return frameKey(frame.data(), key);
+    }
+    int64_t device = frameKey(frame.data(), MATCH_TIMESTAMP);
+    if(!frame.pool()){
+        return device;
+    }
+    DeviceClock::Fit fit = frame.pool()->clockFit();
+    return fit.valid() ? fit.toHostNs(device) / 1000 : device;
+}
+
+
+bool FramesetSync::push(int device, const Frame& frame, std::vector<Frame>& set)
+{
+    if(device < 0 || device >= (int)_devices.size() || frame.empty()){
+        return false;
+    }
+    expire();
+
+    Device& dev = _devices[device];
+    int size = (int)dev.ring.size();
+    if(dev.count == size){
+        popFront(dev);
+        _stats.overflow++;
+    }
+    Pending& p = dev.ring[(dev.head + dev.count) % size];
+    p.frame = frame;
+    p.key = frameKey(frame, _key);
+    p.arrivedMs = monotonicMs();
+    dev.count++;
+
+    return match(set);
+}
+
+
+bool FramesetSync::match(std::vector<Frame>& set)
+{
+    while(true){
+        // every device needs a candidate
+        int64_t pivot = 0;
+        for(size_t i = 0; i < _devices.size(); i++){
+            if(_devices[i].count == 0){
+                return false;
+            }
+        }
+
+        if(_autoAlign && !_aligned){
+            for(size_t i = 1; i < _devices.size(); i++){
+                _devices[i].offset = front(_devices[0]).key - front(_devices[i]).key;
+            }
+            _devices[0].offset = 0;
+            _aligned = true;
+        }
+
+        // the latest head decides: heads too old for it are too old for
+        // any later set as well
+        for(size_t i = 0; i < _devices.size(); i++){
+            int64_t k = front(_devices[i]).key + _devices[i].offset;
+            if(i == 0 || k > pivot){
+                pivot = k;
+            }
+        }
+        bool dropped = false;
+        for(size_t i = 0; i < _devices.size(); i++){
+            Device& dev = _devices[i];
+            if(front(dev).key + dev.offset < pivot - _tolerance){
+                popFront(dev);
+                _stats.unmatched++;
+                dropped = true;
+            }
+        }
+        if(dropped){
+            continue;
+        }
+
+        set.resize(_devices.size());
+        for(size_t i = 0; i < _devices.size(); i++){
+            set[i] = front(_devices[i]).frame;
+            popFront(_devices[i]);
+        }
+        _stats.sets++;
+        return true;
+    }
+}
+
+
+void FramesetSync::expire()
+{
+    if(_timeoutMs < 0){
+        return;
+    }
+    double limit = monotonicMs() - _timeoutMs;
+    for(size_t i = 0; i < _devices.size(); i++){
+        Device& dev = _devices[i];
+        while(dev.count > 0 && front(dev).arrivedMs < limit){
+            popFront(dev);
+            _stats.timedOut++;
+        }
+    }
+}
+
+
+void FramesetSync::clear()
+{
+    for(size_t i = 0; i < _devices.size(); i++){
+        while(_devices[i].count > 0){
+            popFront(_devices[i]);
+        }
+    }
+    _aligned = false;
+}
+
+
+void FramesetSync::popFront(Device& dev)
+{
+    front(dev).frame.release();
+    dev.head = (dev.head + 1) % (int)dev.ring.size();
+    dev.count--;
+}
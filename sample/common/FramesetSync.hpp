@@ -0,0 +1,95 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_FRAMESET_SYNC_HPP_
+#define PERCIPIO_SAMPLE_COMMON_FRAMESET_SYNC_HPP_
+
+#include <stdint.h>
+#include <vector>
+#include "FrameBufferPool.hpp"
+
+/// Groups frames of several triggered devices into framesets, one frame
+/// per device. Each device keeps a short queue of pending frames; a set is
+/// emitted as soon as every device has a frame whose key (timestamp or
+/// image index, plus a per device offset) is within the tolerance of the
+/// latest one. Frames that can no longer be part of a set, that overflow
+/// their queue or that wait longer than the timeout are released and
+/// counted. Not thread safe, feed it from one consumer thread, e.g. from
+/// MultiDeviceCapture::next().
+class FramesetSync
+{
+public:
+    enum MatchKey {
+        MATCH_TIMESTAMP,    ///< TY_IMAGE_DATA::timestamp, microseconds
+        MATCH_INDEX,        ///< TY_IMAGE_DATA::imageIndex, trigger count
+        MATCH_HOST_TIME,    ///< timestamp on the host clock through the
+                            ///< FrameBufferPool::clockFit() of the frame,
+                            ///< microseconds; follows the drift of devices
+    };
+
+    struct Stats {
+        uint64_t    sets;       ///< complete framesets emitted
+        uint64_t    unmatched;  ///< frames older than any possible set
+        uint64_t    overflow;   ///< frames dropped from a full device queue
+        uint64_t    timedOut;   ///< frames dropped by the timeout
+    };
+
+    /// tolerance is in key units, depth is the pending frames per device
+    FramesetSync(int devices, MatchKey key = MATCH_TIMESTAMP, int64_t tolerance = 5000
+            , int depth = 4, int timeoutMs = 1000);
+
+    int deviceCount() const { return (int)_devices.size(); }
+
+    /// Key offset added to the frames of device, to line up clocks or
+    /// trigger counters of different devices.
+    void setOffset(int device, int64_t offset) { _devices[device].offset = offset; }
+    int64_t offset(int device) const { return _devices[device].offset; }
+
+    /// When on, the first frame of every device after the last clear() is
+    /// taken as one set and the offsets are set to line them up with device
+    /// 0. Only valid if all devices run before the first trigger.
+    void setAutoAlign(bool on) { _autoAlign = on; _aligned = false; }
+
+    /// Add a frame of device. Returns true if it completed a set, which is
+    /// then stored in set, indexed by device.
+    bool push(int device, const Frame& frame, std::vector<Frame>& set);
+
+    /// Release pending frames that waited longer than the timeout. push()
+    /// does this too, call it when no frames arrive.
+    void expire();
+
+    /// release all pending frames
+    void clear();
+
+    Stats stats() const { return _stats; }
+
+    /// key of a frame without offset, timestamp or index of its first image
+    static int64_t frameKey(const TY_FRAME_DATA& frame, MatchKey key);
+    static int64_t frameKey(const Frame& frame, MatchKey key);
+
+private:
+    struct Pending {
+        Frame       frame;
+        int64_t     key;
+        double      arrivedMs;
+    };
+
+    struct Device {
+        std::vector<Pending>    ring;
+        int                     head;
+        int                     count;
+        int64_t                 offset;
+    };
+
+    Pending& front(Device& dev) { return dev.ring[dev.head]; }
+    void popFront(Device& dev);
+    bool match(std::vector<Frame>& set);
+
+    std::vector<Device>     _devices;
+    MatchKey                _key;
+    int64_t                 _tolerance;
+    int                     _timeoutMs;
+    bool                    _autoAlign;
+    bool                    _aligned;
+    Stats                   _stats;
+};
+
+
+#endif
@@ -0,0 +1,345 @@
+#include "JpegDecoder.hpp"
+#include <chrono>
+#include <string.h>
+
+#ifdef HAVE_LIBJPEG
+#include <setjmp.h>
+#include <stdio.h>
+extern "C" {
+#include <jpeglib.h>
+}
+#endif
+
+
+#ifdef HAVE_LIBJPEG
+
+struct JpegDecoder::Impl
+{
+    struct ErrorManager {
+        jpeg_error_mgr  pub;
+        jmp_buf         jump;
+    };
+
+    jpeg_decompress_struct  cinfo;
+    ErrorManager            err;
+    jpeg_source_mgr         src;
+
+    Impl() {
+        cinfo.err = jpeg_std_error(&err.pub);
+        err.pub.error_exit = errorExit;
+        err.pub.output_message = outputMessage;
+        jpeg_create_decompress(&cinfo);
+
+        // memory source, jpeg_mem_src is missing in older libjpeg
+        src.init_source = initSource;
+        src.fill_input_buffer = fillInputBuffer;
+        src.skip_input_data = skipInputData;
+        src.resync_to_restart = jpeg_resync_to_restart;
+        src.term_source = termSource;
+        src.next_input_byte = NULL;
+        src.bytes_in_buffer = 0;
+        cinfo.src = &src;
+    }
+    ~Impl() {
+        jpeg_destroy_decompress(&cinfo);
+    }
+
+    static void errorExit(j_common_ptr cinfo) {
+        longjmp(((ErrorManager*)cinfo->err)->jump, 1);
+    }
+    static void outputMessage(j_common_ptr) {
+        // corrupt data warnings would flood the log at camera frame rate
+    }
+    static void initSource(j_decompress_ptr) {}
+    static void termSource(j_decompress_ptr) {}
+    static boolean fillInputBuffer(j_decompress_ptr cinfo) {
+        // truncated stream, end it with a fake EOI like libjpeg does
+        static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+        cinfo->src->next_input_byte = eoi;
+        cinfo->src->bytes_in_buffer = 2;
+        return TRUE;
+    }
+    static void skipInputData(j_decompress_ptr cinfo, long n) {
+        if(n <= 0){
+            return;
+        }
+        if((size_t)n > cinfo->src->bytes_in_buffer){
+            fillInputBuffer(cinfo);
+            return;
+        }
+        cinfo->src->next_input_byte += n;
+        cinfo->src->bytes_in_buffer -= n;
+    }
+};
+
+#else
+
+struct JpegDecoder::Impl
+{
+    cv::Mat full;   // full size decode when imdecode can not reduce
+};
+
+#endif
+
+
+JpegDecoder::JpegDecoder()
+    : _impl(new Impl)
+    , _scale(1)
+{
+}
+
+
+JpegDecoder::~JpegDecoder()
+{
+    delete _impl;
+}
+
+
+void JpegDecoder::setScale(int denom)
+{
+    _scale = (denom == 2 || denom == 4 || denom == 8) ? denom : 1;
+}
+
+
+int JpegDecoder::scaleFor(int width, int height, const cv::Size& target)
+{
+    for(int denom = 8; denom > 1; denom /= 2){
+        if((width + denom - 1) / denom >= target.width
+                && (height + denom - 1) / denom >= target.height){
+            return denom;
+        }
+    }
+    return 1;
+}
+
+
+#ifdef HAVE_LIBJPEG
+
+bool JpegDecoder::decode(const uint8_t* data, size_t size, cv::Mat& dst)
+{
+    jpeg_decompress_struct& cinfo = _impl->cinfo;
+    if(setjmp(_impl->err.jump)){
+        jpeg_abort_decompress(&cinfo);
+        return false;
+    }
+
+    _impl->src.next_input_byte = data;
+    _impl->src.bytes_in_buffer = size;
+    jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+    cinfo.out_color_space = JCS_EXT_BGR;
+#else
+    cinfo.out_color_space = JCS_RGB;
+#endif
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = _scale;
+    jpeg_start_decompress(&cinfo);
+
+    dst.create(cinfo.output_height, cinfo.output_width, CV_8UC3);
+    while(cinfo.output_scanline < cinfo.output_height){
+        JSAMPROW row = dst.ptr<uint8_t>(cinfo.output_scanline);
+        jpeg_read_scanlines(&cinfo, &row, 1);
+#ifndef JCS_EXTENSIONS
+        for(int x = 0; x < dst.cols; x++){
+            uint8_t t = row[x * 3];
+            row[x * 3] = row[x * 3 + 2];
+            row[x * 3 + 2] = t;
+        }
+#endif
+    }
+    jpeg_finish_decompress(&cinfo);
+    return true;
+}
+
+#else
+
+bool JpegDecoder::decode(const uint8_t* data, size_t size, cv::Mat& dst)
+{
+    cv::Mat buf(1, (int)size, CV_8UC1, (void*)data);
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+    int flags = cv::IMREAD_COLOR;
+    switch(_scale){
+        case 2: flags = cv::IMREAD_REDUCED_COLOR_2; break;
+        case 4: flags = cv::IMREAD_REDUCED_COLOR_4; break;
+        case 8: flags = cv::IMREAD_REDUCED_COLOR_8; break;
+    }
+    return !cv::imdecode(buf, flags, &dst).empty();
+#else
+    if(_scale == 1){
+        return !cv::imdecode(buf, CV_LOAD_IMAGE_COLOR, &dst).empty();
+    }
+    if(cv::imdecode(buf, CV_LOAD_IMAGE_COLOR, &_impl->full).empty()){
+        return false;
+    }
+    cv::resize(_impl->full, dst
+            , cv::Size((_impl->full.cols + _scale - 1) / _scale
+                , (_impl->full.rows + _scale - 1) / _scale)
+            , 0, 0, cv::INTER_AREA);
+    return true;
+#endif
+}
+
+#endif
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+JpegDecodeQueue::JpegDecodeQueue(int workers, int depth)
+    : _head(0)
+    , _next(0)
+    , _tail(0)
+    , _scale(1)
+    , _dropped(0)
+    , _failed(0)
+    , _exit(false)
+{
+    if(workers <= 0){
+        workers = 1;
+    }
+    if(depth <= 0){
+        depth = workers * 2;
+    }
+    _slots.resize(depth);
+    for(int i = 0; i < depth; i++){
+        _slots[i].state = SLOT_FREE;
+        _slots[i].ok = false;
+        _slots[i].scale = 1;
+        memset(&_slots[i].info, 0, sizeof(_slots[i].info));
+    }
+    for(int i = 0; i < workers; i++){
+        _workers.push_back(std::thread(&JpegDecodeQueue::workerLoop, this));
+    }
+}
+
+
+JpegDecodeQueue::~JpegDecodeQueue()
+{
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _exit = true;
+    }
+    _work.notify_all();
+    for(size_t i = 0; i < _workers.size(); i++){
+        _workers[i].join();
+    }
+}
+
+
+void JpegDecodeQueue::setScale(int denom)
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _scale = denom;
+}
+
+
+bool JpegDecodeQueue::push(const TY_IMAGE_DATA& image)
+{
+    Slot* slot;
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        slot = &_slots[_head];
+        if(slot->state != SLOT_FREE){
+            _dropped++;
+            return false;
+        }
+        slot->state = SLOT_FILLING;
+        slot->scale = _scale;
+        _head = (_head + 1) % (int)_slots.size();
+    }
+
+    // copy outside the lock, the slot is ours until it is marked queued
+    const uint8_t* bits = (const uint8_t*)image.buffer;
+    slot->bits.assign(bits, bits + image.size);
+    slot->info = image;
+    slot->info.buffer = NULL;
+
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        slot->state = SLOT_QUEUED;
+    }
+    _work.notify_all();
+    return true;
+}
+
+
+bool JpegDecodeQueue::pop(cv::Mat& bgr, int timeoutMs, TY_IMAGE_DATA* info)
+{
+    std::unique_lock<std::mutex> lk(_lock);
+    Slot& slot = _slots[_tail];
+    if(timeoutMs < 0){
+        while(slot.state != SLOT_DONE){
+            _ready.wait(lk);
+        }
+    } else {
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now()
+                + std::chrono::milliseconds(timeoutMs);
+        while(slot.state != SLOT_DONE){
+            if(_ready.wait_until(lk, deadline) == std::cv_status::timeout
+                    && slot.state != SLOT_DONE){
+                return false;
+            }
+        }
+    }
+
+    bool ok = slot.ok;
+    if(ok){
+        cv::swap(bgr, slot.bgr);
+        if(info){
+            *info = slot.info;
+            info->width = bgr.cols;
+            info->height = bgr.rows;
+        }
+    } else {
+        _failed++;
+    }
+    slot.state = SLOT_FREE;
+    _tail = (_tail + 1) % (int)_slots.size();
+    return ok;
+}
+
+
+int JpegDecodeQueue::dropped() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    return _dropped;
+}
+
+
+int JpegDecodeQueue::failed() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    return _failed;
+}
+
+
+void JpegDecodeQueue::workerLoop()
+{
+    JpegDecoder decoder;
+    while(true){
+        Slot* slot;
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            while(!_exit && _slots[_next].state != SLOT_QUEUED){
+                _work.wait(lk);
+            }
+            if(_exit){
+                return;
+            }
+            slot = &_slots[_next];
+            slot->state = SLOT_DECODING;
+            _next = (_next + 1) % (int)_slots.size();
+        }
+
+        decoder.setScale(slot->scale);
+        bool ok = !slot->bits.empty()
+                && decoder.decode(&slot->bits[0], slot->bits.size(), slot->bgr);
+
+        {
+            std::lock_guard<std::mutex> lk(_lock);
+            slot->ok = ok;
+            slot->state = SLOT_DONE;
+        }
+        _ready.notify_all();
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_JPEG_DECODER_HPP_
+#define PERCIPIO_SAMPLE_COMMON_JPEG_DECODER_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "TY_API.h"
+
+/// Reusable JPEG decoder. Decoder state and the output image are kept
+/// between calls, and the image can be reduced by 1/2, 1/4 or 1/8 while
+/// decoding, which is much cheaper than a full size decode plus resize.
+/// Uses libjpeg when built with HAVE_LIBJPEG, cv::imdecode otherwise.
+class JpegDecoder
+{
+public:
+    JpegDecoder();
+    ~JpegDecoder();
+
+    /// reduction denominator: 1, 2, 4 or 8
+    void setScale(int denom);
+    int scale() const { return _scale; }
+
+    /// largest reduction whose output still covers target
+    static int scaleFor(int width, int height, const cv::Size& target);
+
+    /// Decode into dst as CV_8UC3 BGR, dst is only reallocated when the
+    /// output size changes. false if data is not a valid JPEG.
+    bool decode(const uint8_t* data, size_t size, cv::Mat& dst);
+
+private:
+    JpegDecoder(const JpegDecoder&);
+    JpegDecoder& operator=(const JpegDecoder&);
+
+    struct Impl;
+    Impl*   _impl;
+    int     _scale;
+};
+
+
+/// Decodes JPEG color off the capture thread. push() copies the bitstream
+/// so the frame buffer can be re-enqueued right away, worker threads decode
+/// in parallel and pop() hands the images back in push order. Slot buffers
+/// are recycled, nothing is allocated once image sizes are stable.
+class JpegDecodeQueue
+{
+public:
+    /// depth is the number of images in flight, 0 means two per worker
+    explicit JpegDecodeQueue(int workers = 1, int depth = 0);
+    ~JpegDecodeQueue();
+
+    /// reduction denominator for images pushed from now on
+    void setScale(int denom);
+
+    /// Queue a TY_PIXEL_FORMAT_JPEG image. When all slots are busy the
+    /// image is dropped and false returned.
+    bool push(const TY_IMAGE_DATA& image);
+
+    /// Wait up to timeoutMs (-1 forever) for the oldest pushed image and
+    /// swap it into bgr, so passing the same Mat every time recycles it.
+    /// info receives the image metadata with the decoded size. false on
+    /// timeout or if the image failed to decode.
+    bool pop(cv::Mat& bgr, int timeoutMs, TY_IMAGE_DATA* info = NULL);
+
+    /// images dropped by push / failed to decode so far
+    int dropped() const;
+    int failed() const;
+
+private:
+    JpegDecodeQueue(const JpegDecodeQueue&);
+    JpegDecodeQueue& operator=(const JpegDecodeQueue&);
+
+    enum SlotState { SLOT_FREE, SLOT_FILLING, SLOT_QUEUED, SLOT_DECODING, SLOT_DONE };
+    struct Slot {
+        SlotState               state;
+        bool                    ok;
+        int                     scale;
+        std::vector<uint8_t>    bits;
+        TY_IMAGE_DATA           info;
+        cv::Mat                 bgr;
+    };
+
+    void workerLoop();
+
+    std::vector<Slot>           _slots;
+    std::vector<std::thread>    _workers;
+    mutable std::mutex          _lock;
+    std::condition_variable     _work;
+    std::condition_variable     _ready;
+    int                         _head;
+    int                         _next;
+    int                         _tail;
+    int                         _scale;
+    int                         _dropped;
+    int                         _failed;
+    bool                        _exit;
+};
+
+
+#endif
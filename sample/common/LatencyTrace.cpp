@@ -0,0 +1,219 @@
+#include "LatencyTrace.hpp"
+#include <string.h>
+#include <thread>
+
+static int highBit(uint64_t v)
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll(v);
+#else
+    int n = 0;
+    while(v >>= 1){
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+int LatencyHistogram::bucketOf(int64_t ns)
+{
+    if(ns < kSub){
+        return (int)ns;
+    }
+    // values with the top bit at b >= kSubBits keep kSubBits bits below it
+    int shift = highBit((uint64_t)ns) - kSubBits;
+    int bucket = (shift + 1) * kSub + (int)((ns >> shift) & (kSub - 1));
+    return bucket < kBuckets ? bucket : kBuckets - 1;
+}
+
+
+int64_t LatencyHistogram::bucketValue(int bucket)
+{
+    if(bucket < kSub){
+        return bucket;
+    }
+    int shift = bucket / kSub - 1;
+    int64_t base = (int64_t)(kSub + bucket % kSub) << shift;
+    return base + ((int64_t)1 << shift) - 1;
+}
+
+
+void LatencyHistogram::snapshot(Snapshot& out, bool clear)
+{
+    out.total = 0;
+    for(int i = 0; i < kBuckets; i++){
+        out.counts[i] = clear ? _counts[i].exchange(0, std::memory_order_relaxed)
+                : _counts[i].load(std::memory_order_relaxed);
+        out.total += out.counts[i];
+    }
+    out.max = clear ? _max.exchange(0, std::memory_order_relaxed)
+            : _max.load(std::memory_order_relaxed);
+}
+
+
+void LatencyHistogram::reset()
+{
+    for(int i = 0; i < kBuckets; i++){
+        _counts[i].store(0, std::memory_order_relaxed);
+    }
+    _max.store(0, std::memory_order_relaxed);
+}
+
+
+int64_t LatencyHistogram::Snapshot::percentile(double p) const
+{
+    if(total == 0){
+        return 0;
+    }
+    uint64_t rank = (uint64_t)(p * total + 0.5);
+    if(rank < 1){
+        rank = 1;
+    }
+    uint64_t seen = 0;
+    for(int i = 0; i < kBuckets; i++){
+        seen += counts[i];
+        if(seen >= rank){
+            // the bucket bound may be above the largest sample
+            int64_t v = bucketValue(i);
+            return v < max || max == 0 ? v : max;
+        }
+    }
+    return max;
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+LatencyTrace::LatencyTrace()
+    : _enabled(false)
+    , _fp(NULL)
+    , _periodNs(0)
+    , _nextReport(0)
+    , _reporting(false)
+    , _reportStart(0)
+{
+}
+
+
+LatencyTrace::~LatencyTrace()
+{
+    close();
+}
+
+
+bool LatencyTrace::open(const char* path, int periodMs)
+{
+    close();
+    if(path == NULL || strcmp(path, "-") == 0){
+        _fp = stdout;
+    } else {
+        _fp = fopen(path, "a");
+        if(!_fp){
+            return false;
+        }
+    }
+    for(int i = 0; i < STAGE_COUNT; i++){
+        _hist[i].reset();
+    }
+    _periodNs = (int64_t)periodMs * 1000000;
+    _reportStart = monotonicNs();
+    _nextReport.store(_periodNs > 0 ? _reportStart + _periodNs : INT64_MAX);
+    _enabled.store(true);
+    return true;
+}
+
+
+void LatencyTrace::close()
+{
+    if(!_enabled.exchange(false)){
+        return;
+    }
+    // a stamp may be in report() still, wait for it and keep later ones out
+    bool idle = false;
+    while(!_reporting.compare_exchange_weak(idle, true)){
+        idle = false;
+        std::this_thread::yield();
+    }
+    writeReport();
+    if(_fp != stdout){
+        fclose(_fp);
+    }
+    _fp = NULL;
+    _reporting.store(false);
+}
+
+
+void LatencyTrace::recordDevice(const TY_FRAME_DATA& frame, int64_t arrivalNs
+        , const DeviceClock::Fit& clock)
+{
+    if(frame.validCount <= 0){
+        return;
+    }
+    // the first frames only define the line
+    if(clock.points > 1){
+        record(STAGE_DEVICE, arrivalNs - clock.toHostNs((int64_t)frame.image[0].timestamp));
+    }
+}
+
+
+void LatencyTrace::poll(int64_t now)
+{
+    int64_t next = _nextReport.load(std::memory_order_relaxed);
+    if(now < next){
+        return;
+    }
+    int64_t following = now + _periodNs;
+    if(_nextReport.compare_exchange_strong(next, following)){
+        report();
+    }
+}
+
+
+void LatencyTrace::report()
+{
+    // a report taking longer than a period must not meet the next one
+    bool idle = false;
+    if(!_reporting.compare_exchange_strong(idle, true)){
+        return;
+    }
+    if(_fp){
+        writeReport();
+    }
+    _reporting.store(false);
+}
+
+
+void LatencyTrace::writeReport()
+{
+    int64_t now = monotonicNs();
+    fprintf(_fp, "latency over %.1fs, ms          n      p50      p99     p999      max\n"
+            , (now - _reportStart) / 1e9);
+    _reportStart = now;
+    for(int i = 0; i < STAGE_COUNT; i++){
+        _hist[i].snapshot(_snap, true);
+        if(_snap.total == 0){
+            continue;
+        }
+        fprintf(_fp, "  %-24s %8d %8.2f %8.2f %8.2f %8.2f\n", stageName((Stage)i), (int)_snap.total
+                , _snap.percentile(0.5) / 1e6, _snap.percentile(0.99) / 1e6
+                , _snap.percentile(0.999) / 1e6, _snap.max / 1e6);
+    }
+    fflush(_fp);
+}
+
+
+const char* LatencyTrace::stageName(Stage stage)
+{
+    switch(stage){
+        case STAGE_DEVICE:      return "device";
+        case STAGE_QUEUE:       return "queue";
+        case STAGE_PARSE:       return "parse";
+        case STAGE_UNDISTORT:   return "undistort";
+        case STAGE_REGISTER:    return "register";
+        case STAGE_RENDER:      return "render";
+        case STAGE_ENQUEUE:     return "enqueue";
+        case STAGE_TOTAL:       return "total";
+        default:                return "?";
+    }
+}
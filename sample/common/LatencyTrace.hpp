@@ -0,0 +1,178 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_LATENCY_TRACE_HPP_
+#define PERCIPIO_SAMPLE_COMMON_LATENCY_TRACE_HPP_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include "TY_API.h"
+#include "Clock.hpp"
+#include "FrameBufferPool.hpp"
+
+/// Log linear histogram of nanosecond durations, HDR style: every power of
+/// two is cut in 16 buckets, so percentiles are within 6% of the recorded
+/// values. record() is one relaxed atomic increment and may be called from
+/// any thread.
+class LatencyHistogram
+{
+public:
+    enum {
+        kSubBits    = 4,
+        kSub        = 1 << kSubBits,
+        kBuckets    = 44 * kSub,    ///< up to 2^47 ns, 39 hours
+    };
+
+    /// Counts of a histogram taken at one time.
+    struct Snapshot {
+        uint64_t    counts[kBuckets];
+        uint64_t    total;
+        int64_t     max;
+
+        /// value below which fraction p of the samples are, 0 if empty
+        int64_t percentile(double p) const;
+    };
+
+    LatencyHistogram() { reset(); }
+
+    void record(int64_t ns){
+                if(ns < 0){
+                    ns = 0;
+                }
+                _counts[bucketOf(ns)].fetch_add(1, std::memory_order_relaxed);
+                int64_t m = _max.load(std::memory_order_relaxed);
+                while(ns > m && !_max.compare_exchange_weak(m, ns, std::memory_order_relaxed)){
+                }
+            }
+
+    /// Copy the counts. With clear the histogram restarts empty; samples
+    /// recorded meanwhile land in this or the next snapshot, none is lost.
+    void snapshot(Snapshot& out, bool clear);
+    void reset();
+
+    static int bucketOf(int64_t ns);
+    /// largest value of bucket
+    static int64_t bucketValue(int bucket);
+
+private:
+    LatencyHistogram(const LatencyHistogram&);
+    LatencyHistogram& operator=(const LatencyHistogram&);
+
+    std::atomic<uint64_t>   _counts[kBuckets];
+    std::atomic<int64_t>    _max;
+};
+
+
+/// Per stage latency of a frame pipeline. A FrameTrace follows one frame
+/// and stamps it after each stage, the time since the previous stamp goes
+/// to the histogram of the stage. STAGE_DEVICE is the time from the device
+/// timestamp of the frame to its arrival, above the fastest transfer seen
+/// since the device clock is only known through the DeviceClock fit of
+/// the pool the frame came from;
+/// STAGE_TOTAL is arrival to the last stamp. Every period the percentiles
+/// of all stages are written to a file or stdout and the histograms
+/// restart.
+///
+/// A disabled trace does not read the clock, stamps cost one branch. One
+/// trace per device, stamps may come from any thread.
+class LatencyTrace
+{
+public:
+    enum Stage {
+        STAGE_DEVICE,       ///< device timestamp to fetch return
+        STAGE_QUEUE,        ///< fetch return to the consumer
+        STAGE_PARSE,
+        STAGE_UNDISTORT,
+        STAGE_REGISTER,
+        STAGE_RENDER,
+        STAGE_ENQUEUE,      ///< buffer given back to the device
+        STAGE_TOTAL,
+        STAGE_COUNT
+    };
+
+    LatencyTrace();
+    ~LatencyTrace();
+
+    /// Start tracing, path "-" or NULL writes to stdout. Reports are
+    /// appended every periodMs, 0 only reports on close().
+    bool open(const char* path, int periodMs = 1000);
+    /// Write the last report and stop tracing. Waits for a report a stamp
+    /// is writing, stamps after it are ignored.
+    void close();
+
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    void record(Stage stage, int64_t ns) { _hist[stage].record(ns); }
+    /// device latency of frame arriving at host time arrivalNs, clock is
+    /// the fit of its device clock
+    void recordDevice(const TY_FRAME_DATA& frame, int64_t arrivalNs, const DeviceClock::Fit& clock);
+
+    /// Write a report if the period is over, only one caller does it.
+    void poll(int64_t now);
+    /// write a report of the samples since the last one
+    void report();
+
+    static const char* stageName(Stage stage);
+
+private:
+    LatencyTrace(const LatencyTrace&);
+    LatencyTrace& operator=(const LatencyTrace&);
+
+    void writeReport();
+
+    std::atomic<bool>       _enabled;
+    FILE*                   _fp;
+    int64_t                 _periodNs;
+    std::atomic<int64_t>    _nextReport;
+    std::atomic<bool>       _reporting; // owns _fp while set
+    int64_t                 _reportStart;
+    LatencyHistogram        _hist[STAGE_COUNT];
+    LatencyHistogram::Snapshot  _snap;
+};
+
+
+/// Stamps of one frame. Construct it when the frame is fetched, stamp
+/// after each stage and finish() when it is done with.
+class FrameTrace
+{
+public:
+    /// frame as fetched from its FrameBufferPool, whose clock is used
+    FrameTrace(LatencyTrace& trace, const Frame& frame)
+        : _trace(trace), _start(0), _last(0) {
+                if(!_trace.enabled() || frame.empty()){
+                    return;
+                }
+                _last = monotonicNs();
+                _start = frame.fetchedNs() ? frame.fetchedNs() : _last;
+                if(frame.pool()){
+                    _trace.recordDevice(frame.data(), _start, frame.pool()->clockFit());
+                }
+                if(frame.fetchedNs()){
+                    _trace.record(LatencyTrace::STAGE_QUEUE, _last - frame.fetchedNs());
+                }
+            }
+
+    /// stage ended now
+    void stamp(LatencyTrace::Stage stage){
+                if(_trace.enabled()){
+                    int64_t now = monotonicNs();
+                    _trace.record(stage, now - _last);
+                    _last = now;
+                }
+            }
+
+    /// record STAGE_TOTAL up to the last stamp
+    void finish(){
+                if(_trace.enabled() && _start){
+                    _trace.record(LatencyTrace::STAGE_TOTAL, _last - _start);
+                    _trace.poll(_last);
+                    _start = 0;
+                }
+            }
+
+private:
+    LatencyTrace&   _trace;
+    int64_t         _start;
+    int64_t         _last;
+};
+
+
+#endif
@@ -14,7 +14,7 @@ void OpencvViewer::__onMouseCallback(int event, int x, int y, int flags, void* u
 
 void OpencvViewer::show(const std::string& win, const cv::Mat& img)
 {
-    _img = img.clone();
+    img.copyTo(_img);
     _win = win;
     cv::imshow(win.c_str(), _img);
     cv::setMouseCallback(win, __onMouseCallback, this);
@@ -41,21 +41,36 @@ std::string DepthViewer::depthStringAtLoc(const cv::Mat& img, const cv::Point pn
 }
 
 
-void DepthViewer::show(const std::string& win, const cv::Mat& img)
+const cv::Mat& DepthViewer::render(const cv::Mat& img)
 {
     if(img.type() != CV_16U){
+        _colorImg.release();
+        return _colorImg;
+    }
+
+    // all buffers are members and reused, nothing is allocated per frame
+    // once the resolution is stable
+    img.copyTo(_img);
+    _render.Compute(img, _colorImg);
+    return _colorImg;
+}
+
+
+void DepthViewer::show(const std::string& win, const cv::Mat& img)
+{
+    if(render(img).empty()){
         return;
     }
 
-    _img = img.clone();
-    cv::Mat colorImg = _render.Compute(img);
-    std::string text = "Depth at center: " + depthStringAtLoc(_img, cv::Point(img.cols/2, img.rows/2));
-    drawText(colorImg, text, cv::Point(0,20), 0.5, cv::Scalar(0,255,0), 2);
+    char str[64];
+    sprintf(str, "Depth at center: %d", _img.at<uint16_t>(img.rows/2, img.cols/2));
+    _text.assign(str);
+    drawText(_colorImg, _text, cv::Point(0,20), 0.5, cv::Scalar(0,255,0), 2);
+
+    drawFixLoc(_colorImg);
+    drawItems(_colorImg);
 
-    drawFixLoc(colorImg);
-    drawItems(colorImg);
-    
-    OpencvViewer::show(win, colorImg);
+    OpencvViewer::show(win, _colorImg);
 }
 
 
@@ -79,7 +94,8 @@ void DepthViewer::drawFixLoc(cv::Mat& img)
 {
     char str[64];
     sprintf(str, "Depth at (%d,%d): %d", _fixLoc.x, _fixLoc.y, _img.at<uint16_t>(_fixLoc));
-    drawText(img, str, cv::Point(0,40), 0.5, cv::Scalar(0,255,0), 2);
+    _text.assign(str);
+    drawText(img, _text, cv::Point(0,40), 0.5, cv::Scalar(0,255,0), 2);
 }
 
 void DepthViewer::drawItems(cv::Mat& img)
@@ -2,6 +2,7 @@
 #define XYZ_MAT_VIEWER_HPP_
 
 #include <opencv2/opencv.hpp>
+#include <map>
 #include <string>
 #include "DepthRender.hpp"
 
@@ -71,6 +72,11 @@ public:
                     _items.insert(std::make_pair(item->id(), item));}
     void delGraphicItem(GraphicItem* item) { _items.erase(item->id()); }
 
+    /// The colored depth image show() draws on, empty if depthImage is not
+    /// CV_16U. Allocation free once the resolution is stable; the text and
+    /// window of show() are OpenCV's and allocate on their own.
+    const cv::Mat& render(const cv::Mat& depthImage);
+
     virtual void show(const std::string& win, const cv::Mat& depthImage);
     virtual void onMouseCallback(cv::Mat& img, int event, const cv::Point pnt);
 
@@ -80,6 +86,8 @@ private:
 
     DepthRender _render;
     cv::Mat _img;
+    cv::Mat _colorImg;
+    std::string _text;
     cv::Point   _fixLoc;
     std::map<int, GraphicItem*> _items;
 };
@@ -0,0 +1,78 @@
+#include "MultiDeviceCapture.hpp"
+
+
+MultiDeviceCapture::MultiDeviceCapture(int queueDepth, FrameQueue::Policy policy)
+    : _queue(queueDepth, policy)
+    , _running(false)
+{
+}
+
+
+MultiDeviceCapture::~MultiDeviceCapture()
+{
+    stop();
+    for(size_t i = 0; i < _engines.size(); i++){
+        delete _engines[i];
+    }
+}
+
+
+int MultiDeviceCapture::addDevice(FrameBufferPool& pool, int cpu)
+{
+    if(_running){
+        return -1;
+    }
+    CaptureEngine* engine = new CaptureEngine(pool, _queue);
+    engine->setAffinity(cpu);
+    _engines.push_back(engine);
+    return (int)_engines.size() - 1;
+}
+
+
+void MultiDeviceCapture::start()
+{
+    if(_running){
+        return;
+    }
+    _queue.reopen();
+    for(size_t i = 0; i < _engines.size(); i++){
+        _engines[i]->start();
+    }
+    _running = true;
+}
+
+
+void MultiDeviceCapture::stop()
+{
+    // close first, engines blocked in push return before they are joined
+    _queue.close();
+    for(size_t i = 0; i < _engines.size(); i++){
+        _engines[i]->stop();
+    }
+    _queue.clear();
+    _running = false;
+}
+
+
+bool MultiDeviceCapture::next(Frame& frame, int* device, int timeoutMs)
+{
+    if(!_queue.pop(frame, timeoutMs)){
+        return false;
+    }
+    if(device){
+        *device = deviceIndex(frame);
+    }
+    return true;
+}
+
+
+int MultiDeviceCapture::deviceIndex(const Frame& frame) const
+{
+    FrameBufferPool* pool = frame.pool();
+    for(size_t i = 0; i < _engines.size(); i++){
+        if(&_engines[i]->pool() == pool){
+            return (int)i;
+        }
+    }
+    return -1;
+}
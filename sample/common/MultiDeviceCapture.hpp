@@ -0,0 +1,50 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_MULTI_DEVICE_CAPTURE_HPP_
+#define PERCIPIO_SAMPLE_COMMON_MULTI_DEVICE_CAPTURE_HPP_
+
+#include <vector>
+#include "CaptureEngine.hpp"
+
+/// One acquisition thread per device, all feeding one merged FrameQueue.
+/// A slow or dead camera only stalls its own thread, and fetching scales
+/// with the number of devices. Frames are tagged by their pool, use
+/// deviceIndex() or the index returned by next() to tell them apart.
+class MultiDeviceCapture
+{
+public:
+    explicit MultiDeviceCapture(int queueDepth = 8
+            , FrameQueue::Policy policy = FrameQueue::POLICY_DROP_OLDEST);
+    /// stops all threads and releases queued frames
+    ~MultiDeviceCapture();
+
+    /// Add a device by its buffer pool, which must outlive this object.
+    /// cpu pins the fetch thread of this device, -1 does not pin. Returns
+    /// the device index. Devices can only be added while stopped.
+    int addDevice(FrameBufferPool& pool, int cpu = -1);
+    int deviceCount() const { return (int)_engines.size(); }
+
+    void start();
+    /// join all fetch threads and release queued frames, consumers blocked
+    /// in next() return false
+    void stop();
+
+    /// Next frame of any device, waits up to timeoutMs (-1 forever). device
+    /// receives the index of its device.
+    bool next(Frame& frame, int* device = NULL, int timeoutMs = -1);
+
+    /// index of the device a frame came from, -1 if unknown
+    int deviceIndex(const Frame& frame) const;
+
+    FrameQueue& queue() { return _queue; }
+    CaptureEngine::Stats deviceStats(int device) const { return _engines[device]->stats(); }
+
+private:
+    MultiDeviceCapture(const MultiDeviceCapture&);
+    MultiDeviceCapture& operator=(const MultiDeviceCapture&);
+
+    FrameQueue                      _queue;
+    std::vector<CaptureEngine*>     _engines;
+    bool                            _running;
+};
+
+
+#endif
@@ -119,32 +119,3 @@ void PointCloudViewer::show(const cv::Mat &pointCloud, const std::string &window
 {
     impl->show(pointCloud, windowName);
 }
-
-///////////////////////////////////////////////////////////////
-
-static void writePC_XYZ(const cv::Point3f* pnts, size_t n, FILE* fp)
-{
-    for(size_t i = 0; i < n; i++){
-        if(!std::isnan(pnts[i].x)){
-            fprintf(fp, "%f %f %f 0 0 0\n", pnts[i].x, pnts[i].y, pnts[i].z);
-        }
-    }
-}
-
-void writePointCloud(const cv::Point3f* pnts, size_t n, const char* file, int format)
-{
-    FILE* fp = fopen(file, "w");
-    if(!fp){
-        return;
-    }
-
-    switch(format){
-        case PC_FILE_FORMAT_XYZ:
-            writePC_XYZ(pnts, n, fp);
-            break;
-        default:
-            break;
-    }
-
-    fclose(fp);
-}
@@ -3,6 +3,7 @@
 
 #include <opencv2/opencv.hpp>
 #include <string>
+#include "PointCloudWriter.hpp"
 
 class PointCloudViewerImpl;
 
@@ -19,11 +20,4 @@ private:
 };
 
 
-enum{
-    PC_FILE_FORMAT_XYZ = 0,
-};
-void writePointCloud(const cv::Point3f* pnts, size_t n, const char* file, int format);
-
-
-
 #endif
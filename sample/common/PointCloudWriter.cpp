@@ -0,0 +1,435 @@
+#include "PointCloudWriter.hpp"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define POINT_CLOUD_WRITER_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define POINT_CLOUD_WRITER_NEON
+#endif
+
+// Binary files are written in host order, which is little endian on every
+// platform the SDK ships for.
+
+/// size of one fwrite
+static const size_t kChunkSize = 1 << 20;
+
+
+// Copy the points whose x is not NaN, and their colors if bgr is set, to
+// out and outBgr. Returns how many were kept.
+static size_t keepValid(const float* pnts, size_t n, const uint8_t* bgr
+        , float* out, uint8_t* outBgr)
+{
+    size_t i = 0, k = 0;
+#if defined(POINT_CLOUD_WRITER_SSE2) || defined(POINT_CLOUD_WRITER_NEON)
+    // four points at a time, runs of all valid or all NaN points are the
+    // common case in a camera cloud
+    for(; i + 4 <= n; i += 4){
+        const float* s = pnts + i * 3;
+#  if defined(POINT_CLOUD_WRITER_SSE2)
+        // x0 y0 z0 x1 | y1 z1 x2 y2 | z2 x3 y3 z3
+        __m128 a = _mm_loadu_ps(s);
+        __m128 b = _mm_loadu_ps(s + 4);
+        __m128 c = _mm_loadu_ps(s + 8);
+        int ma = _mm_movemask_ps(_mm_cmpord_ps(a, a));
+        int mb = _mm_movemask_ps(_mm_cmpord_ps(b, b));
+        int mc = _mm_movemask_ps(_mm_cmpord_ps(c, c));
+        int valid = (ma & 1) | ((ma >> 2) & 2) | (mb & 4) | ((mc & 2) << 2);
+        if(valid == 15){
+            float* o = out + k * 3;
+            _mm_storeu_ps(o, a);
+            _mm_storeu_ps(o + 4, b);
+            _mm_storeu_ps(o + 8, c);
+#  else
+        float32x4x3_t p = vld3q_f32(s);
+        uint32x4_t ok = vceqq_f32(p.val[0], p.val[0]);
+        const uint32x4_t bits = {1, 2, 4, 8};
+        int valid = (int)vaddvq_u32(vandq_u32(ok, bits));
+        if(valid == 15){
+            vst3q_f32(out + k * 3, p);
+#  endif
+            if(bgr){
+                memcpy(outBgr + k * 3, bgr + i * 3, 12);
+            }
+            k += 4;
+        } else if(valid){
+            for(int j = 0; j < 4; j++){
+                if(valid & (1 << j)){
+                    memcpy(out + k * 3, s + j * 3, 12);
+                    if(bgr){
+                        memcpy(outBgr + k * 3, bgr + (i + j) * 3, 3);
+                    }
+                    k++;
+                }
+            }
+        }
+    }
+#endif
+    for(; i < n; i++){
+        const float* s = pnts + i * 3;
+        if(s[0] == s[0]){
+            memcpy(out + k * 3, s, 12);
+            if(bgr){
+                memcpy(outBgr + k * 3, bgr + i * 3, 3);
+            }
+            k++;
+        }
+    }
+    return k;
+}
+
+
+// Buffered writes of kChunkSize.
+class PointCloudFile
+{
+public:
+    explicit PointCloudFile(FILE* fp) : _fp(fp), _fill(0), _ok(true) { _buf.resize(kChunkSize); }
+
+    /// room for at least size bytes, size <= kChunkSize
+    uint8_t* reserve(size_t size){
+                if(_fill + size > _buf.size()){
+                    flush();
+                }
+                return &_buf[_fill];
+            }
+    void commit(size_t size) { _fill += size; }
+    /// fail the file, for data that could not be formatted
+    void fail() { _ok = false; }
+    void write(const void* data, size_t size){
+                flush();
+                if(size && fwrite(data, 1, size, _fp) != size){
+                    _ok = false;
+                }
+            }
+    bool flush(){
+                if(_fill && fwrite(&_buf[0], 1, _fill, _fp) != _fill){
+                    _ok = false;
+                }
+                _fill = 0;
+                return _ok;
+            }
+
+private:
+    FILE*                   _fp;
+    std::vector<uint8_t>    _buf;
+    size_t                  _fill;
+    bool                    _ok;
+};
+
+
+// LZF as liblzf writes it, which PCL reads for binary_compressed. Control
+// byte c < 32 is followed by c + 1 literals; otherwise c >> 5 is the match
+// length - 2 (7: add the next byte) and c & 31 with the byte after that
+// is the match distance - 1, up to 8191. out needs n + n / 32 + 1 bytes.
+static size_t lzfCompress(const uint8_t* in, size_t n, uint8_t* out, std::vector<uint32_t>& table)
+{
+    enum { kHashBits = 14, kMaxLiteral = 32, kMaxOffset = 1 << 13, kMaxMatch = 264 };
+    table.assign(1 << kHashBits, 0);    // position + 1 of the last 3 bytes with that hash
+
+    size_t ip = 0;
+    size_t op = 1;      // out[0] is the control byte of the first literal run
+    size_t lit = 0;
+    while(ip + 2 < n){
+        uint32_t v = in[ip] | (in[ip + 1] << 8) | (in[ip + 2] << 16);
+        uint32_t h = (v * 2654435761u) >> (32 - kHashBits);
+        size_t ref = table[h];
+        table[h] = (uint32_t)(ip + 1);
+        if(ref && ip - ref < kMaxOffset && in[ref - 1] == in[ip] && in[ref] == in[ip + 1]
+                && in[ref + 1] == in[ip + 2]){
+            ref--;
+            size_t len = 3;
+            size_t maxLen = n - ip < (size_t)kMaxMatch ? n - ip : (size_t)kMaxMatch;
+            while(len < maxLen && in[ref + len] == in[ip + len]){
+                len++;
+            }
+            // close the literal run, or take back its control byte
+            if(lit){
+                out[op - lit - 1] = (uint8_t)(lit - 1);
+            } else {
+                op--;
+            }
+            size_t off = ip - ref - 1;
+            size_t l = len - 2;
+            if(l < 7){
+                out[op++] = (uint8_t)((l << 5) | (off >> 8));
+            } else {
+                out[op++] = (uint8_t)((7 << 5) | (off >> 8));
+                out[op++] = (uint8_t)(l - 7);
+            }
+            out[op++] = (uint8_t)off;
+            lit = 0;
+            op++;
+            ip += len;
+        } else {
+            out[op++] = in[ip++];
+            if(++lit == kMaxLiteral){
+                out[op - lit - 1] = (uint8_t)(lit - 1);
+                lit = 0;
+                op++;
+            }
+        }
+    }
+    while(ip < n){
+        out[op++] = in[ip++];
+        if(++lit == kMaxLiteral){
+            out[op - lit - 1] = (uint8_t)(lit - 1);
+            lit = 0;
+            op++;
+        }
+    }
+    if(lit){
+        out[op - lit - 1] = (uint8_t)(lit - 1);
+    } else {
+        op--;
+    }
+    return op;
+}
+
+
+static inline uint32_t packRGB(const uint8_t* bgr)
+{
+    return ((uint32_t)bgr[2] << 16) | ((uint32_t)bgr[1] << 8) | bgr[0];
+}
+
+
+static void writeXYZ(PointCloudFile& w, const float* p, const uint8_t* bgr, size_t n)
+{
+    // -FLT_MAX takes 47 characters with %f, three of them and the colors
+    // fit any line
+    enum { kMaxLine = 3 * 48 + 3 * 4 + 1 };
+    for(size_t i = 0; i < n; i++, p += 3){
+        char* line = (char*)w.reserve(kMaxLine);
+        int len = snprintf(line, kMaxLine, "%f %f %f %d %d %d\n", p[0], p[1], p[2]
+                , bgr ? bgr[i * 3 + 2] : 0, bgr ? bgr[i * 3 + 1] : 0, bgr ? bgr[i * 3] : 0);
+        if(len <= 0 || len >= kMaxLine){
+            w.fail();
+            return;
+        }
+        w.commit(len);
+    }
+}
+
+
+static void writePLY(PointCloudFile& w, const float* p, const uint8_t* bgr, size_t n)
+{
+    char header[256];
+    int len = snprintf(header, sizeof(header)
+            , "ply\nformat binary_little_endian 1.0\nelement vertex %llu\n"
+              "property float x\nproperty float y\nproperty float z\n%s"
+              "end_header\n", (unsigned long long)n
+            , bgr ? "property uchar red\nproperty uchar green\nproperty uchar blue\n" : "");
+    memcpy(w.reserve(len), header, len);
+    w.commit(len);
+
+    if(!bgr){
+        // the filtered points already are the vertex list
+        w.write(p, n * 12);
+        return;
+    }
+    for(size_t i = 0; i < n; i++){
+        uint8_t* v = w.reserve(15);
+        memcpy(v, p + i * 3, 12);
+        v[12] = bgr[i * 3 + 2];
+        v[13] = bgr[i * 3 + 1];
+        v[14] = bgr[i * 3];
+        w.commit(15);
+    }
+}
+
+
+static void writePCD(PointCloudFile& w, const float* p, const uint8_t* bgr, size_t n, bool compressed)
+{
+    char header[512];
+    int len = snprintf(header, sizeof(header)
+            , "# .PCD v0.7 - Point Cloud Data file format\nVERSION 0.7\n"
+              "FIELDS x y z%s\nSIZE 4 4 4%s\nTYPE F F F%s\nCOUNT 1 1 1%s\n"
+              "WIDTH %llu\nHEIGHT 1\nVIEWPOINT 0 0 0 1 0 0 0\nPOINTS %llu\nDATA %s\n"
+            , bgr ? " rgb" : "", bgr ? " 4" : "", bgr ? " U" : "", bgr ? " 1" : ""
+            , (unsigned long long)n, (unsigned long long)n
+            , compressed ? "binary_compressed" : "binary");
+    memcpy(w.reserve(len), header, len);
+    w.commit(len);
+
+    if(!compressed){
+        if(!bgr){
+            w.write(p, n * 12);
+            return;
+        }
+        for(size_t i = 0; i < n; i++){
+            uint8_t* v = w.reserve(16);
+            uint32_t rgb = packRGB(bgr + i * 3);
+            memcpy(v, p + i * 3, 12);
+            memcpy(v + 12, &rgb, 4);
+            w.commit(16);
+        }
+        return;
+    }
+
+    // one plane per field, then LZF over all of them
+    const size_t fields = bgr ? 4 : 3;
+    std::vector<uint8_t> planes(n * fields * 4 + 1);
+    float* x = (float*)&planes[0];
+    float* y = x + n;
+    float* z = y + n;
+    uint32_t* rgb = (uint32_t*)(z + n);
+    for(size_t i = 0; i < n; i++){
+        x[i] = p[i * 3];
+        y[i] = p[i * 3 + 1];
+        z[i] = p[i * 3 + 2];
+    }
+    if(bgr){
+        for(size_t i = 0; i < n; i++){
+            rgb[i] = packRGB(bgr + i * 3);
+        }
+    }
+    const size_t size = n * fields * 4;
+    std::vector<uint8_t> coded(size + size / 32 + 1);
+    std::vector<uint32_t> table;
+    uint32_t sizes[2];
+    sizes[0] = (uint32_t)lzfCompress(&planes[0], size, &coded[0], table);
+    sizes[1] = (uint32_t)size;
+    memcpy(w.reserve(8), sizes, 8);
+    w.commit(8);
+    if(sizes[0]){
+        w.write(&coded[0], sizes[0]);
+    }
+}
+
+
+// p and bgr hold n valid points
+static bool writeValid(const float* p, const uint8_t* bgr, size_t n, const char* file, int format)
+{
+    FILE* fp = fopen(file, format == PC_FILE_FORMAT_XYZ ? "w" : "wb");
+    if(!fp){
+        return false;
+    }
+    bool ok = true;
+    {
+        PointCloudFile w(fp);
+        switch(format){
+            case PC_FILE_FORMAT_XYZ:
+                writeXYZ(w, p, bgr, n);
+                break;
+            case PC_FILE_FORMAT_PLY:
+                writePLY(w, p, bgr, n);
+                break;
+            case PC_FILE_FORMAT_PCD:
+            case PC_FILE_FORMAT_PCD_COMPRESSED:
+                writePCD(w, p, bgr, n, format == PC_FILE_FORMAT_PCD_COMPRESSED);
+                break;
+            default:
+                ok = false;
+                break;
+        }
+        ok = w.flush() && ok;
+    }
+    return fclose(fp) == 0 && ok;
+}
+
+
+bool writePointCloud(const cv::Point3f* pnts, size_t n, const char* file, int format
+        , const uint8_t* bgr)
+{
+    std::vector<float> points(n * 3 + 1);
+    std::vector<uint8_t> colors(bgr ? n * 3 + 1 : 0);
+    size_t k = keepValid((const float*)pnts, n, bgr, &points[0], bgr ? &colors[0] : NULL);
+    return writeValid(&points[0], bgr ? &colors[0] : NULL, k, file, format);
+}
+
+
+PointCloudWriter::PointCloudWriter()
+    : _count(0)
+    , _hasColor(false)
+    , _format(PC_FILE_FORMAT_PLY)
+    , _pending(false)
+    , _failed(false)
+    , _exit(false)
+{
+    _thread = std::thread(&PointCloudWriter::writerLoop, this);
+}
+
+
+PointCloudWriter::~PointCloudWriter()
+{
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _exit = true;
+    }
+    _wake.notify_one();
+    _thread.join();
+}
+
+
+bool PointCloudWriter::write(const cv::Point3f* pnts, size_t n, const char* file, int format
+        , const uint8_t* bgr)
+{
+    {
+        // held while the buffers are filled, so a second caller finds the
+        // write pending or waits for it to be handed off; the writer thread
+        // only looks at the buffers while a write is pending
+        std::lock_guard<std::mutex> lk(_lock);
+        if(_pending){
+            return false;
+        }
+        if(_points.size() < n * 3 + 1){
+            _points.resize(n * 3 + 1);
+        }
+        if(bgr && _colors.size() < n * 3 + 1){
+            _colors.resize(n * 3 + 1);
+        }
+        _count = keepValid((const float*)pnts, n, bgr, &_points[0], bgr ? &_colors[0] : NULL);
+        _hasColor = bgr != NULL;
+        _file = file;
+        _format = format;
+        _pending = true;
+    }
+    _wake.notify_one();
+    return true;
+}
+
+
+bool PointCloudWriter::busy() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    return _pending;
+}
+
+
+bool PointCloudWriter::wait()
+{
+    std::unique_lock<std::mutex> lk(_lock);
+    while(_pending){
+        _done.wait(lk);
+    }
+    bool ok = !_failed;
+    _failed = false;
+    return ok;
+}
+
+
+void PointCloudWriter::writerLoop()
+{
+    while(true){
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            while(!_pending && !_exit){
+                _wake.wait(lk);
+            }
+            if(!_pending){
+                break;
+            }
+        }
+
+        bool ok = writeValid(&_points[0], _hasColor ? &_colors[0] : NULL, _count
+                , _file.c_str(), _format);
+
+        std::lock_guard<std::mutex> lk(_lock);
+        if(!ok){
+            _failed = true;
+        }
+        _pending = false;
+        _done.notify_all();
+    }
+}
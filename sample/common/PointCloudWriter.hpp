@@ -0,0 +1,71 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_POINT_CLOUD_WRITER_HPP_
+#define PERCIPIO_SAMPLE_COMMON_POINT_CLOUD_WRITER_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <stdint.h>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum{
+    PC_FILE_FORMAT_XYZ = 0,             ///< text, "x y z r g b" per line
+    PC_FILE_FORMAT_PLY = 1,             ///< binary little endian PLY
+    PC_FILE_FORMAT_PCD = 2,             ///< PCD, DATA binary
+    PC_FILE_FORMAT_PCD_COMPRESSED = 3,  ///< PCD, DATA binary_compressed (LZF)
+};
+
+/// Points with a NaN coordinate are skipped. bgr is NULL or 3 bytes per
+/// point, as ColorToDepth::OUTPUT_BGR gives for a host point cloud; with
+/// it the files carry a color per point. false if the file could not be
+/// written.
+bool writePointCloud(const cv::Point3f* pnts, size_t n, const char* file, int format
+        , const uint8_t* bgr = NULL);
+
+
+/// writePointCloud() without blocking the caller. write() keeps the valid
+/// points and their colors and returns; the file is written by a thread of
+/// its own. One cloud is written at a time; write() can be called from
+/// any thread.
+class PointCloudWriter
+{
+public:
+    PointCloudWriter();
+    /// finishes the pending write
+    ~PointCloudWriter();
+
+    /// false, and nothing is copied, while the last cloud is still being
+    /// written
+    bool write(const cv::Point3f* pnts, size_t n, const char* file, int format
+            , const uint8_t* bgr = NULL);
+
+    bool busy() const;
+    /// Wait for the pending write, false if a write failed since the last
+    /// wait().
+    bool wait();
+
+private:
+    PointCloudWriter(const PointCloudWriter&);
+    PointCloudWriter& operator=(const PointCloudWriter&);
+
+    void writerLoop();
+
+    std::vector<float>      _points;    // x y z of the valid points
+    std::vector<uint8_t>    _colors;    // bgr of the valid points
+    size_t                  _count;     // valid points
+    bool                    _hasColor;
+    std::string             _file;
+    int                     _format;
+
+    mutable std::mutex      _lock;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    std::thread             _thread;
+    bool                    _pending;
+    bool                    _failed;
+    bool                    _exit;
+};
+
+
+#endif
@@ -0,0 +1,641 @@
+#define TY_REPLAY_NO_DISPATCH
+#include "ReplayDevice.hpp"
+#include "ReplayDispatch.hpp"
+#include "Clock.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+
+// open replay devices, looked up by handle on every dispatched call
+static std::mutex                   g_registryLock;
+static std::vector<ReplayDevice*>   g_registry;
+static std::atomic<int>             g_registered(0);
+
+
+ReplayDevice::ReplayDevice()
+    : _flags(REPLAY_REALTIME)
+    , _components(0)
+    , _enabled(0)
+    , _bufferSize(0)
+    , _span(0)
+    , _capturing(false)
+    , _next(0)
+    , _loops(0)
+    , _startMs(0.)
+    , _frames(0)
+    , _dropped(0)
+{
+}
+
+
+ReplayDevice::~ReplayDevice()
+{
+    close();
+}
+
+
+TY_STATUS ReplayDevice::open(const char* path, int flags)
+{
+    close();
+    if(!_reader.open(path)){
+        return TY_STATUS_INVALID_PARAMETER;
+    }
+    int count = _reader.frameCount();
+    if(count == 0){
+        _reader.close();
+        return TY_STATUS_NO_DATA;
+    }
+
+    _flags = flags;
+    _components = 0;
+    _bufferSize = 0;
+    TY_FRAME_DATA frame;
+    if(_reader.frame(0, frame)){
+        for(int i = 0; i < frame.validCount; i++){
+            _components |= frame.image[i].componentID;
+        }
+    }
+    for(int i = 0; i < count; i++){
+        _bufferSize = std::max(_bufferSize, _reader.unpackedSize(i));
+    }
+    _enabled = _components;
+
+    uint64_t first = _reader.timestamp(0);
+    uint64_t last = _reader.timestamp(count - 1);
+    _span = count > 1 && last > first ? (last - first) * count / (count - 1) : 33333;
+
+    std::lock_guard<std::mutex> lk(g_registryLock);
+    g_registry.push_back(this);
+    g_registered++;
+    return TY_STATUS_OK;
+}
+
+
+void ReplayDevice::close()
+{
+    {
+        std::lock_guard<std::mutex> lk(g_registryLock);
+        std::vector<ReplayDevice*>::iterator it = std::find(g_registry.begin(), g_registry.end(), this);
+        if(it != g_registry.end()){
+            g_registry.erase(it);
+            g_registered--;
+        }
+    }
+    stopCapture();
+    clearBufferQueue();
+    _reader.close();
+}
+
+
+ReplayDevice* ReplayDevice::fromHandle(TY_DEV_HANDLE handle)
+{
+    if(g_registered.load() == 0){
+        return NULL;
+    }
+    std::lock_guard<std::mutex> lk(g_registryLock);
+    for(size_t i = 0; i < g_registry.size(); i++){
+        if(g_registry[i] == handle){
+            return g_registry[i];
+        }
+    }
+    return NULL;
+}
+
+
+int ReplayDevice::defaultFlags()
+{
+    const char* mode = getenv("TY_REPLAY_MODE");
+    int flags = REPLAY_REALTIME;
+    if(mode && strstr(mode, "fast")){
+        flags |= REPLAY_FAST;
+    }
+    if(mode && strstr(mode, "loop")){
+        flags |= REPLAY_LOOP;
+    }
+    return flags;
+}
+
+
+void ReplayDevice::deviceInfo(TY_DEVICE_BASE_INFO* info) const
+{
+    memset(info, 0, sizeof(*info));
+    snprintf(info->id, sizeof(info->id), "%s", _reader.deviceId());
+    snprintf(info->vendorName, sizeof(info->vendorName), "%s", "Percipio");
+    snprintf(info->modelName, sizeof(info->modelName), "%s", "replay");
+}
+
+
+TY_STATUS ReplayDevice::enableComponents(int32_t comps)
+{
+    // components missing from the recording are silently left out
+    std::lock_guard<std::mutex> lk(_lock);
+    _enabled |= comps & _components;
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::disableComponents(int32_t comps)
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _enabled &= ~comps;
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::enqueueBuffer(void* buffer, int32_t size)
+{
+    if(!buffer){
+        return TY_STATUS_NULL_POINTER;
+    }
+    if(size < _bufferSize){
+        return TY_STATUS_WRONG_SIZE;
+    }
+    std::lock_guard<std::mutex> lk(_lock);
+    UserBuffer buf;
+    buf.data = buffer;
+    buf.size = size;
+    buf.enqueuedMs = monotonicMs();
+    _buffers.push_back(buf);
+    _wake.notify_all();
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::clearBufferQueue()
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _buffers.clear();
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::startCapture()
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    if(_capturing){
+        return TY_STATUS_BUSY;
+    }
+    _capturing = true;
+    _next = 0;
+    _loops = 0;
+    _startMs = monotonicMs();
+    _wake.notify_all();
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::stopCapture()
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    _capturing = false;
+    _wake.notify_all();
+    return TY_STATUS_OK;
+}
+
+
+bool ReplayDevice::isCapturing() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    return _capturing;
+}
+
+
+double ReplayDevice::dueMs(int index) const
+{
+    uint64_t t = _reader.timestamp(index) - _reader.timestamp(0) + _loops * _span;
+    return _startMs + t / 1000.;
+}
+
+
+TY_STATUS ReplayDevice::fetchFrame(TY_FRAME_DATA* frame, int32_t timeout)
+{
+    if(!frame){
+        return TY_STATUS_NULL_POINTER;
+    }
+    double deadline = timeout < 0 ? -1. : monotonicMs() + timeout;
+    const int count = _reader.frameCount();
+    int index;
+    UserBuffer buf;
+    uint64_t tsOffset;
+
+    std::unique_lock<std::mutex> lk(_lock);
+    while(true){
+        if(!_capturing){
+            return TY_STATUS_IDLE;
+        }
+        if(_next >= count && (_flags & REPLAY_LOOP)){
+            _next = 0;
+            _loops++;
+        }
+
+        double wakeAt = -1.;    // < 0: until notified
+        if(_next >= count){
+            // end of the recording, nothing comes any more
+        } else if(!(_flags & REPLAY_FAST) && monotonicMs() < dueMs(_next)){
+            wakeAt = dueMs(_next);
+        } else if(!(_flags & REPLAY_FAST) && !_buffers.empty()
+                && dueMs(_next) < _buffers.front().enqueuedMs){
+            // came while the consumer held every buffer, a camera dropped it
+            _next++;
+            _dropped++;
+            continue;
+        } else if(!_buffers.empty()){
+            buf = _buffers.front();
+            _buffers.pop_front();
+            index = _next++;
+            tsOffset = _loops * _span;
+            break;
+        } else if(!(_flags & REPLAY_FAST)){
+            // a camera drops the frames it has no buffer for
+            _next++;
+            _dropped++;
+            continue;
+        }
+
+        double now = monotonicMs();
+        if(deadline >= 0 && now >= deadline){
+            return TY_STATUS_TIMEOUT;
+        }
+        if(deadline >= 0 && (wakeAt < 0 || deadline < wakeAt)){
+            wakeAt = deadline;
+        }
+        if(wakeAt < 0){
+            _wake.wait(lk);
+        } else {
+            _wake.wait_for(lk, std::chrono::duration<double, std::milli>(wakeAt - now));
+        }
+    }
+    int32_t enabled = _enabled;
+    lk.unlock();
+
+    // copy without the lock, enqueue and fetch from other threads go on
+    if(!_reader.unpack(index, enabled, buf.data, buf.size, *frame)){
+        lk.lock();
+        _buffers.push_front(buf);
+        return TY_STATUS_DEVICE_ERROR;
+    }
+    for(int i = 0; i < frame->validCount; i++){
+        frame->image[i].timestamp += tsOffset;
+    }
+
+    lk.lock();
+    _frames++;
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayDevice::getStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature
+        , void* data, int32_t size) const
+{
+    int32_t stored;
+    const void* p = _reader.findStruct(comp, feature, &stored);
+    if(!p){
+        return TY_STATUS_INVALID_FEATURE;
+    }
+    if(!data){
+        return TY_STATUS_NULL_POINTER;
+    }
+    if(size != stored){
+        return TY_STATUS_WRONG_SIZE;
+    }
+    memcpy(data, p, size);
+    return TY_STATUS_OK;
+}
+
+
+bool ReplayDevice::hasStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature) const
+{
+    return _reader.findStruct(comp, feature) != NULL;
+}
+
+
+TY_STATUS ReplayDevice::depthToWorld(const TY_VECT_3F* depth, TY_VECT_3F* world
+        , int32_t worldPaddingBytes, int32_t pointCount) const
+{
+    if(!depth || !world){
+        return TY_STATUS_NULL_POINTER;
+    }
+    if(worldPaddingBytes < 0 || worldPaddingBytes % 4){
+        return TY_STATUS_INVALID_PARAMETER;
+    }
+    TY_CAMERA_INTRINSIC intri;
+    TY_STATUS err = getStruct(TY_COMPONENT_DEPTH_CAM, TY_STRUCT_CAM_INTRINSIC, &intri, sizeof(intri));
+    if(err != TY_STATUS_OK){
+        return err;
+    }
+    const float fx = intri.data[0];
+    const float cx = intri.data[2];
+    const float fy = intri.data[4];
+    const float cy = intri.data[5];
+    uint8_t* out = (uint8_t*)world;
+    for(int32_t i = 0; i < pointCount; i++){
+        TY_VECT_3F* w = (TY_VECT_3F*)out;
+        float z = depth[i].z;
+        w->x = (depth[i].x - cx) * z / fx;
+        w->y = (depth[i].y - cy) * z / fy;
+        w->z = z;
+        out += sizeof(TY_VECT_3F) + worldPaddingBytes;
+    }
+    return TY_STATUS_OK;
+}
+
+
+ReplayDevice::Stats ReplayDevice::stats() const
+{
+    std::lock_guard<std::mutex> lk(_lock);
+    Stats s;
+    s.frames = _frames;
+    s.dropped = _dropped;
+    s.loops = _loops;
+    return s;
+}
+
+
+//------------------------------------------------------------------------------
+//  Dispatch
+//------------------------------------------------------------------------------
+
+static std::vector<std::string> replayFiles()
+{
+    std::vector<std::string> files;
+    const char* list = getenv("TY_REPLAY");
+    while(list && *list){
+        const char* end = strchr(list, ';');
+        std::string f = end ? std::string(list, end - list) : std::string(list);
+        if(!f.empty()){
+            files.push_back(f);
+        }
+        list = end ? end + 1 : NULL;
+    }
+    return files;
+}
+
+static bool isRecordingPath(const char* id)
+{
+    size_t n = strlen(id);
+    return n > 6 && strcmp(id + n - 6, ".tyrec") == 0;
+}
+
+static TY_STATUS openReplay(const char* path, TY_DEV_HANDLE* handle)
+{
+    ReplayDevice* dev = new ReplayDevice;
+    TY_STATUS err = dev->open(path, ReplayDevice::defaultFlags());
+    if(err != TY_STATUS_OK){
+        delete dev;
+        return err;
+    }
+    *handle = dev->handle();
+    return TY_STATUS_OK;
+}
+
+
+TY_STATUS ReplayTYGetDeviceNumber(int32_t* deviceNumber)
+{
+    TY_STATUS err = TYGetDeviceNumber(deviceNumber);
+    int replays = (int)replayFiles().size();
+    if(err != TY_STATUS_OK){
+        if(!replays){
+            return err;
+        }
+        *deviceNumber = 0;
+    }
+    *deviceNumber += replays;
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYGetDeviceList(TY_DEVICE_BASE_INFO* deviceInfos, int32_t bufferCount
+        , int32_t* filledDeviceCount)
+{
+    std::vector<std::string> files = replayFiles();
+    int32_t n = 0;
+    TY_STATUS err = TYGetDeviceList(deviceInfos, bufferCount, &n);
+    if(err != TY_STATUS_OK){
+        if(files.empty()){
+            return err;
+        }
+        n = 0;
+    }
+    for(size_t i = 0; i < files.size() && n < bufferCount; i++, n++){
+        TY_DEVICE_BASE_INFO& info = deviceInfos[n];
+        memset(&info, 0, sizeof(info));
+        snprintf(info.id, sizeof(info.id), "replay:%d", (int)i);
+        snprintf(info.vendorName, sizeof(info.vendorName), "%s", "Percipio");
+        snprintf(info.modelName, sizeof(info.modelName), "%s", "replay");
+    }
+    *filledDeviceCount = n;
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYOpenDevice(const char* deviceID, TY_DEV_HANDLE* deviceHandle)
+{
+    if(deviceID && strncmp(deviceID, "replay:", 7) == 0){
+        std::vector<std::string> files = replayFiles();
+        int i = atoi(deviceID + 7);
+        if(i < 0 || i >= (int)files.size()){
+            return TY_STATUS_INVALID_PARAMETER;
+        }
+        return openReplay(files[i].c_str(), deviceHandle);
+    }
+    if(deviceID && isRecordingPath(deviceID)){
+        return openReplay(deviceID, deviceHandle);
+    }
+    return TYOpenDevice(deviceID, deviceHandle);
+}
+
+TY_STATUS ReplayTYOpenDeviceWithIP(const char* IP, TY_DEV_HANDLE* deviceHandle)
+{
+    if(IP && isRecordingPath(IP)){
+        return openReplay(IP, deviceHandle);
+    }
+    return TYOpenDeviceWithIP(IP, deviceHandle);
+}
+
+TY_STATUS ReplayTYCloseDevice(TY_DEV_HANDLE hDevice)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYCloseDevice(hDevice);
+    }
+    delete dev;
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYGetDeviceInfo(TY_DEV_HANDLE hDevice, TY_DEVICE_BASE_INFO* info)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYGetDeviceInfo(hDevice, info);
+    }
+    dev->deviceInfo(info);
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYGetComponentIDs(TY_DEV_HANDLE hDevice, int32_t* componentIDs)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYGetComponentIDs(hDevice, componentIDs);
+    }
+    *componentIDs = dev->componentIDs();
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYGetEnabledComponentIDs(TY_DEV_HANDLE hDevice, int32_t* componentIDs)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYGetEnabledComponentIDs(hDevice, componentIDs);
+    }
+    *componentIDs = dev->enabledComponents();
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYEnableComponents(TY_DEV_HANDLE hDevice, int32_t componentIDs)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->enableComponents(componentIDs) : TYEnableComponents(hDevice, componentIDs);
+}
+
+TY_STATUS ReplayTYDisableComponents(TY_DEV_HANDLE hDevice, int32_t componentIDs)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->disableComponents(componentIDs) : TYDisableComponents(hDevice, componentIDs);
+}
+
+TY_STATUS ReplayTYGetFrameBufferSize(TY_DEV_HANDLE hDevice, int32_t* bufferSize)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYGetFrameBufferSize(hDevice, bufferSize);
+    }
+    *bufferSize = dev->frameBufferSize();
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYEnqueueBuffer(TY_DEV_HANDLE hDevice, void* buffer, int32_t bufferSize)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->enqueueBuffer(buffer, bufferSize) : TYEnqueueBuffer(hDevice, buffer, bufferSize);
+}
+
+TY_STATUS ReplayTYClearBufferQueue(TY_DEV_HANDLE hDevice)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->clearBufferQueue() : TYClearBufferQueue(hDevice);
+}
+
+TY_STATUS ReplayTYStartCapture(TY_DEV_HANDLE hDevice)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->startCapture() : TYStartCapture(hDevice);
+}
+
+TY_STATUS ReplayTYStopCapture(TY_DEV_HANDLE hDevice)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->stopCapture() : TYStopCapture(hDevice);
+}
+
+TY_STATUS ReplayTYIsCapturing(TY_DEV_HANDLE hDevice, bool* isCapturing)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYIsCapturing(hDevice, isCapturing);
+    }
+    *isCapturing = dev->isCapturing();
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYSendSoftTrigger(TY_DEV_HANDLE hDevice)
+{
+    // recorded frames come at their own pace, triggers have no effect
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK : TYSendSoftTrigger(hDevice);
+}
+
+TY_STATUS ReplayTYRegisterCallback(TY_DEV_HANDLE hDevice, TY_FRAME_CALLBACK callback, void* userdata)
+{
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_NOT_IMPLEMENTED
+            : TYRegisterCallback(hDevice, callback, userdata);
+}
+
+TY_STATUS ReplayTYRegisterEventCallback(TY_DEV_HANDLE hDevice, TY_EVENT_CALLBACK callback, void* userdata)
+{
+    // a recording never goes offline
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK
+            : TYRegisterEventCallback(hDevice, callback, userdata);
+}
+
+TY_STATUS ReplayTYFetchFrame(TY_DEV_HANDLE hDevice, TY_FRAME_DATA* frame, int32_t timeout)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->fetchFrame(frame, timeout) : TYFetchFrame(hDevice, frame, timeout);
+}
+
+TY_STATUS ReplayTYGetFeatureInfo(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, TY_FEATURE_INFO* featureInfo)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    if(!dev){
+        return TYGetFeatureInfo(hDevice, componentID, featureID, featureInfo);
+    }
+    // only the recorded structs exist, and they are read only
+    memset(featureInfo, 0, sizeof(*featureInfo));
+    featureInfo->componentID = componentID;
+    featureInfo->featureID = featureID;
+    featureInfo->isValid = dev->hasStruct(componentID, featureID);
+    featureInfo->accessMode = featureInfo->isValid ? TY_ACCESS_READABLE : 0;
+    return TY_STATUS_OK;
+}
+
+TY_STATUS ReplayTYGetStruct(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, void* pStruct, int32_t structSize)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->getStruct(componentID, featureID, pStruct, structSize)
+            : TYGetStruct(hDevice, componentID, featureID, pStruct, structSize);
+}
+
+// Settings can not change a recording, they are accepted and ignored so
+// that configuration code runs unchanged.
+
+TY_STATUS ReplayTYSetStruct(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, void* pStruct, int32_t structSize)
+{
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK
+            : TYSetStruct(hDevice, componentID, featureID, pStruct, structSize);
+}
+
+TY_STATUS ReplayTYSetInt(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, int32_t value)
+{
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK
+            : TYSetInt(hDevice, componentID, featureID, value);
+}
+
+TY_STATUS ReplayTYSetEnum(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, int32_t value)
+{
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK
+            : TYSetEnum(hDevice, componentID, featureID, value);
+}
+
+TY_STATUS ReplayTYSetBool(TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID
+        , TY_FEATURE_ID featureID, bool value)
+{
+    return ReplayDevice::fromHandle(hDevice) ? TY_STATUS_OK
+            : TYSetBool(hDevice, componentID, featureID, value);
+}
+
+TY_STATUS ReplayTYDepthToWorld(TY_DEV_HANDLE hDevice, const TY_VECT_3F* depth
+        , TY_VECT_3F* world, int32_t worldPaddingBytes, int32_t pointCount)
+{
+    ReplayDevice* dev = ReplayDevice::fromHandle(hDevice);
+    return dev ? dev->depthToWorld(depth, world, worldPaddingBytes, pointCount)
+            : TYDepthToWorld(hDevice, depth, world, worldPaddingBytes, pointCount);
+}
@@ -0,0 +1,103 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_REPLAY_DEVICE_HPP_
+#define PERCIPIO_SAMPLE_COMMON_REPLAY_DEVICE_HPP_
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "FrameRecord.hpp"
+
+/// A recording (see FrameRecord.hpp) played back as a device. It follows
+/// the buffer queue contract of the SDK: frames are copied into enqueued
+/// user buffers and returned by fetchFrame(). In real time mode frames
+/// come at their recorded pace and are dropped when no buffer is queued at
+/// the time they are due, like on a camera, so a slow consumer misses
+/// frames instead of falling behind the recording; in fast mode every
+/// frame waits for a buffer and nothing is dropped. Calibration structs
+/// stored in the recording are served by getStruct().
+///
+/// Usually not used directly: with ReplayDispatch.hpp the TY_API calls of
+/// the samples accept a replay device in place of a camera.
+class ReplayDevice
+{
+public:
+    enum Flags {
+        REPLAY_REALTIME = 0,    ///< recorded frame pace
+        REPLAY_FAST     = 1,    ///< as fast as buffers are enqueued
+        REPLAY_LOOP     = 2,    ///< restart at the end, timestamps keep increasing
+    };
+
+    struct Stats {
+        uint64_t    frames;     ///< frames delivered
+        uint64_t    dropped;    ///< real time frames without a buffer
+        int         loops;      ///< completed passes over the recording
+    };
+
+    ReplayDevice();
+    ~ReplayDevice();
+
+    TY_STATUS open(const char* path, int flags = REPLAY_REALTIME);
+    void close();
+
+    TY_DEV_HANDLE handle() { return this; }
+    /// the device of handle, NULL if it is not a replay device
+    static ReplayDevice* fromHandle(TY_DEV_HANDLE handle);
+    /// REPLAY_* from TY_REPLAY_MODE, e.g. "fast,loop"
+    static int defaultFlags();
+
+    void deviceInfo(TY_DEVICE_BASE_INFO* info) const;
+    int32_t componentIDs() const { return _components; }
+    int32_t enabledComponents() const { return _enabled; }
+    TY_STATUS enableComponents(int32_t comps);
+    TY_STATUS disableComponents(int32_t comps);
+
+    int32_t frameBufferSize() const { return _bufferSize; }
+    TY_STATUS enqueueBuffer(void* buffer, int32_t size);
+    TY_STATUS clearBufferQueue();
+
+    TY_STATUS startCapture();
+    TY_STATUS stopCapture();
+    bool isCapturing() const;
+
+    TY_STATUS fetchFrame(TY_FRAME_DATA* frame, int32_t timeout);
+
+    TY_STATUS getStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature, void* data, int32_t size) const;
+    bool hasStruct(TY_COMPONENT_ID comp, TY_FEATURE_ID feature) const;
+    /// pinhole projection with the recorded depth intrinsic
+    TY_STATUS depthToWorld(const TY_VECT_3F* depth, TY_VECT_3F* world
+            , int32_t worldPaddingBytes, int32_t pointCount) const;
+
+    Stats stats() const;
+
+private:
+    ReplayDevice(const ReplayDevice&);
+    ReplayDevice& operator=(const ReplayDevice&);
+
+    struct UserBuffer {
+        void*       data;
+        int32_t     size;
+        double      enqueuedMs;
+    };
+
+    double dueMs(int index) const;
+
+    FrameRecordReader       _reader;
+    int                     _flags;
+    int32_t                 _components;
+    int32_t                 _enabled;
+    int32_t                 _bufferSize;
+    uint64_t                _span;      // first to last timestamp plus one frame, us
+
+    mutable std::mutex      _lock;
+    std::condition_variable _wake;
+    std::deque<UserBuffer>  _buffers;
+    bool                    _capturing;
+    int                     _next;
+    int                     _loops;
+    double                  _startMs;
+    uint64_t                _frames;
+    uint64_t                _dropped;
+};
+
+
+#endif
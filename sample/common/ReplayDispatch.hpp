@@ -0,0 +1,79 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_REPLAY_DISPATCH_HPP_
+#define PERCIPIO_SAMPLE_COMMON_REPLAY_DISPATCH_HPP_
+
+// Routes the device calls of the samples through ReplayDevice: handles of
+// replay devices are served from their recording, all others go to the
+// SDK unchanged.
+//
+// A recording is opened with TYOpenDevice("path/to/file.tyrec") or
+// TYOpenDeviceWithIP with the same path. Recordings listed in the
+// TY_REPLAY environment variable (separated by ';') are also reported by
+// TYGetDeviceNumber / TYGetDeviceList, with ids "replay:0", "replay:1"...
+// so samples that pick the first device run on them unchanged.
+// TY_REPLAY_MODE selects the pacing: "realtime" (default) or "fast", add
+// ",loop" to repeat the recording.
+//
+// Define TY_REPLAY_NO_DISPATCH before including to call the SDK directly.
+
+#include "TY_API.h"
+
+TY_STATUS ReplayTYGetDeviceNumber       (int32_t* deviceNumber);
+TY_STATUS ReplayTYGetDeviceList         (TY_DEVICE_BASE_INFO* deviceInfos, int32_t bufferCount, int32_t* filledDeviceCount);
+TY_STATUS ReplayTYOpenDevice            (const char* deviceID, TY_DEV_HANDLE* deviceHandle);
+TY_STATUS ReplayTYOpenDeviceWithIP      (const char* IP, TY_DEV_HANDLE* deviceHandle);
+TY_STATUS ReplayTYCloseDevice           (TY_DEV_HANDLE hDevice);
+TY_STATUS ReplayTYGetDeviceInfo         (TY_DEV_HANDLE hDevice, TY_DEVICE_BASE_INFO* info);
+TY_STATUS ReplayTYGetComponentIDs       (TY_DEV_HANDLE hDevice, int32_t* componentIDs);
+TY_STATUS ReplayTYGetEnabledComponentIDs(TY_DEV_HANDLE hDevice, int32_t* componentIDs);
+TY_STATUS ReplayTYEnableComponents      (TY_DEV_HANDLE hDevice, int32_t componentIDs);
+TY_STATUS ReplayTYDisableComponents     (TY_DEV_HANDLE hDevice, int32_t componentIDs);
+TY_STATUS ReplayTYGetFrameBufferSize    (TY_DEV_HANDLE hDevice, int32_t* bufferSize);
+TY_STATUS ReplayTYEnqueueBuffer         (TY_DEV_HANDLE hDevice, void* buffer, int32_t bufferSize);
+TY_STATUS ReplayTYClearBufferQueue      (TY_DEV_HANDLE hDevice);
+TY_STATUS ReplayTYStartCapture          (TY_DEV_HANDLE hDevice);
+TY_STATUS ReplayTYStopCapture           (TY_DEV_HANDLE hDevice);
+TY_STATUS ReplayTYIsCapturing           (TY_DEV_HANDLE hDevice, bool* isCapturing);
+TY_STATUS ReplayTYSendSoftTrigger       (TY_DEV_HANDLE hDevice);
+TY_STATUS ReplayTYRegisterCallback      (TY_DEV_HANDLE hDevice, TY_FRAME_CALLBACK callback, void* userdata);
+TY_STATUS ReplayTYRegisterEventCallback (TY_DEV_HANDLE hDevice, TY_EVENT_CALLBACK callback, void* userdata);
+TY_STATUS ReplayTYFetchFrame            (TY_DEV_HANDLE hDevice, TY_FRAME_DATA* frame, int32_t timeout);
+TY_STATUS ReplayTYGetFeatureInfo        (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, TY_FEATURE_INFO* featureInfo);
+TY_STATUS ReplayTYGetStruct             (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, void* pStruct, int32_t structSize);
+TY_STATUS ReplayTYSetStruct             (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, void* pStruct, int32_t structSize);
+TY_STATUS ReplayTYSetInt                (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, int32_t value);
+TY_STATUS ReplayTYSetEnum               (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, int32_t value);
+TY_STATUS ReplayTYSetBool               (TY_DEV_HANDLE hDevice, TY_COMPONENT_ID componentID, TY_FEATURE_ID featureID, bool value);
+TY_STATUS ReplayTYDepthToWorld          (TY_DEV_HANDLE hDevice, const TY_VECT_3F* depth, TY_VECT_3F* world, int32_t worldPaddingBytes, int32_t pointCount);
+
+#ifndef TY_REPLAY_NO_DISPATCH
+#define TYGetDeviceNumber       ReplayTYGetDeviceNumber
+#define TYGetDeviceList         ReplayTYGetDeviceList
+#define TYOpenDevice            ReplayTYOpenDevice
+#define TYOpenDeviceWithIP      ReplayTYOpenDeviceWithIP
+#define TYCloseDevice           ReplayTYCloseDevice
+#define TYGetDeviceInfo         ReplayTYGetDeviceInfo
+#define TYGetComponentIDs       ReplayTYGetComponentIDs
+#define TYGetEnabledComponentIDs ReplayTYGetEnabledComponentIDs
+#define TYEnableComponents      ReplayTYEnableComponents
+#define TYDisableComponents     ReplayTYDisableComponents
+#define TYGetFrameBufferSize    ReplayTYGetFrameBufferSize
+#define TYEnqueueBuffer         ReplayTYEnqueueBuffer
+#define TYClearBufferQueue      ReplayTYClearBufferQueue
+#define TYStartCapture          ReplayTYStartCapture
+#define TYStopCapture           ReplayTYStopCapture
+#define TYIsCapturing           ReplayTYIsCapturing
+#define TYSendSoftTrigger       ReplayTYSendSoftTrigger
+#define TYRegisterCallback      ReplayTYRegisterCallback
+#define TYRegisterEventCallback ReplayTYRegisterEventCallback
+#define TYFetchFrame            ReplayTYFetchFrame
+#define TYGetFeatureInfo        ReplayTYGetFeatureInfo
+#define TYGetStruct             ReplayTYGetStruct
+#define TYSetStruct             ReplayTYSetStruct
+#define TYSetInt                ReplayTYSetInt
+#define TYSetEnum               ReplayTYSetEnum
+#define TYSetBool               ReplayTYSetBool
+#define TYDepthToWorld          ReplayTYDepthToWorld
+#endif
+
+
+#endif
@@ -0,0 +1,102 @@
+#include "ThreadPool.hpp"
+
+
+ThreadPool::ThreadPool(int threads)
+    : _task(NULL)
+    , _count(0)
+    , _next(0)
+    , _active(0)
+    , _generation(0)
+    , _exit(false)
+{
+    if(threads <= 0){
+        threads = (int)std::thread::hardware_concurrency();
+    }
+    for(int i = 1; i < threads; i++){
+        _workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _exit = true;
+    }
+    _wake.notify_all();
+    for(size_t i = 0; i < _workers.size(); i++){
+        _workers[i].join();
+    }
+}
+
+
+void ThreadPool::parallelFor(int count, ParallelTask& task)
+{
+    if(count <= 0){
+        return;
+    }
+    if(_workers.empty() || count == 1){
+        for(int i = 0; i < count; i++){
+            task.run(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> run(_runLock);
+    {
+        std::lock_guard<std::mutex> lk(_lock);
+        _task = &task;
+        _count = count;
+        _next = 0;
+        _active = (int)_workers.size();
+        _generation++;
+    }
+    _wake.notify_all();
+
+    runItems(&task, count);
+
+    std::unique_lock<std::mutex> lk(_lock);
+    while(_active != 0){
+        _done.wait(lk);
+    }
+    _task = NULL;
+}
+
+
+void ThreadPool::workerLoop()
+{
+    unsigned seen = 0;
+    while(true){
+        ParallelTask* task;
+        int count;
+        {
+            std::unique_lock<std::mutex> lk(_lock);
+            while(!_exit && _generation == seen){
+                _wake.wait(lk);
+            }
+            if(_exit){
+                return;
+            }
+            seen = _generation;
+            task = _task;
+            count = _count;
+        }
+
+        runItems(task, count);
+
+        std::lock_guard<std::mutex> lk(_lock);
+        if(--_active == 0){
+            _done.notify_all();
+        }
+    }
+}
+
+
+void ThreadPool::runItems(ParallelTask* task, int count)
+{
+    int i;
+    while((i = _next.fetch_add(1)) < count){
+        task->run(i);
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_THREAD_POOL_HPP_
+#define PERCIPIO_SAMPLE_COMMON_THREAD_POOL_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// Work item of ThreadPool::parallelFor, run(i) is called once for every
+/// index in [0, count), from any pool thread.
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+    virtual void run(int index) = 0;
+};
+
+
+/// Persistent fork-join pool. Threads are created once and sleep between
+/// jobs; dispatching a job does not allocate.
+class ThreadPool
+{
+public:
+    /// threads <= 0 means one thread per hardware core, the calling thread
+    /// counts as one of them
+    explicit ThreadPool(int threads = 0);
+    ~ThreadPool();
+
+    /// number of threads working on a job, including the caller
+    int size() const { return (int)_workers.size() + 1; }
+
+    /// Run task for all indices and return when all are done. Calls from
+    /// different threads are serialized, tasks must not call back into the
+    /// same pool.
+    void parallelFor(int count, ParallelTask& task);
+
+private:
+    ThreadPool(const ThreadPool&);
+    ThreadPool& operator=(const ThreadPool&);
+
+    void workerLoop();
+    void runItems(ParallelTask* task, int count);
+
+    std::vector<std::thread>    _workers;
+    std::mutex                  _runLock;
+    std::mutex                  _lock;
+    std::condition_variable     _wake;
+    std::condition_variable     _done;
+    ParallelTask*               _task;
+    int                         _count;
+    std::atomic<int>            _next;
+    int                         _active;
+    unsigned                    _generation;
+    bool                        _exit;
+};
+
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <opencv2/opencv.hpp>
 #include "TY_API.h"
+#include "FrameView.hpp"
 
 static inline const char* colorFormatName(TY_PIXEL_FORMAT fmt)
 {
@@ -34,61 +35,35 @@ static inline const TY_IMAGE_DATA* TYImageInFrame(const TY_FRAME_DATA& frame
 }
 
 
+/// colorDownscale (1, 2 or 4) shrinks the color image while it is
+/// converted. Color is written into the existing buffer of *pColor when
+/// the size matches, so keep the Mat across frames to avoid reallocating
+/// it. Outputs whose component is missing in frame are left untouched.
 static inline int parseFrame(const TY_FRAME_DATA& frame, cv::Mat* pDepth
         , cv::Mat* pLeftIR, cv::Mat* pRightIR
-        , cv::Mat* pColor, cv::Mat* pPoints)
+        , cv::Mat* pColor, cv::Mat* pPoints
+        , int colorDownscale = 1)
 {
-    for( int i = 0; i < frame.validCount; i++ ){
-        // get depth image
-        if(pDepth && frame.image[i].componentID == TY_COMPONENT_DEPTH_CAM){
-            *pDepth = cv::Mat(frame.image[i].height, frame.image[i].width
-                    , CV_16U, frame.image[i].buffer);
-        }
-        // get left ir image
-        if(pLeftIR && frame.image[i].componentID == TY_COMPONENT_IR_CAM_LEFT){
-            *pLeftIR = cv::Mat(frame.image[i].height, frame.image[i].width
-                    , CV_8U, frame.image[i].buffer);
-        }
-        // get right ir image
-        if(pRightIR && frame.image[i].componentID == TY_COMPONENT_IR_CAM_RIGHT){
-            *pRightIR = cv::Mat(frame.image[i].height, frame.image[i].width
-                    , CV_8U, frame.image[i].buffer);
-        }
-        // get BGR
-        if(pColor && frame.image[i].componentID == TY_COMPONENT_RGB_CAM){
-            if (frame.image[i].pixelFormat == TY_PIXEL_FORMAT_JPEG){
-                cv::Mat jpeg(frame.image[i].height, frame.image[i].width
-			    	    , CV_8UC1, frame.image[i].buffer);
-				*pColor = cv::imdecode(jpeg,CV_LOAD_IMAGE_COLOR);
-			}
-            if (frame.image[i].pixelFormat == TY_PIXEL_FORMAT_YVYU){
-                cv::Mat yuv(frame.image[i].height, frame.image[i].width
-                            , CV_8UC2, frame.image[i].buffer);
-                cv::cvtColor(yuv, *pColor, cv::COLOR_YUV2BGR_YVYU);
-            }
-            else if (frame.image[i].pixelFormat == TY_PIXEL_FORMAT_YUYV){
-                cv::Mat yuv(frame.image[i].height, frame.image[i].width
-                            , CV_8UC2, frame.image[i].buffer);
-                cv::cvtColor(yuv, *pColor, cv::COLOR_YUV2BGR_YUYV);
-            } else if(frame.image[i].pixelFormat == TY_PIXEL_FORMAT_RGB){
-                cv::Mat rgb(frame.image[i].height, frame.image[i].width
-                        , CV_8UC3, frame.image[i].buffer);
-                cv::cvtColor(rgb, *pColor, cv::COLOR_RGB2BGR);
-            } else if(frame.image[i].pixelFormat == TY_PIXEL_FORMAT_MONO){
-                cv::Mat gray(frame.image[i].height, frame.image[i].width
-                        , CV_8U, frame.image[i].buffer);
-                cv::cvtColor(gray, *pColor, cv::COLOR_GRAY2BGR);
-             } else if(frame.image[i].pixelFormat == TY_PIXEL_FORMAT_BAYER8GB){
-                cv::Mat raw(frame.image[i].height, frame.image[i].width
-                        , CV_8U, frame.image[i].buffer);
-                cv::cvtColor(raw, *pColor, cv::COLOR_BayerGB2BGR);
-            }
-        }
-        // get point3D
-        if(pPoints && frame.image[i].componentID == TY_COMPONENT_POINT3D_CAM){
-            *pPoints = cv::Mat(frame.image[i].height, frame.image[i].width
-                    , CV_32FC3, frame.image[i].buffer);
-        }
+    FrameView view(frame);
+    // get depth image
+    if(pDepth && view.has(TY_COMPONENT_DEPTH_CAM)){
+        *pDepth = view.depth16();
+    }
+    // get left ir image
+    if(pLeftIR && view.has(TY_COMPONENT_IR_CAM_LEFT)){
+        *pLeftIR = view.mono8(TY_COMPONENT_IR_CAM_LEFT);
+    }
+    // get right ir image
+    if(pRightIR && view.has(TY_COMPONENT_IR_CAM_RIGHT)){
+        *pRightIR = view.mono8(TY_COMPONENT_IR_CAM_RIGHT);
+    }
+    // get BGR
+    if(pColor && view.has(TY_COMPONENT_RGB_CAM)){
+        colorImageToBGR(*view.image(TY_COMPONENT_RGB_CAM), *pColor, colorDownscale);
+    }
+    // get point3D
+    if(pPoints && view.has(TY_COMPONENT_POINT3D_CAM)){
+        *pPoints = view.point3f();
     }
 
     return 0;
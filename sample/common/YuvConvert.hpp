@@ -0,0 +1,237 @@
+#ifndef PERCIPIO_SAMPLE_COMMON_YUV_CONVERT_HPP_
+#define PERCIPIO_SAMPLE_COMMON_YUV_CONVERT_HPP_
+
+#include <opencv2/opencv.hpp>
+#include <string.h>
+#include "TY_API.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  include <emmintrin.h>
+#  define YUV_CONVERT_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#  include <arm_neon.h>
+#  define YUV_CONVERT_NEON
+#endif
+
+/// Packed YUV422 (YUYV / YVYU) to BGR24, BT.601 video range like
+/// cv::COLOR_YUV2BGR_YUYV. The output is written into a caller owned Mat
+/// which is only reallocated when its size changes, and an optional 2x or
+/// 4x downscale is fused into the same pass, so the full resolution BGR
+/// image is never built.
+
+enum YuvScaleMode {
+    YUV_SCALE_BOX = 0,      ///< mean of each scale x scale block, like INTER_AREA
+    YUV_SCALE_BILINEAR = 1, ///< sample at the block center, like INTER_LINEAR
+};
+
+enum {
+    kYuvShift   = 13,
+    kYuvRound   = 1 << (kYuvShift - 1),
+    kYuvCY      = 9535,     // 1.164
+    kYuvCUB     = 16531,    // 2.018
+    kYuvCUG     = -3203,    // -0.391
+    kYuvCVG     = -6660,    // -0.813
+    kYuvCVR     = 13074,    // 1.596
+    kYuvChunk   = 256,      // output pixels converted per step
+};
+
+static inline uint8_t yuvClamp(int v)
+{
+    return (uint8_t)(v < 0 ? 0 : (v > 255 ? 255 : v));
+}
+
+/// Scalar reference of yuvToBGRRow, y is max(Y - 16, 0), u and v are
+/// centered on 0.
+static inline void yuvToBGRPixel(int y, int u, int v, uint8_t* bgr)
+{
+    int yy = y * kYuvCY + kYuvRound;
+    bgr[0] = yuvClamp((yy + kYuvCUB * u) >> kYuvShift);
+    bgr[1] = yuvClamp((yy + kYuvCUG * u + kYuvCVG * v) >> kYuvShift);
+    bgr[2] = yuvClamp((yy + kYuvCVR * v) >> kYuvShift);
+}
+
+/// Convert n planar samples to packed BGR24, same result as yuvToBGRPixel.
+static inline void yuvToBGRRow(const int16_t* y, const int16_t* u
+        , const int16_t* v, int n, uint8_t* dst)
+{
+    int i = 0;
+#if defined(YUV_CONVERT_SSE2)
+    const __m128i kB = _mm_set1_epi32((int)(((uint32_t)(uint16_t)kYuvCUB << 16) | (uint16_t)kYuvCY));
+    const __m128i kG = _mm_set1_epi32((int)(((uint32_t)(uint16_t)kYuvCUG << 16) | (uint16_t)kYuvCY));
+    const __m128i kGV = _mm_set1_epi32((int)((uint32_t)(uint16_t)kYuvCVG << 16));
+    const __m128i kR = _mm_set1_epi32((int)(((uint32_t)(uint16_t)kYuvCVR << 16) | (uint16_t)kYuvCY));
+    const __m128i round = _mm_set1_epi32(kYuvRound);
+    const __m128i zero = _mm_setzero_si128();
+    uint8_t packed[32];
+    // the last pixel of the row is left to the scalar tail, the 4 byte
+    // stores below write one byte past each pixel
+    for(; i + 8 < n; i += 8){
+        __m128i y8 = _mm_loadu_si128((const __m128i*)(y + i));
+        __m128i u8 = _mm_loadu_si128((const __m128i*)(u + i));
+        __m128i v8 = _mm_loadu_si128((const __m128i*)(v + i));
+        __m128i yuL = _mm_unpacklo_epi16(y8, u8);
+        __m128i yuH = _mm_unpackhi_epi16(y8, u8);
+        __m128i yvL = _mm_unpacklo_epi16(y8, v8);
+        __m128i yvH = _mm_unpackhi_epi16(y8, v8);
+
+        __m128i bL = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuL, kB), round), kYuvShift);
+        __m128i bH = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yuH, kB), round), kYuvShift);
+        __m128i gL = _mm_add_epi32(_mm_madd_epi16(yuL, kG), _mm_madd_epi16(yvL, kGV));
+        __m128i gH = _mm_add_epi32(_mm_madd_epi16(yuH, kG), _mm_madd_epi16(yvH, kGV));
+        gL = _mm_srai_epi32(_mm_add_epi32(gL, round), kYuvShift);
+        gH = _mm_srai_epi32(_mm_add_epi32(gH, round), kYuvShift);
+        __m128i rL = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvL, kR), round), kYuvShift);
+        __m128i rH = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(yvH, kR), round), kYuvShift);
+
+        __m128i b = _mm_packus_epi16(_mm_packs_epi32(bL, bH), zero);
+        __m128i g = _mm_packus_epi16(_mm_packs_epi32(gL, gH), zero);
+        __m128i r = _mm_packus_epi16(_mm_packs_epi32(rL, rH), zero);
+        __m128i bg = _mm_unpacklo_epi8(b, g);
+        __m128i r0 = _mm_unpacklo_epi8(r, zero);
+        _mm_storeu_si128((__m128i*)packed, _mm_unpacklo_epi16(bg, r0));
+        _mm_storeu_si128((__m128i*)(packed + 16), _mm_unpackhi_epi16(bg, r0));
+        uint8_t* out = dst + i * 3;
+        for(int k = 0; k < 8; k++){
+            memcpy(out + k * 3, packed + k * 4, 4);
+        }
+    }
+#elif defined(YUV_CONVERT_NEON)
+    for(; i + 8 <= n; i += 8){
+        int16x8_t y8 = vld1q_s16(y + i);
+        int16x8_t u8 = vld1q_s16(u + i);
+        int16x8_t v8 = vld1q_s16(v + i);
+        int32x4_t yL = vmull_n_s16(vget_low_s16(y8), kYuvCY);
+        int32x4_t yH = vmull_n_s16(vget_high_s16(y8), kYuvCY);
+
+        int32x4_t bL = vmlal_n_s16(yL, vget_low_s16(u8), kYuvCUB);
+        int32x4_t bH = vmlal_n_s16(yH, vget_high_s16(u8), kYuvCUB);
+        int32x4_t gL = vmlal_n_s16(vmlal_n_s16(yL, vget_low_s16(u8), kYuvCUG), vget_low_s16(v8), kYuvCVG);
+        int32x4_t gH = vmlal_n_s16(vmlal_n_s16(yH, vget_high_s16(u8), kYuvCUG), vget_high_s16(v8), kYuvCVG);
+        int32x4_t rL = vmlal_n_s16(yL, vget_low_s16(v8), kYuvCVR);
+        int32x4_t rH = vmlal_n_s16(yH, vget_high_s16(v8), kYuvCVR);
+
+        uint8x8x3_t bgr;
+        bgr.val[0] = vqmovun_s16(vcombine_s16(vqmovn_s32(vrshrq_n_s32(bL, kYuvShift)), vqmovn_s32(vrshrq_n_s32(bH, kYuvShift))));
+        bgr.val[1] = vqmovun_s16(vcombine_s16(vqmovn_s32(vrshrq_n_s32(gL, kYuvShift)), vqmovn_s32(vrshrq_n_s32(gH, kYuvShift))));
+        bgr.val[2] = vqmovun_s16(vcombine_s16(vqmovn_s32(vrshrq_n_s32(rL, kYuvShift)), vqmovn_s32(vrshrq_n_s32(rH, kYuvShift))));
+        vst3_u8(dst + i * 3, bgr);
+    }
+#endif
+    for(; i < n; i++){
+        yuvToBGRPixel(y[i], u[i], v[i], dst + i * 3);
+    }
+}
+
+/// Unpack n pixels of one YUV422 row starting at pixel x0 (even).
+static inline void yuv422GatherRow(const uint8_t* row, int x0, int n
+        , int uoff, int voff, int16_t* y, int16_t* u, int16_t* v)
+{
+    const uint8_t* p = row + x0 * 2;
+    for(int k = 0; k + 1 < n; k += 2, p += 4){
+        int cu = p[uoff] - 128;
+        int cv = p[voff] - 128;
+        y[k] = (int16_t)(p[0] > 16 ? p[0] - 16 : 0);
+        y[k + 1] = (int16_t)(p[2] > 16 ? p[2] - 16 : 0);
+        u[k] = u[k + 1] = (int16_t)cu;
+        v[k] = v[k + 1] = (int16_t)cv;
+    }
+    if(n & 1){
+        y[n - 1] = (int16_t)(p[0] > 16 ? p[0] - 16 : 0);
+        u[n - 1] = (int16_t)(p[uoff] - 128);
+        v[n - 1] = (int16_t)(p[voff] - 128);
+    }
+}
+
+/// Average taps x taps source pixels per output pixel. rows holds the taps
+/// source rows, output pixel k reads columns (ox0 + k) * step + offset on.
+static inline void yuv422GatherScaled(const uint8_t* const* rows, int taps
+        , int ox0, int n, int step, int offset, int uoff, int voff
+        , int16_t* y, int16_t* u, int16_t* v)
+{
+    if(taps == 2 && step == 2){
+        // 2x box: one macropixel of two rows per output pixel
+        const uint8_t* p0 = rows[0] + ox0 * 4;
+        const uint8_t* p1 = rows[1] + ox0 * 4;
+        for(int k = 0; k < n; k++, p0 += 4, p1 += 4){
+            int yy = ((p0[0] + p0[2] + p1[0] + p1[2] + 2) >> 2) - 16;
+            y[k] = (int16_t)(yy > 0 ? yy : 0);
+            u[k] = (int16_t)(((p0[uoff] + p1[uoff] + 1) >> 1) - 128);
+            v[k] = (int16_t)(((p0[voff] + p1[voff] + 1) >> 1) - 128);
+        }
+        return;
+    }
+
+    const int shift = taps == 4 ? 4 : 2;
+    const int half = 1 << (shift - 1);
+    for(int k = 0; k < n; k++){
+        int x0 = (ox0 + k) * step + offset;
+        int ys = 0, us = 0, vs = 0;
+        for(int r = 0; r < taps; r++){
+            const uint8_t* p = rows[r];
+            for(int c = x0; c < x0 + taps; c++){
+                const uint8_t* m = p + (c >> 1) * 4;
+                ys += p[c * 2];
+                us += m[uoff];
+                vs += m[voff];
+            }
+        }
+        int yy = ((ys + half) >> shift) - 16;
+        y[k] = (int16_t)(yy > 0 ? yy : 0);
+        u[k] = (int16_t)(((us + half) >> shift) - 128);
+        v[k] = (int16_t)(((vs + half) >> shift) - 128);
+    }
+}
+
+/// Output size of yuv422ToBGR for a width x height source.
+static inline cv::Size yuv422ScaledSize(int width, int height, int scale)
+{
+    return cv::Size(width / scale, height / scale);
+}
+
+/// Convert a packed YUV422 image into dst, downscaled by scale (1, 2 or 4).
+/// dst is (re)created as CV_8UC3 of yuv422ScaledSize. Returns false if the
+/// format or scale is not supported.
+static inline bool yuv422ToBGR(const uint8_t* src, int width, int height
+        , TY_PIXEL_FORMAT fmt, cv::Mat& dst, int scale = 1
+        , YuvScaleMode mode = YUV_SCALE_BOX)
+{
+    int uoff, voff;
+    if(fmt == TY_PIXEL_FORMAT_YUYV){
+        uoff = 1; voff = 3;
+    } else if(fmt == TY_PIXEL_FORMAT_YVYU){
+        uoff = 3; voff = 1;
+    } else {
+        return false;
+    }
+    if(scale != 1 && scale != 2 && scale != 4){
+        return false;
+    }
+
+    // box averages the whole block, bilinear the 2x2 pixels around its center
+    const int taps = (mode == YUV_SCALE_BOX || scale == 1) ? scale : 2;
+    const int offset = (scale - taps) / 2;
+    const cv::Size size = yuv422ScaledSize(width, height, scale);
+    const size_t stride = (size_t)width * 2;
+    dst.create(size, CV_8UC3);
+
+    int16_t y[kYuvChunk], u[kYuvChunk], v[kYuvChunk];
+    const uint8_t* rows[4];
+    for(int oy = 0; oy < size.height; oy++){
+        for(int r = 0; r < taps; r++){
+            rows[r] = src + (size_t)(oy * scale + offset + r) * stride;
+        }
+        uint8_t* out = dst.ptr<uint8_t>(oy);
+        for(int ox = 0; ox < size.width; ox += kYuvChunk){
+            int n = size.width - ox < kYuvChunk ? size.width - ox : kYuvChunk;
+            if(scale == 1){
+                yuv422GatherRow(rows[0], ox, n, uoff, voff, y, u, v);
+            } else {
+                yuv422GatherScaled(rows, taps, ox, n, scale, offset, uoff, voff, y, u, v);
+            }
+            yuvToBGRRow(y, u, v, n, out + ox * 3);
+        }
+    }
+    return true;
+}
+
+#endif
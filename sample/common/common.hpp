@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "TY_API.h"
+#include "ReplayDispatch.hpp"
+#include "Clock.hpp"
 
 #ifndef ASSERT
 #define ASSERT(x)   do{ \
@@ -31,7 +33,8 @@
 #ifdef _WIN32
 # include <windows.h>
 # include <time.h>
-  static inline int32_t getSystemTime()
+  /// wall clock milliseconds, use monotonicNs() for intervals
+  static inline int64_t getSystemTime()
   {
       SYSTEMTIME wtm;
       struct tm tm;
@@ -43,7 +46,7 @@
       tm.tm_min     = wtm.wMinute;
       tm.tm_sec     = wtm.wSecond;
       tm. tm_isdst    = -1;
-      return mktime(&tm) * 1000 + wtm.wMilliseconds;
+      return (int64_t)mktime(&tm) * 1000 + wtm.wMilliseconds;
   }
   static inline void MSleep(uint32_t ms)
   {
@@ -52,11 +55,12 @@
 #else
 # include <sys/time.h>
 # include <unistd.h>
-  inline int32_t getSystemTime()
+  /// wall clock milliseconds, use monotonicNs() for intervals
+  inline int64_t getSystemTime()
   {
       struct timeval tv;
       gettimeofday(&tv, NULL);
-      return tv.tv_sec*1000 + tv.tv_usec/1000;
+      return (int64_t)tv.tv_sec*1000 + tv.tv_usec/1000;
   }
   static inline void MSleep(uint32_t ms)
   {
@@ -65,10 +69,13 @@
 #endif
 
 
-#define LOGD(fmt,...)  printf("%d " fmt "\n", getSystemTime(), ##__VA_ARGS__)
-#define LOGI(fmt,...)  printf("%d " fmt "\n", getSystemTime(), ##__VA_ARGS__)
-#define LOGW(fmt,...)  printf("%d " fmt "\n", getSystemTime(), ##__VA_ARGS__)
-#define LOGE(fmt,...)  printf("%d Error: " fmt "\n", getSystemTime(), ##__VA_ARGS__)
+// log lines carry monotonic milliseconds, they keep their order when the
+// wall clock is set
+#define LOG_TIME()     ((long long)(monotonicNs() / 1000000))
+#define LOGD(fmt,...)  printf("%lld " fmt "\n", LOG_TIME(), ##__VA_ARGS__)
+#define LOGI(fmt,...)  printf("%lld " fmt "\n", LOG_TIME(), ##__VA_ARGS__)
+#define LOGW(fmt,...)  printf("%lld " fmt "\n", LOG_TIME(), ##__VA_ARGS__)
+#define LOGE(fmt,...)  printf("%lld Error: " fmt "\n", LOG_TIME(), ##__VA_ARGS__)
 #define xLOGD(fmt,...)
 #define xLOGI(fmt,...)
 #define xLOGW(fmt,...)
@@ -92,8 +99,21 @@
 #endif
 
 #include "Utils.hpp"
+#include "CaptureEngine.hpp"
+#include "ColorToDepth.hpp"
+#include "DepthCodec.hpp"
+#include "DepthRegistration.hpp"
 #include "DepthRender.hpp"
+#include "DepthToWorld.hpp"
+#include "FrameBufferPool.hpp"
+#include "FrameRecord.hpp"
+#include "FramesetSync.hpp"
+#include "JpegDecoder.hpp"
+#include "LatencyTrace.hpp"
 #include "MatViewer.hpp"
+#include "MultiDeviceCapture.hpp"
 #include "PointCloudViewer.hpp"
+#include "PointCloudWriter.hpp"
+#include "ReplayDevice.hpp"
 
 #endif